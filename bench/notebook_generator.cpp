@@ -0,0 +1,165 @@
+#include "notebook_generator.h"
+#include "../src/core/page.h"
+#include "../src/core/textobject.h"
+#include "../src/core/drawingobject.h"
+#include <QColor>
+#include <QDateTime>
+#include <QFont>
+#include <QPainterPath>
+#include <QPen>
+
+namespace {
+
+const QSize PageSize(800, 600);
+const int Margin = 50;
+
+} // namespace
+
+QJsonObject NotebookGenerator::Options::toJson() const
+{
+    QJsonObject json;
+    json["documents"] = documents;
+    json["pages"] = pages;
+    json["textObjects"] = textObjects;
+    json["drawings"] = drawings;
+    json["strokes"] = strokes;
+    json["points"] = points;
+    json["seed"] = static_cast<qint64>(seed);
+    return json;
+}
+
+NotebookGenerator::NotebookGenerator(const Options &options)
+    : m_options(options)
+    , m_random(options.seed)
+{
+}
+
+QStringList NotebookGenerator::tagPool()
+{
+    return {"work", "personal", "ideas", "research", "meeting", "draft", "archive", "reading"};
+}
+
+QStringList NotebookGenerator::vocabulary()
+{
+    return {"notes", "drawing", "markdown", "storage", "page", "object", "layer", "stroke",
+            "pen", "highlighter", "canvas", "project", "meeting", "summary", "design", "review",
+            "budget", "schedule", "research", "outline", "sketch", "diagram", "question", "answer",
+            "release", "feature", "database", "backup", "search", "index", "shortcut", "theme"};
+}
+
+std::shared_ptr<Document> NotebookGenerator::generate(int index)
+{
+    auto document = std::make_shared<Document>(QString("Synthetic Notebook %1").arg(index + 1));
+    document->setDescription(words(12));
+
+    // Each document gets two tags from the pool, so a tag matches about a quarter of them
+    const QStringList tags = tagPool();
+    document->addTag("synthetic");
+    document->addTag(tags[index % tags.size()]);
+    document->addTag(tags[(index * 3 + 1) % tags.size()]);
+
+    QStringList pageTitles;
+    for (int i = 0; i < m_options.pages; ++i) {
+        pageTitles.append(QString("Page %1 %2").arg(i + 1).arg(words(1)));
+    }
+
+    const int slots = qMax(1, m_options.textObjects + m_options.drawings);
+    const int slotHeight = qMax(40, (PageSize.height() - 2 * Margin) / slots);
+
+    for (int i = 0; i < m_options.pages; ++i) {
+        auto page = std::make_shared<Page>(pageTitles[i]);
+        page->setSize(PageSize);
+        page->setBackgroundColor(Qt::white);
+
+        int slot = 0;
+        for (int j = 0; j < m_options.textObjects; ++j, ++slot) {
+            auto text = textObject(j, pageTitles);
+            text->setBounds(QRect(Margin, Margin + slot * slotHeight, PageSize.width() - 2 * Margin, slotHeight));
+            page->addObject(text);
+        }
+        for (int j = 0; j < m_options.drawings; ++j, ++slot) {
+            page->addObject(drawingObject(QRect(Margin, Margin + slot * slotHeight, 300, slotHeight)));
+        }
+
+        document->addPage(page);
+    }
+
+    return document;
+}
+
+QString NotebookGenerator::words(int count)
+{
+    const QStringList words = vocabulary();
+    QStringList picked;
+    for (int i = 0; i < count; ++i) {
+        picked.append(words[m_random.bounded(words.size())]);
+    }
+    return picked.join(QLatin1Char(' '));
+}
+
+QString NotebookGenerator::paragraph()
+{
+    QString text = words(1);
+    text[0] = text[0].toUpper();
+    return text + QLatin1Char(' ') + words(8 + m_random.bounded(16)) + QLatin1Char('.');
+}
+
+std::shared_ptr<TextObject> NotebookGenerator::textObject(int index, const QStringList &pageTitles)
+{
+    // Headings, bullet lists and the odd [[wiki link]], like the example notebook
+    QString content = QString("## %1\n\n%2").arg(words(3), paragraph());
+    const int bullets = m_random.bounded(5);
+    if (bullets > 0) {
+        content += QLatin1String("\n");
+        for (int i = 0; i < bullets; ++i) {
+            content += QString("\n- **%1**: %2").arg(words(1), paragraph());
+        }
+    }
+    if (!pageTitles.isEmpty() && m_random.bounded(4) == 0) {
+        content += QString("\n\nSee [[%1]].").arg(pageTitles[m_random.bounded(pageTitles.size())]);
+    }
+
+    auto text = std::make_shared<TextObject>();
+    text->setMarkdownMode(true);
+    text->setContent(content);
+    text->setFont(QFont("Arial", index == 0 ? 18 : 12, index == 0 ? QFont::Bold : QFont::Normal));
+    text->setTextColor(Qt::black);
+    text->setBackgroundColor(Qt::white);
+    text->setAlignment(Qt::AlignLeft);
+    return text;
+}
+
+std::shared_ptr<DrawingObject> NotebookGenerator::drawingObject(const QRect &bounds)
+{
+    static const QColor penColors[] = {QColor("#0066cc"), QColor("#cc3300"), QColor("#000000"), QColor("#009933")};
+
+    auto drawing = std::make_shared<DrawingObject>();
+    drawing->setBounds(bounds);
+
+    const qint64 start = QDateTime(QDate(2024, 1, 1), QTime(0, 0)).toMSecsSinceEpoch();
+    for (int i = 0; i < m_options.strokes; ++i) {
+        DrawingObject::Stroke stroke;
+        stroke.mode = m_random.bounded(5) == 0 ? DrawingObject::HighlighterMode : DrawingObject::PenMode;
+        stroke.timestamp = start + i * 1000;
+        if (stroke.mode == DrawingObject::HighlighterMode) {
+            stroke.pen = QPen(QColor("#ffff00"), 8, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin);
+        } else {
+            stroke.pen = QPen(penColors[m_random.bounded(4)], 3, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin);
+        }
+
+        // A bounded random walk, so paths look like handwriting rather than noise
+        QPointF point(bounds.left() + m_random.bounded(bounds.width()),
+                      bounds.top() + m_random.bounded(bounds.height()));
+        stroke.path.moveTo(point);
+        for (int j = 1; j < m_options.points; ++j) {
+            point += QPointF(m_random.bounded(9) - 4, m_random.bounded(9) - 4);
+            point.setX(qBound<qreal>(bounds.left(), point.x(), bounds.right()));
+            point.setY(qBound<qreal>(bounds.top(), point.y(), bounds.bottom()));
+            stroke.path.lineTo(point);
+        }
+
+        drawing->addStroke(stroke);
+    }
+
+    return drawing;
+}
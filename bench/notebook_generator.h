@@ -0,0 +1,59 @@
+#ifndef NOTEBOOK_GENERATOR_H
+#define NOTEBOOK_GENERATOR_H
+
+#include "../src/core/document.h"
+#include <QJsonObject>
+#include <QRect>
+#include <QRandomGenerator>
+#include <QString>
+#include <QStringList>
+#include <memory>
+
+class DrawingObject;
+class TextObject;
+
+/**
+ * @brief Builds synthetic notebooks for the storage benchmarks
+ *
+ * Documents are modeled on example_notebook.json: pages of markdown text
+ * blocks and pen or highlighter drawings, with a few tags per document.
+ * Every size is configurable and the output only depends on the seed, so
+ * runs with the same options can be compared across builds.
+ */
+class NotebookGenerator
+{
+public:
+    struct Options {
+        int documents = 20;
+        int pages = 50;             // per document
+        int textObjects = 4;        // per page
+        int drawings = 1;           // per page
+        int strokes = 20;           // per drawing
+        int points = 40;            // per stroke
+        quint32 seed = 1;
+
+        QJsonObject toJson() const;
+    };
+
+    explicit NotebookGenerator(const Options &options);
+
+    const Options &options() const { return m_options; }
+
+    // The index-th document; documents must be generated in order to be reproducible
+    std::shared_ptr<Document> generate(int index);
+
+    // Tags handed out to documents and words used in text, for building queries
+    static QStringList tagPool();
+    static QStringList vocabulary();
+
+private:
+    Options m_options;
+    QRandomGenerator m_random;
+
+    QString words(int count);
+    QString paragraph();
+    std::shared_ptr<TextObject> textObject(int index, const QStringList &pageTitles);
+    std::shared_ptr<DrawingObject> drawingObject(const QRect &bounds);
+};
+
+#endif // NOTEBOOK_GENERATOR_H
@@ -0,0 +1,545 @@
+#include "../src/core/document.h"
+#include "../src/core/page.h"
+#include "../src/core/blobcodec.h"
+#include "../src/core/storage.h"
+#include "notebook_generator.h"
+#include <QApplication>
+#include <QCommandLineParser>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryDir>
+#include <QThreadPool>
+#include <QUuid>
+#include <QVector>
+#include <QDebug>
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+
+#ifndef NOTESAPP_SOURCE_DIR
+#define NOTESAPP_SOURCE_DIR "."
+#endif
+
+/**
+ * Storage benchmarks for NotesApp.
+ *
+ * Usage: notes_bench [notebook.json] [scale]
+ *        notes_bench --suite [--documents N] [--pages N] [--texts N]
+ *                    [--drawings N] [--strokes N] [--points N] [--seed N]
+ *                    [--repeat N] [--json report.json]
+ *
+ * Loads a notebook (example_notebook.json by default), replicates its pages
+ * `scale` times (1000 by default) and compares the JSON and binary blob
+ * encodings by total size and encode/decode time. The binary encoding is
+ * measured uncompressed, with zlib and, when built with zstd, with zstd
+ * with and without a dictionary trained on the pages; the per-page columns
+ * give the CPU cost of encoding and decoding one page. Replicated pages make
+ * the dictionary ratio optimistic.
+ *
+ * It then saves and reloads the scaled notebook through Storage in a
+ * temporary database, once with the statement cache and pragmas disabled
+ * and once with them enabled, and reports save and load throughput. The
+ * tuned run is repeated with a single pool thread, which shows how much of
+ * the load time the parallel object decoding saves.
+ *
+ * With --suite it instead generates synthetic notebooks of the given size
+ * and times the main Storage operations on them: saveDocument (first write
+ * and full rewrite), loadDocument (full and lazy), loadPage, searchDocuments, findDocumentsByTag and
+ * createBackup. Every operation reports latency percentiles, and --json
+ * writes the report as JSON ("-" for stdout) for tracking across releases.
+ */
+
+namespace {
+
+struct CodecResult {
+    qint64 bytes = 0;
+    qint64 encodeNs = 0;
+    qint64 decodeNs = 0;
+    int pages = 0;
+};
+
+struct StorageResult {
+    qint64 fullSaveMs = 0;
+    qint64 incrementalSaveMs = 0;
+    qint64 loadMs = 0;
+    int incrementalSaves = 0;
+};
+
+std::shared_ptr<Document> loadNotebook(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return nullptr;
+    }
+    
+    QJsonDocument doc = QJsonDocument::fromJson(file.readAll());
+    if (doc.isNull()) {
+        return nullptr;
+    }
+    
+    auto document = std::make_shared<Document>();
+    document->fromJson(doc.object());
+    return document;
+}
+
+QVector<std::shared_ptr<Page>> scalePages(std::shared_ptr<Document> document, int scale)
+{
+    QVector<std::shared_ptr<Page>> pages;
+    pages.reserve(document->pages().size() * scale);
+    
+    for (int i = 0; i < scale; ++i) {
+        for (const auto &page : document->pages()) {
+            std::shared_ptr<Page> copy(page->clone().release());
+            copy->setId(QUuid::createUuid().toString(QUuid::WithoutBraces));
+            pages.append(copy);
+        }
+    }
+    
+    return pages;
+}
+
+CodecResult benchJson(const QVector<std::shared_ptr<Page>> &pages)
+{
+    CodecResult result;
+    result.pages = pages.size();
+    QVector<QByteArray> blobs;
+    blobs.reserve(pages.size());
+    
+    QElapsedTimer timer;
+    timer.start();
+    for (const auto &page : pages) {
+        blobs.append(QJsonDocument(page->toJson()).toJson(QJsonDocument::Compact));
+    }
+    result.encodeNs = timer.nsecsElapsed();
+    
+    timer.restart();
+    for (const QByteArray &blob : blobs) {
+        Page page;
+        page.fromJson(QJsonDocument::fromJson(blob).object());
+        result.bytes += blob.size();
+    }
+    result.decodeNs = timer.nsecsElapsed();
+    
+    return result;
+}
+
+CodecResult benchBinary(const QVector<std::shared_ptr<Page>> &pages)
+{
+    CodecResult result;
+    result.pages = pages.size();
+    QVector<QByteArray> blobs;
+    blobs.reserve(pages.size());
+    
+    QElapsedTimer timer;
+    timer.start();
+    for (const auto &page : pages) {
+        blobs.append(BlobCodec::encodePage(*page));
+    }
+    result.encodeNs = timer.nsecsElapsed();
+    
+    timer.restart();
+    for (const QByteArray &blob : blobs) {
+        Page page;
+        BlobCodec::decodePage(blob, page);
+        result.bytes += blob.size();
+    }
+    result.decodeNs = timer.nsecsElapsed();
+    
+    return result;
+}
+
+StorageResult benchStorage(const QVector<std::shared_ptr<Page>> &pages, bool tuned)
+{
+    StorageResult result;
+    
+    QTemporaryDir dir;
+    Storage storage;
+    storage.setTuningEnabled(tuned);
+    if (!dir.isValid() || !storage.initialize(dir.filePath("bench.db"))) {
+        qWarning() << "Failed to open benchmark database";
+        return result;
+    }
+    
+    auto document = std::make_shared<Document>("Benchmark");
+    for (const auto &page : pages) {
+        std::shared_ptr<Page> copy(page->clone().release());
+        copy->setId(page->id());
+        document->addPage(copy);
+    }
+    
+    // One save that writes every page
+    QElapsedTimer timer;
+    timer.start();
+    storage.saveDocument(document);
+    result.fullSaveMs = timer.elapsed();
+    
+    // Many small saves, each nudging one object (or renaming an empty page);
+    // this is where re-preparing statements and syncing every commit show up
+    result.incrementalSaves = qMin(500, static_cast<int>(document->pages().size()));
+    timer.restart();
+    for (int i = 0; i < result.incrementalSaves; ++i) {
+        auto page = document->pageAt(i);
+        if (!page->objects().isEmpty()) {
+            auto object = page->objects().first();
+            object->setBounds(object->bounds().translated(1, 0));
+        } else {
+            page->setTitle(page->title() + QLatin1Char('.'));
+        }
+        storage.saveDocument(document);
+    }
+    result.incrementalSaveMs = timer.elapsed();
+    
+    timer.restart();
+    auto loaded = storage.loadDocument(document->id(), Storage::LoadFull);
+    result.loadMs = timer.elapsed();
+    if (!loaded || loaded->pages().size() != document->pages().size()) {
+        qWarning() << "Benchmark document did not round-trip";
+    }
+    
+    storage.close();
+    return result;
+}
+
+void printStorageResult(const char *name, const StorageResult &result, int pageCount)
+{
+    auto perSecond = [](int count, qint64 ms) {
+        return ms > 0 ? count * 1000.0 / ms : 0.0;
+    };
+    
+    std::printf("%-8s %10lld %12.0f %10lld %12.0f %10lld %12.0f\n", name,
+                static_cast<long long>(result.fullSaveMs), perSecond(pageCount, result.fullSaveMs),
+                static_cast<long long>(result.incrementalSaveMs),
+                perSecond(result.incrementalSaves, result.incrementalSaveMs),
+                static_cast<long long>(result.loadMs), perSecond(pageCount, result.loadMs));
+}
+
+QByteArray trainPageDictionary(const QVector<std::shared_ptr<Page>> &pages)
+{
+    QVector<QByteArray> samples;
+    for (int i = 0; i < pages.size() && i < 4000; ++i) {
+        samples.append(BlobCodec::payload(BlobCodec::encodePage(*pages[i])));
+    }
+    return BlobCodec::trainDictionary(samples);
+}
+
+void printResult(const char *name, const CodecResult &result)
+{
+    auto perPage = [&result](qint64 ns) {
+        return result.pages > 0 ? ns / 1000.0 / result.pages : 0.0;
+    };
+    
+    std::printf("%-10s %14lld %12lld %12lld %10.2f %10.2f\n", name,
+                static_cast<long long>(result.bytes),
+                static_cast<long long>(result.encodeNs / 1000000),
+                static_cast<long long>(result.decodeNs / 1000000),
+                perPage(result.encodeNs), perPage(result.decodeNs));
+}
+
+// Latencies of one operation in the suite
+struct OperationResult {
+    QString name;
+    QVector<qint64> samplesNs;
+    int failures = 0;
+    
+    QJsonObject toJson() const
+    {
+        QVector<qint64> sorted = samplesNs;
+        std::sort(sorted.begin(), sorted.end());
+        
+        auto percentileUs = [&sorted](double fraction) {
+            if (sorted.isEmpty()) {
+                return 0.0;
+            }
+            const int count = sorted.size();
+            const int index = qBound(0, static_cast<int>(fraction * count), count - 1);
+            return sorted[index] / 1000.0;
+        };
+        
+        qint64 totalNs = 0;
+        for (qint64 sample : sorted) {
+            totalNs += sample;
+        }
+        
+        QJsonObject json;
+        json["name"] = name;
+        json["iterations"] = static_cast<int>(sorted.size());
+        json["failures"] = failures;
+        json["totalMs"] = totalNs / 1000000.0;
+        json["meanUs"] = sorted.isEmpty() ? 0.0 : totalNs / 1000.0 / sorted.size();
+        json["minUs"] = percentileUs(0.0);
+        json["p50Us"] = percentileUs(0.5);
+        json["p95Us"] = percentileUs(0.95);
+        json["maxUs"] = percentileUs(1.0);
+        return json;
+    }
+};
+
+// Times one call of the operation; a false result counts as a failure
+template <typename Function>
+void measure(OperationResult &result, Function function)
+{
+    QElapsedTimer timer;
+    timer.start();
+    bool ok = function();
+    result.samplesNs.append(timer.nsecsElapsed());
+    if (!ok) {
+        ++result.failures;
+    }
+}
+
+QJsonObject runSuite(const NotebookGenerator::Options &options, int repeat)
+{
+    QJsonObject report;
+    report["benchmark"] = "notes_bench";
+    report["formatVersion"] = 1;
+    report["timestamp"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+    report["qtVersion"] = QString::fromLatin1(qVersion());
+    report["threads"] = QThreadPool::globalInstance()->maxThreadCount();
+    report["zstd"] = BlobCodec::hasZstd();
+    report["generator"] = options.toJson();
+    report["repeat"] = repeat;
+    
+    QTemporaryDir dir;
+    Storage storage;
+    if (!dir.isValid() || !storage.initialize(dir.filePath("suite.db"))) {
+        qWarning() << "Failed to open benchmark database";
+        report["error"] = "Failed to open benchmark database";
+        return report;
+    }
+    
+    NotebookGenerator generator(options);
+    QVector<std::shared_ptr<Document>> documents;
+    QStringList pageIds;
+    
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < options.documents; ++i) {
+        documents.append(generator.generate(i));
+        for (const auto &page : documents.last()->pages()) {
+            pageIds.append(page->id());
+        }
+    }
+    report["generateMs"] = timer.elapsed();
+    
+    OperationResult save{"saveDocument"};
+    OperationResult rewrite{"saveDocument.rewrite"};
+    OperationResult loadFull{"loadDocument.full"};
+    OperationResult loadLazy{"loadDocument.lazy"};
+    OperationResult loadPage{"loadPage"};
+    OperationResult search{"searchDocuments"};
+    OperationResult byTag{"findDocumentsByTag"};
+    OperationResult backup{"createBackup"};
+    
+    // The first save inserts every row; later rounds mark every page for a
+    // full rewrite, so each round replaces the same rows
+    for (const auto &document : documents) {
+        measure(save, [&]() { return storage.saveDocument(document); });
+    }
+    for (int round = 0; round < repeat; ++round) {
+        for (const auto &document : documents) {
+            for (const auto &page : document->pages()) {
+                page->markAllDirty();
+            }
+            measure(rewrite, [&]() { return storage.saveDocument(document); });
+        }
+    }
+    
+    for (int round = 0; round < repeat; ++round) {
+        for (const auto &document : documents) {
+            const QString id = document->id();
+            const int pageCount = document->pages().size();
+            measure(loadFull, [&]() {
+                auto loaded = storage.loadDocument(id, Storage::LoadFull);
+                return loaded && loaded->pages().size() == pageCount;
+            });
+            measure(loadLazy, [&]() {
+                auto loaded = storage.loadDocument(id, Storage::LoadLazy);
+                return loaded && loaded->pages().size() == pageCount;
+            });
+        }
+    }
+    
+    // Pages spread evenly over every document
+    const int pageSamples = qMin(static_cast<int>(pageIds.size()), 1000);
+    for (int round = 0; round < repeat; ++round) {
+        for (int i = 0; i < pageSamples; ++i) {
+            const QString &pageId = pageIds[static_cast<int>(static_cast<qint64>(i) * pageIds.size() / pageSamples)];
+            measure(loadPage, [&]() { return storage.loadPage(pageId) != nullptr; });
+        }
+    }
+    
+    // Words from the generator's vocabulary match text on many pages; the last query matches nothing
+    QStringList queries = NotebookGenerator::vocabulary().mid(0, 8);
+    queries << "Synthetic Notebook" << "nomatchxyz";
+    for (int round = 0; round < repeat; ++round) {
+        for (const QString &query : queries) {
+            measure(search, [&]() {
+                storage.searchDocuments(query);
+                return true;
+            });
+        }
+        for (const QString &tag : NotebookGenerator::tagPool() + QStringList{"synthetic"}) {
+            measure(byTag, [&]() {
+                storage.findDocumentsByTag(tag);
+                return true;
+            });
+        }
+        measure(backup, [&]() {
+            return storage.createBackup(dir.filePath(QString("backup-%1.db").arg(round)));
+        });
+    }
+    
+    QFileInfo database(dir.filePath("suite.db"));
+    report["databaseBytes"] = database.size();
+    
+    QJsonArray results;
+    for (const OperationResult *result : {&save, &rewrite, &loadFull, &loadLazy, &loadPage, &search, &byTag, &backup}) {
+        results.append(result->toJson());
+    }
+    report["results"] = results;
+    
+    storage.close();
+    return report;
+}
+
+void printSuite(const QJsonObject &report)
+{
+    const QJsonObject generator = report["generator"].toObject();
+    std::printf("documents: %d, pages: %d, texts/page: %d, drawings/page: %d, strokes: %d, points: %d\n",
+                generator["documents"].toInt(), generator["pages"].toInt(), generator["textObjects"].toInt(),
+                generator["drawings"].toInt(), generator["strokes"].toInt(), generator["points"].toInt());
+    std::printf("%-20s %8s %10s %10s %10s %10s %10s %6s\n", "operation", "calls", "total ms",
+                "mean us", "p50 us", "p95 us", "max us", "fail");
+    
+    for (const QJsonValue &value : report["results"].toArray()) {
+        const QJsonObject result = value.toObject();
+        std::printf("%-20s %8d %10.1f %10.1f %10.1f %10.1f %10.1f %6d\n",
+                    qPrintable(result["name"].toString()), result["iterations"].toInt(),
+                    result["totalMs"].toDouble(), result["meanUs"].toDouble(), result["p50Us"].toDouble(),
+                    result["p95Us"].toDouble(), result["maxUs"].toDouble(), result["failures"].toInt());
+    }
+}
+
+bool writeReport(const QJsonObject &report, const QString &path)
+{
+    const QByteArray json = QJsonDocument(report).toJson(QJsonDocument::Indented);
+    if (path == QLatin1String("-")) {
+        std::fwrite(json.constData(), 1, json.size(), stdout);
+        return true;
+    }
+    
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(json) != json.size()) {
+        qWarning() << "Failed to write report" << path;
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    // Text objects need a GUI application for fonts, but no display
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    QApplication app(argc, argv);
+    
+    NotebookGenerator::Options defaults;
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Storage benchmarks for NotesApp");
+    parser.addHelpOption();
+    parser.addPositionalArgument("notebook", "Notebook to scale for the codec comparison.", "[notebook.json]");
+    parser.addPositionalArgument("scale", "Times each page is replicated (default 1000).", "[scale]");
+    
+    QCommandLineOption suiteOption("suite", "Time Storage operations on generated notebooks.");
+    QCommandLineOption documentsOption("documents", "Generated documents.", "count", QString::number(defaults.documents));
+    QCommandLineOption pagesOption("pages", "Pages per document.", "count", QString::number(defaults.pages));
+    QCommandLineOption textsOption("texts", "Text objects per page.", "count", QString::number(defaults.textObjects));
+    QCommandLineOption drawingsOption("drawings", "Drawings per page.", "count", QString::number(defaults.drawings));
+    QCommandLineOption strokesOption("strokes", "Strokes per drawing.", "count", QString::number(defaults.strokes));
+    QCommandLineOption pointsOption("points", "Points per stroke.", "count", QString::number(defaults.points));
+    QCommandLineOption seedOption("seed", "Generator seed.", "seed", QString::number(defaults.seed));
+    QCommandLineOption repeatOption("repeat", "Rounds of each operation.", "count", "3");
+    QCommandLineOption jsonOption("json", "Write the suite report as JSON (- for stdout).", "file");
+    parser.addOptions({suiteOption, documentsOption, pagesOption, textsOption, drawingsOption,
+                       strokesOption, pointsOption, seedOption, repeatOption, jsonOption});
+    parser.process(app);
+    
+    if (parser.isSet(suiteOption)) {
+        NotebookGenerator::Options options;
+        options.documents = qMax(0, parser.value(documentsOption).toInt());
+        options.pages = qMax(0, parser.value(pagesOption).toInt());
+        options.textObjects = qMax(0, parser.value(textsOption).toInt());
+        options.drawings = qMax(0, parser.value(drawingsOption).toInt());
+        options.strokes = qMax(0, parser.value(strokesOption).toInt());
+        options.points = qMax(1, parser.value(pointsOption).toInt());
+        options.seed = parser.value(seedOption).toUInt();
+        
+        QJsonObject report = runSuite(options, qMax(1, parser.value(repeatOption).toInt()));
+        
+        // The table goes to stdout only when the report does not
+        const QString jsonPath = parser.value(jsonOption);
+        if (jsonPath != QLatin1String("-")) {
+            printSuite(report);
+        }
+        if (!jsonPath.isEmpty() && !writeReport(report, jsonPath)) {
+            return 1;
+        }
+        return report.contains("error") ? 1 : 0;
+    }
+    
+    const QStringList arguments = parser.positionalArguments();
+    QString notebookPath = arguments.size() > 0 ? arguments[0]
+                                                : QStringLiteral(NOTESAPP_SOURCE_DIR "/example_notebook.json");
+    int scale = arguments.size() > 1 ? arguments[1].toInt() : 1000;
+    
+    auto document = loadNotebook(notebookPath);
+    if (!document) {
+        qWarning() << "Failed to load notebook" << notebookPath;
+        return 1;
+    }
+    
+    QVector<std::shared_ptr<Page>> pages = scalePages(document, qMax(1, scale));
+    std::printf("pages: %d (scale %d)\n", pages.size(), scale);
+    std::printf("%-10s %14s %12s %12s %10s %10s\n", "format", "bytes", "encode ms", "decode ms",
+                "enc us/pg", "dec us/pg");
+    printResult("json", benchJson(pages));
+    
+    BlobCodec::Compression defaultCompression = BlobCodec::compression();
+    BlobCodec::setCompression(BlobCodec::NoCompression);
+    printResult("binary", benchBinary(pages));
+    BlobCodec::setCompression(BlobCodec::ZlibCompression);
+    printResult("zlib", benchBinary(pages));
+    
+    if (BlobCodec::hasZstd()) {
+        BlobCodec::setCompression(BlobCodec::ZstdCompression);
+        printResult("zstd", benchBinary(pages));
+        
+        QByteArray dictionary = trainPageDictionary(pages);
+        if (BlobCodec::addDictionary(dictionary)) {
+            BlobCodec::setActiveDictionary(BlobCodec::dictionaryId(dictionary));
+            printResult("zstd+dict", benchBinary(pages));
+            BlobCodec::setActiveDictionary(0);
+        }
+    }
+    BlobCodec::setCompression(defaultCompression);
+    
+    std::printf("\n%-8s %10s %12s %10s %12s %10s %12s\n", "storage",
+                "save ms", "pages/s", "incr ms", "saves/s", "load ms", "pages/s");
+    printStorageResult("plain", benchStorage(pages, false), pages.size());
+    printStorageResult("tuned", benchStorage(pages, true), pages.size());
+    
+    const int threads = QThreadPool::globalInstance()->maxThreadCount();
+    QThreadPool::globalInstance()->setMaxThreadCount(1);
+    printStorageResult("1 thread", benchStorage(pages, true), pages.size());
+    QThreadPool::globalInstance()->setMaxThreadCount(threads);
+    
+    return 0;
+}
@@ -0,0 +1,427 @@
+#include "asyncstorage.h"
+#include <QFutureWatcher>
+#include <QMetaObject>
+#include <QMutexLocker>
+#include <QPointer>
+#include <QDebug>
+#include <algorithm>
+
+AsyncStorage::AsyncStorage(QObject *parent)
+    : QObject(parent)
+    , m_storage(nullptr)
+    , m_ownerThread(QThread::currentThread())
+    , m_open(false)
+{
+    // The SQLite connection may only be used by the thread that opened it,
+    // so every request runs on the one thread m_worker lives on
+    m_thread.setObjectName("AsyncStorage");
+    m_worker.moveToThread(&m_thread);
+
+    connect(this, &AsyncStorage::saveFailed, this, &AsyncStorage::onSaveFailed, Qt::QueuedConnection);
+}
+
+AsyncStorage::~AsyncStorage()
+{
+    close();
+}
+
+bool AsyncStorage::initialize(const QString &databasePath)
+{
+    if (!m_thread.isRunning()) {
+        m_thread.start();
+    }
+
+    QFuture<bool> future = call([this, databasePath]() {
+        if (!m_storage) {
+            m_storage = new Storage();
+            connect(m_storage, &Storage::documentSaved, this, &AsyncStorage::documentSaved);
+            connect(m_storage, &Storage::documentDeleted, this, &AsyncStorage::documentDeleted);
+            connect(m_storage, &Storage::databaseError, this, &AsyncStorage::databaseError);
+            connect(m_storage, &Storage::backupProgress, this, &AsyncStorage::backupProgress);
+        }
+        return m_storage->initialize(databasePath);
+    });
+
+    m_open = future.result();
+    return m_open;
+}
+
+void AsyncStorage::close()
+{
+    if (!m_thread.isRunning()) {
+        m_open = false;
+        return;
+    }
+
+    // Queued saves run first, so closing flushes them; the worker stops
+    // itself after the last one and is joined here
+    post([this]() {
+        if (m_storage) {
+            m_storage->close();
+            delete m_storage;
+            m_storage = nullptr;
+        }
+        m_thread.quit();
+    });
+
+    m_thread.wait();
+    m_open = false;
+}
+
+QFuture<bool> AsyncStorage::saveDocument(std::shared_ptr<Document> document)
+{
+    if (!document || !m_thread.isRunning()) {
+        return run([](Storage &) { return false; });
+    }
+
+    // Snapshot and mark clean on the owning thread; pages edited while the
+    // write is in flight become dirty again and go out with the next save
+    Storage::DocumentSnapshot snapshot = Storage::snapshotDocument(*document);
+    document->markSaved();
+
+    const QString documentId = snapshot.id;
+    m_savedDocuments.insert(documentId, document);
+
+    QMutexLocker locker(&m_saveMutex);
+
+    std::shared_ptr<PendingSave> pending = m_pendingSaves.value(documentId);
+    if (pending) {
+        mergeSnapshot(pending->snapshot, snapshot);
+        return pending->future;
+    }
+
+    auto save = std::make_shared<PendingSave>();
+    save->snapshot = snapshot;
+    m_pendingSaves.insert(documentId, save);
+
+    QFuture<bool> future = call([this, documentId, save]() {
+        Storage::DocumentSnapshot toWrite;
+        {
+            // Nothing can be merged into a save once it is being written. A
+            // save that failed before is older, so this one is merged into it.
+            QMutexLocker locker(&m_saveMutex);
+            if (m_pendingSaves.value(documentId) == save) {
+                m_pendingSaves.remove(documentId);
+            }
+            toWrite = m_failedSaves.take(documentId);
+            if (toWrite.id.isEmpty()) {
+                toWrite = save->snapshot;
+            } else {
+                mergeSnapshot(toWrite, save->snapshot);
+            }
+        }
+
+        if (m_storage && m_storage->saveDocument(toWrite)) {
+            return true;
+        }
+
+        // The document was marked saved and may have evicted these pages
+        // since, so the snapshot itself is kept for the next save
+        {
+            QMutexLocker locker(&m_saveMutex);
+            m_failedSaves.insert(documentId, toWrite);
+        }
+        emit saveFailed(documentId);
+        return false;
+    });
+
+    save->future = future;
+    return future;
+}
+
+QFuture<std::shared_ptr<Document>> AsyncStorage::loadDocument(const QString &documentId, Storage::LoadMode mode)
+{
+    QPointer<AsyncStorage> self(this);
+    return run([this, self, documentId, mode](Storage &storage) -> std::shared_ptr<Document> {
+        auto document = storage.loadDocument(documentId, mode);
+        if (!document) {
+            return nullptr;
+        }
+
+        // Pages requested later are read through the worker, not on the caller's
+        // thread. Showing a page only requests it; the blocking loader is left
+        // for code that needs the content at once, like editing a stub.
+        if (mode == Storage::LoadLazy) {
+            std::weak_ptr<Document> weakDocument = document;
+            document->setPageRequester([self, weakDocument](std::shared_ptr<Page> page) {
+                if (self) {
+                    self->requestPage(weakDocument, page);
+                }
+            });
+            document->setPageLoader([self](std::shared_ptr<Page> page) {
+                return self && self->loadPage(page);
+            });
+        }
+
+        moveToOwnerThread(*document);
+        return document;
+    });
+}
+
+QFuture<bool> AsyncStorage::deleteDocument(const QString &documentId)
+{
+    {
+        QMutexLocker locker(&m_saveMutex);
+        m_failedSaves.remove(documentId);
+    }
+
+    return run([documentId](Storage &storage) {
+        return storage.deleteDocument(documentId);
+    });
+}
+
+QFuture<bool> AsyncStorage::appendJournal(const QString &documentId, const QVector<JournalEntry> &entries)
+{
+    // A queued save clears the journal when it is written, and these entries
+    // land after that. A later save merged into the queued one would write a
+    // snapshot newer than the entries, and replay would then apply stale edits
+    // over it, so later saves are queued behind the append instead.
+    {
+        QMutexLocker locker(&m_saveMutex);
+        m_pendingSaves.remove(documentId);
+    }
+
+    return run([documentId, entries](Storage &storage) {
+        return storage.appendJournal(documentId, entries);
+    });
+}
+
+QFuture<QStringList> AsyncStorage::listDocuments()
+{
+    return run([](Storage &storage) {
+        return storage.listDocuments();
+    });
+}
+
+QFuture<AsyncStorage::CatalogPage> AsyncStorage::documentCatalog(int limit, const Storage::CatalogCursor &after)
+{
+    return run([limit, after](Storage &storage) {
+        CatalogPage page;
+        page.entries = storage.documentCatalog(limit, after, &page.next);
+        return page;
+    });
+}
+
+QFuture<QStringList> AsyncStorage::searchDocuments(const QString &query)
+{
+    return run([query](Storage &storage) {
+        return storage.searchDocuments(query);
+    });
+}
+
+QFuture<QVector<Storage::SearchHit>> AsyncStorage::searchContent(const QString &query, int limit)
+{
+    return run([query, limit](Storage &storage) {
+        return storage.searchContent(query, limit);
+    });
+}
+
+QFuture<QStringList> AsyncStorage::findDocumentsByTags(const QStringList &tags, Storage::TagMatch match)
+{
+    return run([tags, match](Storage &storage) {
+        return storage.findDocumentsByTags(tags, match);
+    });
+}
+
+QFuture<QMap<QString, int>> AsyncStorage::tagCounts()
+{
+    return run([](Storage &storage) {
+        return storage.tagCounts();
+    });
+}
+
+QFuture<QVector<Storage::Backlink>> AsyncStorage::backlinks(const QString &pageId)
+{
+    return run([pageId](Storage &storage) {
+        return storage.backlinks(pageId);
+    });
+}
+
+QFuture<QVector<QJsonObject>> AsyncStorage::getRecentDocuments(int limit)
+{
+    return run([limit](Storage &storage) {
+        return storage.getRecentDocuments(limit);
+    });
+}
+
+QFuture<bool> AsyncStorage::createBackup(const QString &backupPath)
+{
+    return run([backupPath](Storage &storage) {
+        return storage.createBackup(backupPath);
+    });
+}
+
+QFuture<bool> AsyncStorage::createIncrementalBackup(const QString &backupPath)
+{
+    return run([backupPath](Storage &storage) {
+        return storage.createIncrementalBackup(backupPath);
+    });
+}
+
+QFuture<bool> AsyncStorage::restoreFromBackup(const QString &backupPath)
+{
+    return run([backupPath](Storage &storage) {
+        return storage.restoreFromBackup(backupPath);
+    });
+}
+
+QFuture<bool> AsyncStorage::compactDatabase()
+{
+    return run([](Storage &storage) {
+        return storage.compactDatabase();
+    });
+}
+
+void AsyncStorage::waitForIdle()
+{
+    call([]() { return true; }).waitForFinished();
+}
+
+void AsyncStorage::post(std::function<void()> task)
+{
+    // With no worker there is no connection either, so the task only yields its default
+    if (m_thread.isRunning()) {
+        QMetaObject::invokeMethod(&m_worker, std::move(task), Qt::QueuedConnection);
+    } else {
+        task();
+    }
+}
+
+bool AsyncStorage::loadPage(std::shared_ptr<Page> page)
+{
+    const QString pageId = page->id();
+    Storage::PageRecord record = run([pageId](Storage &storage) {
+        return storage.loadPageRecord(pageId);
+    }).result();
+
+    return Storage::decodePageRecord(record, *page);
+}
+
+void AsyncStorage::requestPage(std::weak_ptr<Document> document, std::shared_ptr<Page> page)
+{
+    // The record is read on the worker and decoded here once it arrives
+    const QString pageId = page->id();
+    auto *watcher = new QFutureWatcher<Storage::PageRecord>(this);
+    connect(watcher, &QFutureWatcher<Storage::PageRecord>::finished, this, [watcher, document, page]() {
+        const Storage::PageRecord record = watcher->result();
+        watcher->deleteLater();
+
+        auto owner = document.lock();
+        if (owner) {
+            owner->fillPage(page, [&record](Page &target) {
+                return Storage::decodePageRecord(record, target);
+            });
+        }
+    });
+    watcher->setFuture(run([pageId](Storage &storage) {
+        return storage.loadPageRecord(pageId);
+    }));
+}
+
+void AsyncStorage::moveToOwnerThread(Document &document)
+{
+    // Objects take their children along, text layouts included
+    document.moveToThread(m_ownerThread);
+    for (const auto &page : document.pages()) {
+        page->moveToThread(m_ownerThread);
+        for (const auto &object : page->objects()) {
+            object->moveToThread(m_ownerThread);
+        }
+    }
+}
+
+void AsyncStorage::mergeSnapshot(Storage::DocumentSnapshot &pending, const Storage::DocumentSnapshot &latest)
+{
+    // Pages removed since are dropped; pages in both are merged object by object
+    QVector<Storage::PageSnapshot> pages;
+    for (const auto &page : pending.pages) {
+        if (!latest.removedPageIds.contains(page.id)) {
+            pages.append(page);
+        }
+    }
+    for (const auto &page : latest.pages) {
+        auto it = std::find_if(pages.begin(), pages.end(), [&page](const Storage::PageSnapshot &other) {
+            return other.id == page.id;
+        });
+        if (it != pages.end()) {
+            mergePageSnapshot(*it, page);
+        } else {
+            pages.append(page);
+        }
+    }
+
+    // A page removed in the pending save and added back since, e.g. by undo,
+    // is written rather than deleted
+    QStringList removedPageIds = pending.removedPageIds + latest.removedPageIds;
+    for (const auto &page : latest.pages) {
+        removedPageIds.removeAll(page.id);
+    }
+
+    // Newer positions win; a page written in full carries its own
+    QHash<QString, QString> movedPages = pending.movedPages;
+    for (auto it = latest.movedPages.begin(); it != latest.movedPages.end(); ++it) {
+        movedPages.insert(it.key(), it.value());
+    }
+    for (const auto &page : latest.pages) {
+        movedPages.remove(page.id);
+    }
+    for (auto &page : pages) {
+        auto moved = movedPages.find(page.id);
+        if (moved != movedPages.end()) {
+            page.position = moved.value();
+            movedPages.erase(moved);
+        }
+    }
+
+    // The latest links are complete, but must still be written if either changed them
+    bool linksChanged = pending.linksChanged || latest.linksChanged;
+
+    pending = latest;
+    pending.pages = pages;
+    pending.removedPageIds = removedPageIds;
+    pending.movedPages = movedPages;
+    pending.linksChanged = linksChanged;
+}
+
+void AsyncStorage::mergePageSnapshot(Storage::PageSnapshot &pending, const Storage::PageSnapshot &latest)
+{
+    // A full rewrite in the newer snapshot already carries every object
+    if (latest.replaceObjects) {
+        pending = latest;
+        return;
+    }
+
+    QVector<Storage::ObjectSnapshot> objects;
+    for (const auto &object : pending.objects) {
+        if (!latest.removedObjectIds.contains(object.id)) {
+            objects.append(object);
+        }
+    }
+    for (const auto &object : latest.objects) {
+        auto it = std::find_if(objects.begin(), objects.end(), [&object](const Storage::ObjectSnapshot &other) {
+            return other.id == object.id;
+        });
+        if (it != objects.end()) {
+            *it = object;
+        } else {
+            objects.append(object);
+        }
+    }
+
+    // Removals run before upserts, so an object removed and re-added survives
+    QStringList removedObjectIds = pending.removedObjectIds + latest.removedObjectIds;
+    bool replaceObjects = pending.replaceObjects;
+
+    pending = latest;
+    pending.objects = objects;
+    pending.removedObjectIds = removedObjectIds;
+    pending.replaceObjects = replaceObjects;
+}
+
+void AsyncStorage::onSaveFailed(const QString &documentId)
+{
+    auto document = m_savedDocuments.value(documentId).lock();
+    if (document) {
+        document->markUnsaved();
+    }
+}
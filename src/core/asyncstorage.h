@@ -0,0 +1,141 @@
+#ifndef ASYNCSTORAGE_H
+#define ASYNCSTORAGE_H
+
+#include "storage.h"
+#include <QObject>
+#include <QFuture>
+#include <QFutureInterface>
+#include <QHash>
+#include <QMutex>
+#include <QThread>
+#include <functional>
+#include <memory>
+
+/**
+ * @brief Runs Storage on a dedicated worker thread
+ *
+ * The worker thread owns the Storage instance and its SQLite connection, so
+ * the thread that creates AsyncStorage never touches the database. Requests
+ * are posted to the worker's event loop and run there in order; waiting on
+ * a returned QFuture never runs the request on the waiting thread. Storage
+ * signals are forwarded as queued signals.
+ *
+ * Saves take a snapshot of the uncompressed encodings on the calling thread;
+ * compressing, hashing and writing it happen on the worker. A save requested while an earlier save of the same document
+ * is still queued is merged into it and shares its future, unless a journal
+ * append was queued after the earlier save.
+ */
+class AsyncStorage : public QObject
+{
+    Q_OBJECT
+
+public:
+    /**
+     * @brief One batch of catalog rows and the cursor for the next batch
+     */
+    struct CatalogPage {
+        QVector<Storage::CatalogEntry> entries;
+        Storage::CatalogCursor next;
+    };
+
+    explicit AsyncStorage(QObject *parent = nullptr);
+    ~AsyncStorage() override;
+
+    // Lifecycle; both wait for the worker, and close() joins it after the queued requests
+    bool initialize(const QString &databasePath = QString());
+    void close();
+    bool isOpen() const { return m_open; }
+
+    // Document operations
+    QFuture<bool> saveDocument(std::shared_ptr<Document> document);
+    QFuture<std::shared_ptr<Document>> loadDocument(const QString &documentId,
+                                                    Storage::LoadMode mode = Storage::LoadLazy);
+    QFuture<bool> deleteDocument(const QString &documentId);
+    QFuture<QStringList> listDocuments();
+    QFuture<bool> appendJournal(const QString &documentId, const QVector<JournalEntry> &entries);
+    QFuture<CatalogPage> documentCatalog(int limit, const Storage::CatalogCursor &after = Storage::CatalogCursor());
+
+    // Search and queries
+    QFuture<QStringList> searchDocuments(const QString &query);
+    QFuture<QVector<Storage::SearchHit>> searchContent(const QString &query, int limit = 50);
+    QFuture<QStringList> findDocumentsByTags(const QStringList &tags, Storage::TagMatch match = Storage::MatchAll);
+    QFuture<QMap<QString, int>> tagCounts();
+    QFuture<QVector<Storage::Backlink>> backlinks(const QString &pageId);
+    QFuture<QVector<QJsonObject>> getRecentDocuments(int limit = 10);
+
+    // Backup and restore
+    QFuture<bool> createBackup(const QString &backupPath);
+    QFuture<bool> createIncrementalBackup(const QString &backupPath);
+    QFuture<bool> restoreFromBackup(const QString &backupPath);
+    
+    // Maintenance
+    QFuture<bool> compactDatabase();
+
+    // Blocks until every request queued so far has finished
+    void waitForIdle();
+
+signals:
+    void documentSaved(const QString &documentId);
+    void documentDeleted(const QString &documentId);
+    void databaseError(const QString &error);
+    void backupProgress(qint64 done, qint64 total);
+
+    // Emitted from the worker when a snapshot could not be written; it is
+    // written again, merged with the next save of the document
+    void saveFailed(const QString &documentId);
+
+private:
+    struct PendingSave {
+        Storage::DocumentSnapshot snapshot;
+        QFuture<bool> future;
+    };
+
+    QThread m_thread;
+    QObject m_worker;               // lives on m_thread; requests are posted to it
+    Storage *m_storage;             // created, used and deleted on the worker
+    QThread *m_ownerThread;
+    bool m_open;
+
+    QMutex m_saveMutex;
+    QHash<QString, std::shared_ptr<PendingSave>> m_pendingSaves;   // queued saves still open to merging
+    QHash<QString, Storage::DocumentSnapshot> m_failedSaves;      // snapshots a save could not write
+    QHash<QString, std::weak_ptr<Document>> m_savedDocuments;
+
+    bool loadPage(std::shared_ptr<Page> page);
+    void requestPage(std::weak_ptr<Document> document, std::shared_ptr<Page> page);
+    void moveToOwnerThread(Document &document);
+    static void mergeSnapshot(Storage::DocumentSnapshot &pending, const Storage::DocumentSnapshot &latest);
+    static void mergePageSnapshot(Storage::PageSnapshot &pending, const Storage::PageSnapshot &latest);
+
+    // Queues task on the worker thread; runs it here at once when the worker is not running
+    void post(std::function<void()> task);
+
+    // Queues function() on the worker; the future holds its result
+    template <typename Function>
+    auto call(Function function) -> QFuture<decltype(function())>
+    {
+        QFutureInterface<decltype(function())> promise;
+        promise.reportStarted();
+        auto future = promise.future();
+        post([function, promise]() mutable {
+            promise.reportResult(function());
+            promise.reportFinished();
+        });
+        return future;
+    }
+
+    // Queues function(Storage &) on the worker; yields a default value when storage is closed
+    template <typename Function>
+    auto run(Function function) -> QFuture<decltype(function(std::declval<Storage &>()))>
+    {
+        using Result = decltype(function(std::declval<Storage &>()));
+        return call([this, function]() -> Result {
+            return m_storage ? function(*m_storage) : Result();
+        });
+    }
+
+private slots:
+    void onSaveFailed(const QString &documentId);
+};
+
+#endif // ASYNCSTORAGE_H
@@ -0,0 +1,484 @@
+#include "blobcodec.h"
+#include "page.h"
+#include "object.h"
+#include "document.h"
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QHash>
+#include <QReadWriteLock>
+#include <QVector>
+#include <limits>
+
+#ifdef NOTESAPP_HAVE_ZSTD
+#include <zstd.h>
+#include <zdict.h>
+#endif
+
+namespace {
+const char MagicFirst = 'N';
+const char MagicSecond = 'B';
+const int HeaderSize = 4;
+const int CompressedHeaderSize = 5;     // header plus the compression byte
+
+// Bodies this small gain nothing once the codec framing is paid for
+const int MinimumCompressedSize = 64;
+
+#ifdef NOTESAPP_HAVE_ZSTD
+const int ZstdLevel = 3;
+const int MinimumTrainingSamples = 100;
+
+/**
+ * @brief A trained zstd dictionary, digested once for both directions
+ */
+struct Dictionary {
+    ZSTD_CDict *compress = nullptr;
+    ZSTD_DDict *decompress = nullptr;
+    
+    ~Dictionary()
+    {
+        ZSTD_freeCDict(compress);
+        ZSTD_freeDDict(decompress);
+    }
+};
+
+// Contexts are reused per thread; saves encode on the GUI thread, loads decode on the worker
+struct ZstdContexts {
+    ZSTD_CCtx *compress = ZSTD_createCCtx();
+    ZSTD_DCtx *decompress = ZSTD_createDCtx();
+    
+    ~ZstdContexts()
+    {
+        ZSTD_freeCCtx(compress);
+        ZSTD_freeDCtx(decompress);
+    }
+};
+
+ZstdContexts &zstdContexts()
+{
+    thread_local ZstdContexts contexts;
+    return contexts;
+}
+#endif
+
+struct CodecSettings {
+    QReadWriteLock lock;
+#ifdef NOTESAPP_HAVE_ZSTD
+    BlobCodec::Compression compression = BlobCodec::ZstdCompression;
+    quint32 activeDictionary = 0;
+    QHash<quint32, std::shared_ptr<Dictionary>> dictionaries;
+#else
+    BlobCodec::Compression compression = BlobCodec::ZlibCompression;
+#endif
+};
+
+CodecSettings &settings()
+{
+    static CodecSettings codecSettings;
+    return codecSettings;
+}
+}
+
+QByteArray BlobCodec::encodePage(const Page &page)
+{
+    QByteArray body;
+    QDataStream out(&body, QIODevice::WriteOnly);
+    setupStream(out);
+    page.writeBinary(out);
+    return seal(PageBlob, body);
+}
+
+QByteArray BlobCodec::encodePageHeader(const Page &page)
+{
+    return seal(PageHeaderBlob, encodePageHeaderPayload(page));
+}
+
+QByteArray BlobCodec::encodePageHeaderPayload(const Page &page)
+{
+    QByteArray body;
+    QDataStream out(&body, QIODevice::WriteOnly);
+    setupStream(out);
+    page.writeHeader(out);
+    return body;
+}
+
+bool BlobCodec::decodePage(const QByteArray &blob, Page &page)
+{
+    if (!isBinary(blob)) {
+        // Rows written before the binary format
+        QJsonDocument doc = QJsonDocument::fromJson(blob);
+        if (doc.isNull()) {
+            return false;
+        }
+        page.fromJson(doc.object());
+        return true;
+    }
+    
+    bool headerOnly = isPageHeader(blob);
+    
+    QByteArray body;
+    if (!open(blob, headerOnly ? PageHeaderBlob : PageBlob, body)) {
+        return false;
+    }
+    
+    QDataStream in(body);
+    setupStream(in);
+    
+    if (headerOnly) {
+        page.readHeader(in);
+    } else {
+        page.readBinary(in);
+    }
+    return in.status() == QDataStream::Ok;
+}
+
+QByteArray BlobCodec::encodeObject(const Object &object)
+{
+    return seal(ObjectBlob, encodeObjectPayload(object));
+}
+
+QByteArray BlobCodec::encodeObjectPayload(const Object &object)
+{
+    QByteArray body;
+    QDataStream out(&body, QIODevice::WriteOnly);
+    setupStream(out);
+    out << static_cast<quint8>(object.type());
+    object.writeBinary(out);
+    return body;
+}
+
+std::shared_ptr<Object> BlobCodec::decodeObject(const QByteArray &blob)
+{
+    QByteArray body;
+    if (!open(blob, ObjectBlob, body)) {
+        return nullptr;
+    }
+    
+    QDataStream in(body);
+    setupStream(in);
+    
+    quint8 type = 0;
+    in >> type;
+    
+    std::shared_ptr<Object> object = Page::createObject(static_cast<Object::Type>(type));
+    if (!object) {
+        return nullptr;
+    }
+    
+    object->readBinary(in);
+    return in.status() == QDataStream::Ok ? object : nullptr;
+}
+
+QByteArray BlobCodec::encodeManifest(const Document &document)
+{
+    return seal(ManifestBlob, encodeManifestPayload(document));
+}
+
+QByteArray BlobCodec::encodeManifestPayload(const Document &document)
+{
+    QByteArray body;
+    QDataStream out(&body, QIODevice::WriteOnly);
+    setupStream(out);
+    document.writeManifest(out);
+    return body;
+}
+
+bool BlobCodec::decodeDocument(const QByteArray &blob, Document &document, bool *hasPageContent)
+{
+    if (hasPageContent) {
+        *hasPageContent = false;
+    }
+    
+    if (!isBinary(blob)) {
+        QJsonDocument doc = QJsonDocument::fromJson(blob);
+        if (doc.isNull()) {
+            return false;
+        }
+        
+        QJsonObject json = doc.object();
+        if (json.contains("manifestVersion")) {
+            document.fromManifest(json);
+        } else {
+            // Rows written before manifests were introduced hold the full document
+            document.fromJson(json);
+            if (hasPageContent) {
+                *hasPageContent = true;
+            }
+        }
+        return true;
+    }
+    
+    QByteArray body;
+    if (!open(blob, ManifestBlob, body)) {
+        return false;
+    }
+    
+    QDataStream in(body);
+    setupStream(in);
+    
+    document.readManifest(in);
+    return in.status() == QDataStream::Ok;
+}
+
+bool BlobCodec::isBinary(const QByteArray &blob)
+{
+    return blob.size() >= HeaderSize && blob[0] == MagicFirst && blob[1] == MagicSecond;
+}
+
+bool BlobCodec::isPageHeader(const QByteArray &blob)
+{
+    return isBinary(blob) && static_cast<quint8>(blob[3]) == PageHeaderBlob;
+}
+
+void BlobCodec::setCompression(Compression compression)
+{
+    if (compression == ZstdCompression && !hasZstd()) {
+        compression = ZlibCompression;
+    }
+    
+    QWriteLocker locker(&settings().lock);
+    settings().compression = compression;
+}
+
+BlobCodec::Compression BlobCodec::compression()
+{
+    QReadLocker locker(&settings().lock);
+    return settings().compression;
+}
+
+bool BlobCodec::hasZstd()
+{
+#ifdef NOTESAPP_HAVE_ZSTD
+    return true;
+#else
+    return false;
+#endif
+}
+
+QByteArray BlobCodec::trainDictionary(const QVector<QByteArray> &samples, int maxSize)
+{
+#ifdef NOTESAPP_HAVE_ZSTD
+    QByteArray buffer;
+    QVector<size_t> sizes;
+    for (const QByteArray &sample : samples) {
+        if (!sample.isEmpty()) {
+            buffer.append(sample);
+            sizes.append(static_cast<size_t>(sample.size()));
+        }
+    }
+    
+    // Too few samples and the trainer has nothing to learn from
+    if (sizes.size() < MinimumTrainingSamples) {
+        return QByteArray();
+    }
+    
+    QByteArray dictionary(maxSize, Qt::Uninitialized);
+    size_t size = ZDICT_trainFromBuffer(dictionary.data(), dictionary.size(), buffer.constData(),
+                                        sizes.constData(), static_cast<unsigned>(sizes.size()));
+    if (ZDICT_isError(size)) {
+        return QByteArray();
+    }
+    
+    dictionary.resize(static_cast<int>(size));
+    return dictionary;
+#else
+    Q_UNUSED(samples);
+    Q_UNUSED(maxSize);
+    return QByteArray();
+#endif
+}
+
+quint32 BlobCodec::dictionaryId(const QByteArray &dictionary)
+{
+#ifdef NOTESAPP_HAVE_ZSTD
+    return ZDICT_getDictID(dictionary.constData(), dictionary.size());
+#else
+    Q_UNUSED(dictionary);
+    return 0;
+#endif
+}
+
+bool BlobCodec::addDictionary(const QByteArray &dictionary)
+{
+#ifdef NOTESAPP_HAVE_ZSTD
+    quint32 id = dictionaryId(dictionary);
+    if (id == 0) {
+        return false;
+    }
+    
+    auto digested = std::make_shared<Dictionary>();
+    digested->compress = ZSTD_createCDict(dictionary.constData(), dictionary.size(), ZstdLevel);
+    digested->decompress = ZSTD_createDDict(dictionary.constData(), dictionary.size());
+    if (!digested->compress || !digested->decompress) {
+        return false;
+    }
+    
+    QWriteLocker locker(&settings().lock);
+    settings().dictionaries.insert(id, digested);
+    return true;
+#else
+    Q_UNUSED(dictionary);
+    return false;
+#endif
+}
+
+void BlobCodec::setActiveDictionary(quint32 id)
+{
+#ifdef NOTESAPP_HAVE_ZSTD
+    QWriteLocker locker(&settings().lock);
+    settings().activeDictionary = settings().dictionaries.contains(id) ? id : 0;
+#else
+    Q_UNUSED(id);
+#endif
+}
+
+QByteArray BlobCodec::payload(const QByteArray &blob)
+{
+    QByteArray body;
+    if (!isBinary(blob) || !open(blob, static_cast<Kind>(blob[3]), body)) {
+        return QByteArray();
+    }
+    
+    // Uncompressed bodies point into the blob; detach before handing them out
+    return QByteArray(body.constData(), body.size());
+}
+
+QByteArray BlobCodec::recompress(const QByteArray &blob)
+{
+    QByteArray body;
+    if (!isBinary(blob) || !open(blob, static_cast<Kind>(blob[3]), body)) {
+        return blob;
+    }
+    return seal(static_cast<Kind>(blob[3]), body);
+}
+
+QByteArray BlobCodec::seal(Kind kind, const QByteArray &body)
+{
+    QByteArray compressed;
+    Compression method = compress(body, compressed);
+    
+    QByteArray blob;
+    if (method == NoCompression) {
+        // Uncompressed blobs keep the version 1 layout so older builds still read them
+        blob.reserve(HeaderSize + body.size());
+        blob.append(MagicFirst).append(MagicSecond).append(static_cast<char>(1)).append(static_cast<char>(kind));
+        blob.append(body);
+    } else {
+        blob.reserve(CompressedHeaderSize + compressed.size());
+        blob.append(MagicFirst).append(MagicSecond).append(static_cast<char>(FormatVersion))
+            .append(static_cast<char>(kind)).append(static_cast<char>(method));
+        blob.append(compressed);
+    }
+    return blob;
+}
+
+bool BlobCodec::open(const QByteArray &blob, Kind kind, QByteArray &body)
+{
+    if (!isBinary(blob)) {
+        return false;
+    }
+    
+    // Newer format versions may change the layout; refuse rather than misread
+    quint8 version = static_cast<quint8>(blob[2]);
+    if (version == 0 || version > FormatVersion || static_cast<quint8>(blob[3]) != kind) {
+        return false;
+    }
+    
+    int offset = version == 1 ? HeaderSize : CompressedHeaderSize;
+    if (blob.size() < offset) {
+        return false;
+    }
+    
+    const char *data = blob.constData() + offset;
+    int size = blob.size() - offset;
+    Compression method = version == 1 ? NoCompression : static_cast<Compression>(blob[4]);
+    
+    if (method == NoCompression) {
+        body = QByteArray::fromRawData(data, size);
+        return true;
+    }
+    return decompress(method, data, size, body);
+}
+
+BlobCodec::Compression BlobCodec::compress(const QByteArray &body, QByteArray &compressed)
+{
+    Compression method = compression();
+    if (method == NoCompression || body.size() < MinimumCompressedSize) {
+        return NoCompression;
+    }
+    
+    if (method == ZlibCompression) {
+        compressed = qCompress(body);
+    }
+#ifdef NOTESAPP_HAVE_ZSTD
+    else if (method == ZstdCompression) {
+        std::shared_ptr<Dictionary> dictionary;
+        {
+            QReadLocker locker(&settings().lock);
+            dictionary = settings().dictionaries.value(settings().activeDictionary);
+        }
+        
+        compressed.resize(static_cast<int>(ZSTD_compressBound(body.size())));
+        ZSTD_CCtx *context = zstdContexts().compress;
+        size_t size = dictionary
+            ? ZSTD_compress_usingCDict(context, compressed.data(), compressed.size(),
+                                       body.constData(), body.size(), dictionary->compress)
+            : ZSTD_compressCCtx(context, compressed.data(), compressed.size(),
+                                body.constData(), body.size(), ZstdLevel);
+        if (ZSTD_isError(size)) {
+            return NoCompression;
+        }
+        compressed.resize(static_cast<int>(size));
+    }
+#endif
+    else {
+        return NoCompression;
+    }
+    
+    // Keep the raw body when compression does not pay for itself
+    return compressed.size() < body.size() ? method : NoCompression;
+}
+
+bool BlobCodec::decompress(Compression method, const char *data, int size, QByteArray &body)
+{
+    if (method == ZlibCompression) {
+        body = qUncompress(reinterpret_cast<const uchar *>(data), size);
+        return !body.isEmpty();
+    }
+    
+#ifdef NOTESAPP_HAVE_ZSTD
+    if (method == ZstdCompression) {
+        unsigned long long length = ZSTD_getFrameContentSize(data, size);
+        if (length == ZSTD_CONTENTSIZE_ERROR || length == ZSTD_CONTENTSIZE_UNKNOWN ||
+            length > static_cast<unsigned long long>(std::numeric_limits<int>::max())) {
+            return false;
+        }
+        
+        // The frame names the dictionary it was compressed with
+        std::shared_ptr<Dictionary> dictionary;
+        quint32 id = ZSTD_getDictID_fromFrame(data, size);
+        if (id != 0) {
+            QReadLocker locker(&settings().lock);
+            dictionary = settings().dictionaries.value(id);
+            if (!dictionary) {
+                return false;
+            }
+        }
+        
+        body.resize(static_cast<int>(length));
+        ZSTD_DCtx *context = zstdContexts().decompress;
+        size_t written = dictionary
+            ? ZSTD_decompress_usingDDict(context, body.data(), body.size(), data, size, dictionary->decompress)
+            : ZSTD_decompressDCtx(context, body.data(), body.size(), data, size);
+        return !ZSTD_isError(written) && written == length;
+    }
+#endif
+    
+    // zstd blobs read by a build without zstd end up here
+    return false;
+}
+
+void BlobCodec::setupStream(QDataStream &stream)
+{
+    // Pin the stream version so blobs stay readable across Qt releases
+    stream.setVersion(QDataStream::Qt_5_12);
+}
@@ -0,0 +1,96 @@
+#ifndef BLOBCODEC_H
+#define BLOBCODEC_H
+
+#include <QByteArray>
+#include <QDataStream>
+#include <QVector>
+#include <memory>
+
+class Object;
+class Page;
+class Document;
+
+/**
+ * @brief Encoder and decoder for the blobs stored in the database
+ * 
+ * Pages and document manifests are stored in a compact, versioned binary
+ * format built on QDataStream. Every binary blob starts with a short header
+ * (magic, format version, blob kind) so that rows written as JSON by older
+ * versions can still be recognised and read. JSON remains the format for
+ * import and export.
+ * 
+ * Bodies are compressed when that makes them smaller: with zstd when the
+ * build has it (optionally with a dictionary trained on the user's own
+ * blobs), with zlib otherwise. Compressed blobs carry format version 2 and
+ * a compression byte after the header; uncompressed blobs keep version 1.
+ */
+class BlobCodec
+{
+public:
+    enum Kind : quint8 {
+        PageBlob = 'P',         // page attributes and every object
+        PageHeaderBlob = 'H',   // page attributes; objects are stored as rows
+        ObjectBlob = 'O',
+        ManifestBlob = 'M'
+    };
+    
+    enum Compression : quint8 {
+        NoCompression = 0,
+        ZlibCompression = 1,
+        ZstdCompression = 2     // the frame records the dictionary it needs, if any
+    };
+    
+    static const quint8 FormatVersion = 2;
+    
+    // Pages; decodePage accepts both full pages and page headers
+    static QByteArray encodePage(const Page &page);
+    static QByteArray encodePageHeader(const Page &page);
+    static bool decodePage(const QByteArray &blob, Page &page);
+    
+    // Objects
+    static QByteArray encodeObject(const Object &object);
+    static std::shared_ptr<Object> decodeObject(const QByteArray &blob);
+    
+    // Documents: binary manifests, JSON manifests and legacy full JSON documents.
+    // hasPageContent is set when the blob carried the content of every page.
+    static QByteArray encodeManifest(const Document &document);
+    static bool decodeDocument(const QByteArray &blob, Document &document, bool *hasPageContent = nullptr);
+    
+    // Format detection
+    static bool isBinary(const QByteArray &blob);
+    static bool isPageHeader(const QByteArray &blob);
+    
+    // Compression used by the encoders; zstd falls back to zlib when not built in
+    static void setCompression(Compression compression);
+    static Compression compression();
+    static bool hasZstd();
+    
+    // zstd dictionaries. Every dictionary a stored blob was written with must be
+    // added before that blob is decoded; the active one is used for new blobs.
+    static QByteArray trainDictionary(const QVector<QByteArray> &samples, int maxSize = 64 * 1024);
+    static quint32 dictionaryId(const QByteArray &dictionary);
+    static bool addDictionary(const QByteArray &dictionary);
+    static void setActiveDictionary(quint32 id);
+    
+    // The body of a binary blob without header or compression, e.g. as a training sample
+    static QByteArray payload(const QByteArray &blob);
+    
+    // The same blob written with the current compression settings
+    static QByteArray recompress(const QByteArray &blob);
+    
+    // Payloads as the encoders above write them, and the blob for a payload.
+    // A payload does not depend on the compression settings, so content
+    // hashes are taken over it.
+    static QByteArray encodePageHeaderPayload(const Page &page);
+    static QByteArray encodeObjectPayload(const Object &object);
+    static QByteArray encodeManifestPayload(const Document &document);
+    static QByteArray seal(Kind kind, const QByteArray &body);
+    
+private:
+    static bool open(const QByteArray &blob, Kind kind, QByteArray &body);
+    static Compression compress(const QByteArray &body, QByteArray &compressed);
+    static bool decompress(Compression method, const char *data, int size, QByteArray &body);
+    static void setupStream(QDataStream &stream);
+};
+
+#endif // BLOBCODEC_H
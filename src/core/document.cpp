@@ -1,11 +1,16 @@
 #include "document.h"
+#include "fractionalindex.h"
 #include <QUuid>
 #include <QJsonObject>
 #include <QJsonArray>
 #include <QJsonDocument>
 #include <QDateTime>
 #include <QRegularExpression>
+#include <QSignalBlocker>
+#include <QThread>
+#include <QtConcurrent>
 #include <algorithm>
+#include <numeric>
 
 Document::Document(QObject *parent)
     : QObject(parent)
@@ -13,6 +18,8 @@ Document::Document(QObject *parent)
     , m_createdDate(QDateTime::currentDateTime())
     , m_modifiedDate(QDateTime::currentDateTime())
     , m_modified(false)
+    , m_linksChanged(false)
+    , m_maxLoadedPages(16)
 {
     generateId();
     // Create a default page
@@ -25,6 +32,8 @@ Document::Document(const QString &title, QObject *parent)
     , m_createdDate(QDateTime::currentDateTime())
     , m_modifiedDate(QDateTime::currentDateTime())
     , m_modified(false)
+    , m_linksChanged(false)
+    , m_maxLoadedPages(16)
 {
     generateId();
     // Create a default page
@@ -67,8 +76,16 @@ void Document::addPage(std::shared_ptr<Page> page)
     if (!page) return;
     
     m_pages.append(page);
+    m_removedPageIds.removeAll(page->id());
+    assignPosition(m_pages.size() - 1);
     connectPageSignals(page);
     
+    // Its stored rows, if any, may have been deleted by a save since it was
+    // removed, so an added page is written in full
+    if (page->isLoaded()) {
+        page->markAllDirty();
+    }
+    
     if (!m_currentPage) {
         setCurrentPage(page);
     }
@@ -83,8 +100,14 @@ void Document::insertPage(int index, std::shared_ptr<Page> page)
     
     index = qBound(0, index, m_pages.size());
     m_pages.insert(index, page);
+    m_removedPageIds.removeAll(page->id());
+    assignPosition(index);
     connectPageSignals(page);
     
+    if (page->isLoaded()) {
+        page->markAllDirty();
+    }
+    
     if (!m_currentPage) {
         setCurrentPage(page);
     }
@@ -101,6 +124,9 @@ void Document::removePage(std::shared_ptr<Page> page)
     if (index >= 0) {
         disconnectPageSignals(page);
         m_pages.removeAt(index);
+        m_recentPages.removeAll(page);
+        m_removedPageIds.append(page->id());
+        removeLinksOf(page->id());
         
         if (m_currentPage == page) {
             if (m_pages.isEmpty()) {
@@ -127,8 +153,10 @@ void Document::clearPages()
 {
     for (auto &page : m_pages) {
         disconnectPageSignals(page);
+        m_removedPageIds.append(page->id());
     }
     m_pages.clear();
+    m_recentPages.clear();
     setCurrentPage(nullptr);
     markAsModified();
 }
@@ -164,6 +192,12 @@ void Document::movePage(int fromIndex, int toIndex)
         
         auto page = m_pages[fromIndex];
         m_pages.move(fromIndex, toIndex);
+        
+        // Only the moved page gets a new position
+        assignPosition(toIndex);
+        if (!m_movedPageIds.contains(page->id())) {
+            m_movedPageIds.append(page->id());
+        }
         markAsModified();
         emit pageMoved(page, fromIndex, toIndex);
     }
@@ -173,6 +207,7 @@ void Document::duplicatePage(int index)
 {
     if (index >= 0 && index < m_pages.size()) {
         auto originalPage = m_pages[index];
+        ensurePageLoaded(originalPage);
         auto clonedPage = originalPage->clone();
         clonedPage->setTitle(originalPage->title() + " (Copy)");
         
@@ -190,6 +225,7 @@ std::shared_ptr<Page> Document::createNewPage(const QString &title)
 void Document::setCurrentPage(std::shared_ptr<Page> page)
 {
     if (m_currentPage != page) {
+        requestPage(page);
         m_currentPage = page;
         emit currentPageChanged(m_currentPage);
     }
@@ -200,6 +236,76 @@ void Document::setCurrentPage(int index)
     setCurrentPage(pageAt(index));
 }
 
+void Document::setPageLoader(PageLoader loader)
+{
+    m_pageLoader = std::move(loader);
+}
+
+void Document::setPageRequester(PageRequester requester)
+{
+    m_pageRequester = std::move(requester);
+}
+
+bool Document::ensurePageLoaded(std::shared_ptr<Page> page)
+{
+    if (!page) return false;
+    
+    if (!page->isLoaded() && !m_pageLoader) {
+        return false;
+    }
+    return fillPage(page, [this, page](Page &) {
+        return m_pageLoader(page);
+    });
+}
+
+void Document::requestPage(std::shared_ptr<Page> page)
+{
+    if (!page) return;
+    
+    if (page->isLoaded() || !m_pageRequester) {
+        ensurePageLoaded(page);
+        return;
+    }
+    
+    if (!m_requestedPageIds.contains(page->id())) {
+        m_requestedPageIds.insert(page->id());
+        m_pageRequester(page);
+    }
+}
+
+bool Document::fillPage(std::shared_ptr<Page> page, const std::function<bool(Page &)> &fill)
+{
+    m_requestedPageIds.remove(page->id());
+    
+    // A page removed while it was being read, or loaded by an edit in the
+    // meantime, is left as it is
+    if (!m_pages.contains(page)) {
+        return false;
+    }
+    
+    if (!page->isLoaded()) {
+        // Filling a stub is not an edit; its signals must not mark the document modified
+        {
+            const QSignalBlocker blocker(page.get());
+            if (!fill(*page)) {
+                return false;
+            }
+        }
+        page->announceLoaded();
+        emit pageLoaded(page);
+    }
+    
+    touchPage(page);
+    evictPages();
+    return true;
+}
+
+void Document::setMaxLoadedPages(int count)
+{
+    m_maxLoadedPages = qMax(1, count);
+    evictPages();
+}
+
 void Document::setTags(const QStringList &tags)
 {
     if (m_tags != tags) {
@@ -240,6 +346,8 @@ QVector<std::shared_ptr<Page>> Document::searchPages(const QString &query) const
         if (page->title().contains(regex)) {
             result.append(page);
         } else {
+            page->ensureLoaded();
+            
             // Search in page objects
             auto objects = page->findObjectsContaining(query);
             if (!objects.isEmpty()) {
@@ -256,6 +364,7 @@ QVector<std::shared_ptr<Object>> Document::searchObjects(const QString &query) c
     QVector<std::shared_ptr<Object>> result;
     
     for (const auto &page : m_pages) {
+        page->ensureLoaded();
         auto objects = page->findObjectsContaining(query);
         result.append(objects);
     }
@@ -280,94 +389,176 @@ QVector<std::shared_ptr<Page>> Document::findPagesByTag(const QString &tag) cons
 
 QStringList Document::getBacklinks(const QString &pageId) const
 {
-    QStringList result;
-    
-    for (auto it = m_links.begin(); it != m_links.end(); ++it) {
-        if (it.value().contains(pageId)) {
-            result.append(it.key());
-        }
-    }
-    
-    return result;
+    return m_backlinks.value(pageId);
 }
 
 void Document::addLink(const QString &fromPageId, const QString &toPageId)
 {
     if (!m_links[fromPageId].contains(toPageId)) {
         m_links[fromPageId].append(toPageId);
+        m_backlinks[toPageId].append(fromPageId);
+        m_linksChanged = true;
         markAsModified();
+        emit linkAdded(fromPageId, toPageId);
     }
 }
 
 void Document::removeLink(const QString &fromPageId, const QString &toPageId)
 {
-    if (m_links[fromPageId].removeAll(toPageId) > 0) {
-        markAsModified();
+    auto outgoing = m_links.find(fromPageId);
+    if (outgoing == m_links.end() || outgoing->removeAll(toPageId) == 0) {
+        return;
     }
+    if (outgoing->isEmpty()) {
+        m_links.erase(outgoing);
+    }
+    
+    auto incoming = m_backlinks.find(toPageId);
+    if (incoming != m_backlinks.end()) {
+        incoming->removeAll(fromPageId);
+        if (incoming->isEmpty()) {
+            m_backlinks.erase(incoming);
+        }
+    }
+    
+    m_linksChanged = true;
+    markAsModified();
+    emit linkRemoved(fromPageId, toPageId);
+}
+
+QVector<QPair<QString, QString>> Document::links() const
+{
+    QVector<QPair<QString, QString>> result;
+    for (auto it = m_links.begin(); it != m_links.end(); ++it) {
+        for (const QString &toPageId : it.value()) {
+            result.append(qMakePair(it.key(), toPageId));
+        }
+    }
+    return result;
 }
 
 QJsonObject Document::toJson() const
 {
     QJsonObject json;
-    json["id"] = m_id;
-    json["title"] = m_title;
-    json["description"] = m_description;
-    json["createdDate"] = m_createdDate.toString(Qt::ISODate);
-    json["modifiedDate"] = m_modifiedDate.toString(Qt::ISODate);
-    json["tags"] = QJsonArray::fromStringList(m_tags);
+    writeMetadata(json);
     
     QJsonArray pagesArray;
     for (const auto &page : m_pages) {
+        page->ensureLoaded();
         pagesArray.append(page->toJson());
     }
     json["pages"] = pagesArray;
     
-    // Save links
-    QJsonObject linksObj;
-    for (auto it = m_links.begin(); it != m_links.end(); ++it) {
-        linksObj[it.key()] = QJsonArray::fromStringList(it.value());
-    }
-    json["links"] = linksObj;
-    
     return json;
 }
 
 void Document::fromJson(const QJsonObject &json)
 {
-    m_id = json["id"].toString();
-    m_title = json["title"].toString();
-    m_description = json["description"].toString();
-    m_createdDate = QDateTime::fromString(json["createdDate"].toString(), Qt::ISODate);
-    m_modifiedDate = QDateTime::fromString(json["modifiedDate"].toString(), Qt::ISODate);
+    readMetadata(json);
     
-    // Load tags
-    QJsonArray tagsArray = json["tags"].toArray();
-    m_tags.clear();
-    for (const QJsonValue &value : tagsArray) {
-        m_tags.append(value.toString());
+    // Clear existing pages
+    clearPages();
+    
+    // Pages and their objects are built in parallel on the global pool and
+    // pushed to this document's thread by the thread that built them; only
+    // adding them, which wires up their signals, happens here
+    const QJsonArray pagesArray = json["pages"].toArray();
+    QVector<std::shared_ptr<Page>> pages(pagesArray.size());
+    std::shared_ptr<Page> *results = pages.data();
+    QThread *owner = thread();
+    QVector<int> indexes(pagesArray.size());
+    std::iota(indexes.begin(), indexes.end(), 0);
+    
+    QtConcurrent::blockingMap(indexes, [&pagesArray, results, owner](int index) {
+        auto page = std::make_shared<Page>();
+        page->fromJson(pagesArray.at(index).toObject());
+        for (const auto &object : page->objects()) {
+            object->moveToThread(owner);
+        }
+        page->moveToThread(owner);
+        results[index] = page;
+    });
+    
+    for (const auto &page : pages) {
+        addPage(page);
+    }
+    
+    m_modified = false;
+}
+
+QJsonObject Document::toManifest() const
+{
+    QJsonObject json;
+    writeMetadata(json);
+    json["manifestVersion"] = 1;
+    
+    // Only page identity and order; content lives in the pages table
+    QJsonArray pagesArray;
+    for (const auto &page : m_pages) {
+        pagesArray.append(QJsonObject{
+            {"id", page->id()},
+            {"title", page->title()},
+            {"size", QJsonObject{
+                {"width", page->size().width()},
+                {"height", page->size().height()}
+            }}
+        });
     }
+    json["pages"] = pagesArray;
+    
+    return json;
+}
+
+void Document::fromManifest(const QJsonObject &json)
+{
+    readMetadata(json);
     
     // Clear existing pages
     clearPages();
     
-    // Load pages
+    // Create page stubs in manifest order; content is filled in by the page loader
     QJsonArray pagesArray = json["pages"].toArray();
     for (const QJsonValue &value : pagesArray) {
-        auto page = std::make_shared<Page>();
-        page->fromJson(value.toObject());
-        addPage(page);
+        QJsonObject pageObj = value.toObject();
+        QJsonObject sizeObj = pageObj["size"].toObject();
+        addPageStub(pageObj["id"].toString(), pageObj["title"].toString(),
+                    QSize(sizeObj["width"].toInt(), sizeObj["height"].toInt()));
     }
     
-    // Load links
-    m_links.clear();
-    QJsonObject linksObj = json["links"].toObject();
-    for (auto it = linksObj.begin(); it != linksObj.end(); ++it) {
-        QStringList links;
-        QJsonArray linksArray = it.value().toArray();
-        for (const QJsonValue &value : linksArray) {
-            links.append(value.toString());
-        }
-        m_links[it.key()] = links;
+    m_modified = false;
+}
+
+void Document::writeManifest(QDataStream &out) const
+{
+    out << m_id << m_title << m_description << m_createdDate << m_modifiedDate
+        << m_tags << m_links;
+    
+    out << static_cast<qint32>(m_pages.size());
+    for (const auto &page : m_pages) {
+        out << page->id() << page->title() << page->size();
+    }
+}
+
+void Document::readManifest(QDataStream &in)
+{
+    in >> m_id >> m_title >> m_description >> m_createdDate >> m_modifiedDate
+       >> m_tags >> m_links;
+    
+    // Binary manifests come from storage, which already holds these links
+    rebuildBacklinks();
+    m_linksChanged = false;
+    
+    // Clear existing pages
+    clearPages();
+    
+    qint32 pageCount = 0;
+    in >> pageCount;
+    for (qint32 i = 0; i < pageCount && in.status() == QDataStream::Ok; ++i) {
+        QString id;
+        QString title;
+        QSize size;
+        in >> id >> title >> size;
+        addPageStub(id, title, size);
     }
     
     m_modified = false;
@@ -404,6 +595,45 @@ void Document::markAsModified()
     setModified(true);
 }
 
+void Document::markSaved()
+{
+    for (const auto &page : m_pages) {
+        page->markClean();
+    }
+    m_removedPageIds.clear();
+    m_movedPageIds.clear();
+    m_linksChanged = false;
+    setModified(false);
+}
+
+void Document::restorePagePositions(const QHash<QString, QString> &positions)
+{
+    bool complete = true;
+    for (const auto &page : m_pages) {
+        auto position = positions.find(page->id());
+        if (position != positions.end()) {
+            page->setPosition(position.value());
+        } else {
+            complete = false;
+        }
+    }
+    
+    if (complete) {
+        std::stable_sort(m_pages.begin(), m_pages.end(),
+                         [](const std::shared_ptr<Page> &a, const std::shared_ptr<Page> &b) {
+            return a->position() < b->position();
+        });
+    }
+}
+
+void Document::markUnsaved()
+{
+    // A save that never reached the database. Its content is kept by whoever
+    // wrote it, since the pages may have been evicted since; the document
+    // only has to be saved again.
+    setModified(true);
+}
+
 void Document::generateId()
 {
     m_id = QUuid::createUuid().toString(QUuid::WithoutBraces);
@@ -414,6 +644,9 @@ void Document::connectPageSignals(std::shared_ptr<Page> page)
     connect(page.get(), &Page::titleChanged, this, &Document::onPageTitleChanged);
     connect(page.get(), &Page::objectAdded, this, &Document::onPageObjectAdded);
     connect(page.get(), &Page::objectRemoved, this, &Document::onPageObjectRemoved);
+    connect(page.get(), &Page::changed, this, &Document::onPageChanged);
+    connect(page.get(), &Page::loadRequested, this, &Document::onPageLoadRequested);
+    connect(page.get(), &Page::prefetchRequested, this, &Document::onPagePrefetchRequested);
 }
 
 void Document::disconnectPageSignals(std::shared_ptr<Page> page)
@@ -421,6 +654,9 @@ void Document::disconnectPageSignals(std::shared_ptr<Page> page)
     disconnect(page.get(), &Page::titleChanged, this, &Document::onPageTitleChanged);
     disconnect(page.get(), &Page::objectAdded, this, &Document::onPageObjectAdded);
     disconnect(page.get(), &Page::objectRemoved, this, &Document::onPageObjectRemoved);
+    disconnect(page.get(), &Page::changed, this, &Document::onPageChanged);
+    disconnect(page.get(), &Page::loadRequested, this, &Document::onPageLoadRequested);
+    disconnect(page.get(), &Page::prefetchRequested, this, &Document::onPagePrefetchRequested);
 }
 
 void Document::updateModifiedDate()
@@ -428,6 +664,137 @@ void Document::updateModifiedDate()
     m_modifiedDate = QDateTime::currentDateTime();
 }
 
+void Document::addPageStub(const QString &id, const QString &title, const QSize &size)
+{
+    auto page = std::make_shared<Page>(title);
+    page->setId(id);
+    page->setSize(size);
+    page->setLoaded(false);
+    addPage(page);
+}
+
+void Document::assignPosition(int index)
+{
+    const QString before = index > 0 ? m_pages[index - 1]->position() : QString();
+    const QString after = index + 1 < m_pages.size() ? m_pages[index + 1]->position() : QString();
+    
+    // Neighbours without usable positions, e.g. from an import, are renumbered
+    const QString position = FractionalIndex::between(before, after);
+    if (position.isEmpty() || (index > 0 && before.isEmpty()) ||
+        (index + 1 < m_pages.size() && after.isEmpty())) {
+        renumberPositions();
+        return;
+    }
+    m_pages[index]->setPosition(position);
+}
+
+void Document::renumberPositions()
+{
+    QString position;
+    for (const auto &page : m_pages) {
+        position = FractionalIndex::after(position);
+        page->setPosition(position);
+        if (!m_movedPageIds.contains(page->id())) {
+            m_movedPageIds.append(page->id());
+        }
+    }
+}
+
+void Document::touchPage(std::shared_ptr<Page> page)
+{
+    m_recentPages.removeOne(page);
+    m_recentPages.prepend(page);
+}
+
+void Document::evictPages()
+{
+    // Pages can only be dropped if they can be loaded again
+    if (!m_pageLoader) return;
+    
+    for (int i = m_recentPages.size() - 1; i >= 0 && m_recentPages.size() > m_maxLoadedPages; --i) {
+        auto page = m_recentPages[i];
+        
+        // Unsaved edits and the page on screen stay in memory
+        if (page == m_currentPage || page->isDirty()) {
+            continue;
+        }
+        
+        page->unload();
+        m_recentPages.removeAt(i);
+    }
+}
+
+void Document::writeMetadata(QJsonObject &json) const
+{
+    json["id"] = m_id;
+    json["title"] = m_title;
+    json["description"] = m_description;
+    json["createdDate"] = m_createdDate.toString(Qt::ISODate);
+    json["modifiedDate"] = m_modifiedDate.toString(Qt::ISODate);
+    json["tags"] = QJsonArray::fromStringList(m_tags);
+    
+    // Save links
+    QJsonObject linksObj;
+    for (auto it = m_links.begin(); it != m_links.end(); ++it) {
+        linksObj[it.key()] = QJsonArray::fromStringList(it.value());
+    }
+    json["links"] = linksObj;
+}
+
+void Document::readMetadata(const QJsonObject &json)
+{
+    m_id = json["id"].toString();
+    m_title = json["title"].toString();
+    m_description = json["description"].toString();
+    m_createdDate = QDateTime::fromString(json["createdDate"].toString(), Qt::ISODate);
+    m_modifiedDate = QDateTime::fromString(json["modifiedDate"].toString(), Qt::ISODate);
+    
+    // Load tags
+    QJsonArray tagsArray = json["tags"].toArray();
+    m_tags.clear();
+    for (const QJsonValue &value : tagsArray) {
+        m_tags.append(value.toString());
+    }
+    
+    // Load links
+    m_links.clear();
+    QJsonObject linksObj = json["links"].toObject();
+    for (auto it = linksObj.begin(); it != linksObj.end(); ++it) {
+        QStringList links;
+        QJsonArray linksArray = it.value().toArray();
+        for (const QJsonValue &value : linksArray) {
+            links.append(value.toString());
+        }
+        m_links[it.key()] = links;
+    }
+    rebuildBacklinks();
+    m_linksChanged = !m_links.isEmpty();
+}
+
+void Document::rebuildBacklinks()
+{
+    m_backlinks.clear();
+    for (auto it = m_links.begin(); it != m_links.end(); ++it) {
+        for (const QString &toPageId : it.value()) {
+            m_backlinks[toPageId].append(it.key());
+        }
+    }
+}
+
+void Document::removeLinksOf(const QString &pageId)
+{
+    // Both directions are found through the maps; no scan over all links
+    const QStringList outgoing = m_links.value(pageId);
+    for (const QString &toPageId : outgoing) {
+        removeLink(pageId, toPageId);
+    }
+    
+    const QStringList incoming = m_backlinks.value(pageId);
+    for (const QString &fromPageId : incoming) {
+        removeLink(fromPageId, pageId);
+    }
+}
+
 void Document::onPageTitleChanged(const QString &newTitle)
 {
     Q_UNUSED(newTitle)
@@ -445,3 +812,30 @@ void Document::onPageObjectRemoved(std::shared_ptr<Object> object)
     Q_UNUSED(object)
     markAsModified();
 }
+
+void Document::onPageChanged()
+{
+    markAsModified();
+}
+
+void Document::onPageLoadRequested()
+{
+    Page *requester = qobject_cast<Page *>(sender());
+    for (const auto &page : m_pages) {
+        if (page.get() == requester) {
+            ensurePageLoaded(page);
+            break;
+        }
+    }
+}
+
+void Document::onPagePrefetchRequested()
+{
+    Page *requester = qobject_cast<Page *>(sender());
+    for (const auto &page : m_pages) {
+        if (page.get() == requester) {
+            requestPage(page);
+            break;
+        }
+    }
+}
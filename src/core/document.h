@@ -9,6 +9,11 @@
 #include <QJsonDocument>
 #include <QDateTime>
 #include <QStringList>
+#include <QList>
+#include <QHash>
+#include <QSet>
+#include <QPair>
+#include <functional>
 #include <memory>
 
 /**
@@ -61,6 +66,19 @@ public:
     void setCurrentPage(std::shared_ptr<Page> page);
     void setCurrentPage(int index);
     
+    // Lazy page loading. The loader fills a page before returning; the
+    // requester only starts reading it and hands the result to fillPage()
+    // on this document's thread later, so showing a page never waits.
+    using PageLoader = std::function<bool(std::shared_ptr<Page>)>;
+    using PageRequester = std::function<void(std::shared_ptr<Page>)>;
+    void setPageLoader(PageLoader loader);
+    void setPageRequester(PageRequester requester);
+    bool ensurePageLoaded(std::shared_ptr<Page> page);
+    void requestPage(std::shared_ptr<Page> page);
+    bool fillPage(std::shared_ptr<Page> page, const std::function<bool(Page &)> &fill);
+    int maxLoadedPages() const { return m_maxLoadedPages; }
+    void setMaxLoadedPages(int count);
+    
     // Tags and metadata
     QStringList tags() const { return m_tags; }
     void setTags(const QStringList &tags);
@@ -77,11 +95,19 @@ public:
     QStringList getBacklinks(const QString &pageId) const;
     void addLink(const QString &fromPageId, const QString &toPageId);
     void removeLink(const QString &fromPageId, const QString &toPageId);
+    QVector<QPair<QString, QString>> links() const;
+    bool linksChanged() const { return m_linksChanged; }
     
     // Serialization
     QJsonObject toJson() const;
     void fromJson(const QJsonObject &json);
     
+    // Storage manifest: metadata, links and page order without page content
+    QJsonObject toManifest() const;
+    void fromManifest(const QJsonObject &json);
+    void writeManifest(QDataStream &out) const;
+    void readManifest(QDataStream &in);
+    
     // Operations
     std::unique_ptr<Document> clone() const;
     
@@ -93,6 +119,15 @@ public:
     bool isModified() const { return m_modified; }
     void setModified(bool modified);
     void markAsModified();
+    
+    // Persistence state
+    QStringList removedPageIds() const { return m_removedPageIds; }
+    QStringList movedPageIds() const { return m_movedPageIds; }
+    void markSaved();
+    void markUnsaved();
+    
+    // Positions as stored; pages are put in position order when all have one
+    void restorePagePositions(const QHash<QString, QString> &positions);
 
 signals:
     void titleChanged(const QString &newTitle);
@@ -101,6 +136,9 @@ signals:
     void pageRemoved(std::shared_ptr<Page> page, int index);
     void pageMoved(std::shared_ptr<Page> page, int fromIndex, int toIndex);
     void currentPageChanged(std::shared_ptr<Page> newPage);
+    void pageLoaded(std::shared_ptr<Page> page);
+    void linkAdded(const QString &fromPageId, const QString &toPageId);
+    void linkRemoved(const QString &fromPageId, const QString &toPageId);
     void tagsChanged(const QStringList &newTags);
     void modifiedChanged(bool modified);
 
@@ -114,17 +152,38 @@ private:
     std::shared_ptr<Page> m_currentPage;
     QStringList m_tags;
     QMap<QString, QStringList> m_links; // from page ID to list of linked page IDs
+    QHash<QString, QStringList> m_backlinks; // to page ID to the pages linking to it
+    bool m_linksChanged;                // links changed since the last save
     bool m_modified;
+    QStringList m_removedPageIds; // pages removed since the last save
+    QStringList m_movedPageIds;   // pages given a new position since the last save
+    PageLoader m_pageLoader;
+    PageRequester m_pageRequester;
+    QSet<QString> m_requestedPageIds;   // requested and not filled in yet
+    QList<std::shared_ptr<Page>> m_recentPages; // most recently used first
+    int m_maxLoadedPages;
     
     void generateId();
     void connectPageSignals(std::shared_ptr<Page> page);
     void disconnectPageSignals(std::shared_ptr<Page> page);
     void updateModifiedDate();
+    void writeMetadata(QJsonObject &json) const;
+    void readMetadata(const QJsonObject &json);
+    void addPageStub(const QString &id, const QString &title, const QSize &size);
+    void touchPage(std::shared_ptr<Page> page);
+    void evictPages();
+    void rebuildBacklinks();
+    void removeLinksOf(const QString &pageId);
+    void assignPosition(int index);
+    void renumberPositions();
 
 private slots:
     void onPageTitleChanged(const QString &newTitle);
     void onPageObjectAdded(std::shared_ptr<Object> object);
     void onPageObjectRemoved(std::shared_ptr<Object> object);
+    void onPageChanged();
+    void onPageLoadRequested();
+    void onPagePrefetchRequested();
 };
 
 #endif // DOCUMENT_H
@@ -26,13 +26,17 @@ void DrawingObject::setCurrentMode(DrawingMode mode)
     if (m_currentMode != mode) {
         m_currentMode = mode;
         setupDefaultPen();
+        markChanged();
         emit drawingModeChanged(mode);
     }
 }
 
 void DrawingObject::setCurrentPen(const QPen &pen)
 {
-    m_currentPen = pen;
+    if (m_currentPen != pen) {
+        m_currentPen = pen;
+        markChanged();
+    }
 }
 
 void DrawingObject::setCurrentBrush(const QBrush &brush)
@@ -43,6 +47,7 @@ void DrawingObject::setCurrentBrush(const QBrush &brush)
 void DrawingObject::addStroke(const Stroke &stroke)
 {
     m_strokes.append(stroke);
+    markChanged();
     emit strokeAdded(m_strokes.size() - 1);
 }
 
@@ -51,6 +56,7 @@ void DrawingObject::removeStroke(int index)
     if (index >= 0 && index < m_strokes.size()) {
         m_strokes.removeAt(index);
         m_selectedStrokes.removeAll(index);
+        markChanged();
         emit strokeRemoved(index);
     }
 }
@@ -59,6 +65,7 @@ void DrawingObject::clearStrokes()
 {
     m_strokes.clear();
     m_selectedStrokes.clear();
+    markChanged();
     emit strokeSelectionChanged();
 }
 
@@ -158,6 +165,10 @@ void DrawingObject::moveSelectedStrokes(const QPoint &delta)
             m_strokes[index].path.translate(delta);
         }
     }
+    
+    if (!m_selectedStrokes.isEmpty()) {
+        markChanged();
+    }
 }
 
 void DrawingObject::deleteSelectedStrokes()
@@ -281,6 +292,53 @@ void DrawingObject::fromJson(const QJsonObject &json)
     );
 }
 
+void DrawingObject::writeBinary(QDataStream &out) const
+{
+    Object::writeBinary(out);
+    
+    // Paths, pens and brushes use Qt's native stream encoding
+    out << static_cast<qint32>(m_strokes.size());
+    for (const Stroke &stroke : m_strokes) {
+        writeStroke(out, stroke);
+    }
+    
+    out << static_cast<quint8>(m_currentMode) << m_currentPen;
+}
+
+void DrawingObject::readBinary(QDataStream &in)
+{
+    Object::readBinary(in);
+    
+    m_strokes.clear();
+    m_selectedStrokes.clear();
+    
+    qint32 strokeCount = 0;
+    in >> strokeCount;
+    m_strokes.reserve(qMax(0, strokeCount));
+    for (qint32 i = 0; i < strokeCount && in.status() == QDataStream::Ok; ++i) {
+        m_strokes.append(readStroke(in));
+    }
+    
+    quint8 currentMode = 0;
+    in >> currentMode >> m_currentPen;
+    m_currentMode = static_cast<DrawingMode>(currentMode);
+}
+
+void DrawingObject::writeStroke(QDataStream &out, const Stroke &stroke)
+{
+    out << static_cast<quint8>(stroke.mode) << stroke.timestamp
+        << stroke.path << stroke.pen << stroke.brush;
+}
+
+DrawingObject::Stroke DrawingObject::readStroke(QDataStream &in)
+{
+    Stroke stroke;
+    quint8 mode = 0;
+    in >> mode >> stroke.timestamp >> stroke.path >> stroke.pen >> stroke.brush;
+    stroke.mode = static_cast<DrawingMode>(mode);
+    return stroke;
+}
+
 std::unique_ptr<Object> DrawingObject::clone() const
 {
     auto clone = std::make_unique<DrawingObject>();
@@ -65,6 +65,7 @@ public:
     void addPointToStroke(const QPoint &point);
     void finishStroke();
     void cancelStroke();
+    bool isDrawing() const { return m_drawing; }
     
     // Stroke editing
     int getStrokeAt(const QPoint &point) const;
@@ -84,6 +85,10 @@ public:
     // Serialization
     QJsonObject toJson() const override;
     void fromJson(const QJsonObject &json) override;
+    void writeBinary(QDataStream &out) const override;
+    void readBinary(QDataStream &in) override;
+    static void writeStroke(QDataStream &out, const Stroke &stroke);
+    static Stroke readStroke(QDataStream &in);
     
     // Operations
     std::unique_ptr<Object> clone() const override;
@@ -0,0 +1,69 @@
+#include "fractionalindex.h"
+
+namespace {
+const QString Digits = QStringLiteral("0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz");
+}
+
+QString FractionalIndex::between(const QString &before, const QString &after)
+{
+    if (!isValid(before) || !isValid(after)) {
+        return QString();
+    }
+    if (after.isEmpty()) {
+        return FractionalIndex::after(before);
+    }
+    if (before >= after) {
+        return QString();
+    }
+    return midpoint(before, after);
+}
+
+QString FractionalIndex::after(const QString &before)
+{
+    if (before.isEmpty()) {
+        return QString(Digits.at(1));
+    }
+
+    // Bumping the last digit keeps appended keys as short as possible
+    const int last = Digits.indexOf(before.at(before.size() - 1));
+    if (last + 1 < Digits.size()) {
+        return before.left(before.size() - 1) + Digits.at(last + 1);
+    }
+    return before + Digits.at(1);
+}
+
+bool FractionalIndex::isValid(const QString &key)
+{
+    for (const QChar digit : key) {
+        if (!Digits.contains(digit)) {
+            return false;
+        }
+    }
+    return key.isEmpty() || key.at(key.size() - 1) != Digits.at(0);
+}
+
+QString FractionalIndex::midpoint(const QString &lower, const QString &upper)
+{
+    // An empty upper bound stands for 1; a lower bound is padded with zeros
+    int common = 0;
+    while (common < upper.size() &&
+           (common < lower.size() ? lower.at(common) : Digits.at(0)) == upper.at(common)) {
+        ++common;
+    }
+    if (common > 0) {
+        return upper.left(common) + midpoint(lower.mid(common), upper.mid(common));
+    }
+
+    const int lowerDigit = lower.isEmpty() ? 0 : Digits.indexOf(lower.at(0));
+    const int upperDigit = upper.isEmpty() ? Digits.size() : Digits.indexOf(upper.at(0));
+    if (upperDigit - lowerDigit > 1) {
+        return QString(Digits.at((lowerDigit + upperDigit) / 2));
+    }
+
+    // Adjacent digits: the upper digit alone still sorts below a longer upper
+    // bound, otherwise the key continues after the lower digit
+    if (upper.size() > 1) {
+        return upper.left(1);
+    }
+    return Digits.at(lowerDigit) + midpoint(lower.mid(1), QString());
+}
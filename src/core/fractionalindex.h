@@ -0,0 +1,31 @@
+#ifndef FRACTIONALINDEX_H
+#define FRACTIONALINDEX_H
+
+#include <QString>
+
+/**
+ * @brief Sortable position keys that leave room between any two of them
+ *
+ * A key is a base-62 fraction written with digits that sort in ASCII order,
+ * so keys compare correctly as plain strings, including in SQLite. A key
+ * never ends in '0', which keeps room below every key. Placing an item
+ * between two others only needs a new key for that item; its neighbours
+ * keep theirs.
+ */
+class FractionalIndex
+{
+public:
+    // A key strictly between before and after; an empty bound is open.
+    // Returns an empty string if before does not sort below after.
+    static QString between(const QString &before, const QString &after);
+
+    // A short key above before, for appending
+    static QString after(const QString &before);
+
+    static bool isValid(const QString &key);
+
+private:
+    static QString midpoint(const QString &lower, const QString &upper);
+};
+
+#endif // FRACTIONALINDEX_H
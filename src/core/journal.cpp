@@ -0,0 +1,357 @@
+#include "journal.h"
+#include "blobcodec.h"
+#include "drawingobject.h"
+#include <QDataStream>
+#include <algorithm>
+
+namespace {
+void setupStream(QDataStream &stream)
+{
+    // Same pinned version as stored blobs
+    stream.setVersion(QDataStream::Qt_5_12);
+}
+
+std::shared_ptr<Object> findObject(const Page &page, const QString &objectId)
+{
+    const auto &objects = page.objects();
+    auto it = std::find_if(objects.begin(), objects.end(), [&objectId](const std::shared_ptr<Object> &object) {
+        return object->id() == objectId;
+    });
+    return it != objects.end() ? *it : nullptr;
+}
+}
+
+JournalEntry JournalEntry::objectWritten(const QString &pageId, const Object &object)
+{
+    JournalEntry entry;
+    entry.operation = ObjectWritten;
+    entry.pageId = pageId;
+    entry.objectId = object.id();
+    entry.data = BlobCodec::encodeObject(object);
+    return entry;
+}
+
+JournalEntry JournalEntry::objectMoved(const QString &pageId, const Object &object)
+{
+    JournalEntry entry;
+    entry.operation = ObjectMoved;
+    entry.pageId = pageId;
+    entry.objectId = object.id();
+
+    QDataStream out(&entry.data, QIODevice::WriteOnly);
+    setupStream(out);
+    out << object.bounds();
+    return entry;
+}
+
+JournalEntry JournalEntry::strokeAppended(const QString &pageId, const DrawingObject &drawing, int index)
+{
+    JournalEntry entry;
+    entry.operation = StrokeAppended;
+    entry.pageId = pageId;
+    entry.objectId = drawing.id();
+
+    QDataStream out(&entry.data, QIODevice::WriteOnly);
+    setupStream(out);
+    out << static_cast<qint32>(index);
+    DrawingObject::writeStroke(out, drawing.strokes().at(index));
+    return entry;
+}
+
+JournalEntry JournalEntry::objectRemoved(const QString &pageId, const QString &objectId)
+{
+    JournalEntry entry;
+    entry.operation = ObjectRemoved;
+    entry.pageId = pageId;
+    entry.objectId = objectId;
+    return entry;
+}
+
+bool JournalEntry::apply(Page &page) const
+{
+    std::shared_ptr<Object> existing = findObject(page, objectId);
+
+    switch (operation) {
+    case ObjectWritten: {
+        std::shared_ptr<Object> object = BlobCodec::decodeObject(data);
+        if (!object) {
+            return false;
+        }
+        if (existing) {
+            page.removeObject(existing);
+        }
+        page.addObject(object);
+        return true;
+    }
+
+    case ObjectMoved: {
+        if (!existing) {
+            return false;
+        }
+
+        QDataStream in(data);
+        setupStream(in);
+        QRect bounds;
+        in >> bounds;
+        if (in.status() != QDataStream::Ok) {
+            return false;
+        }
+        existing->setBounds(bounds);
+        return true;
+    }
+
+    case StrokeAppended: {
+        auto drawing = std::dynamic_pointer_cast<DrawingObject>(existing);
+        if (!drawing) {
+            return false;
+        }
+
+        QDataStream in(data);
+        setupStream(in);
+        qint32 index = 0;
+        in >> index;
+        DrawingObject::Stroke stroke = DrawingObject::readStroke(in);
+
+        // The stroke is only appended where it was appended; a snapshot that
+        // already holds it has more strokes and is left alone
+        if (in.status() != QDataStream::Ok || index != drawing->strokes().size()) {
+            return false;
+        }
+        drawing->addStroke(stroke);
+        return true;
+    }
+
+    case ObjectRemoved:
+        if (!existing) {
+            return false;
+        }
+        page.removeObject(existing);
+        return true;
+    }
+
+    return false;
+}
+
+JournalRecorder::JournalRecorder(QObject *parent)
+    : QObject(parent)
+    , m_needsSnapshot(false)
+{
+}
+
+JournalRecorder::~JournalRecorder()
+{
+    detach();
+}
+
+void JournalRecorder::attach(std::shared_ptr<Document> document)
+{
+    detach();
+
+    m_document = document;
+    if (!m_document) {
+        return;
+    }
+
+    connect(m_document.get(), &Document::titleChanged, this, &JournalRecorder::onStructureChanged);
+    connect(m_document.get(), &Document::descriptionChanged, this, &JournalRecorder::onStructureChanged);
+    connect(m_document.get(), &Document::tagsChanged, this, &JournalRecorder::onStructureChanged);
+    connect(m_document.get(), &Document::pageAdded, this, &JournalRecorder::onPageAdded);
+    connect(m_document.get(), &Document::pageRemoved, this, &JournalRecorder::onStructureChanged);
+    connect(m_document.get(), &Document::pageMoved, this, &JournalRecorder::onStructureChanged);
+    connect(m_document.get(), &Document::pageLoaded, this, &JournalRecorder::onPageLoaded);
+    connect(m_document.get(), &Document::linkAdded, this, &JournalRecorder::onStructureChanged);
+    connect(m_document.get(), &Document::linkRemoved, this, &JournalRecorder::onStructureChanged);
+
+    for (const auto &page : m_document->pages()) {
+        attachPage(page);
+    }
+}
+
+void JournalRecorder::detach()
+{
+    if (m_document) {
+        disconnect(m_document.get(), nullptr, this, nullptr);
+        for (const auto &page : m_document->pages()) {
+            disconnect(page.get(), nullptr, this, nullptr);
+        }
+    }
+
+    for (const auto &tracked : m_objects) {
+        if (auto object = tracked.object.lock()) {
+            disconnect(object.get(), nullptr, this, nullptr);
+        }
+    }
+
+    m_objects.clear();
+    m_document.reset();
+    clear();
+}
+
+QVector<JournalEntry> JournalRecorder::takeEntries()
+{
+    QVector<JournalEntry> entries = m_removals;
+
+    for (const QString &objectId : m_pendingOrder) {
+        const PendingObject pending = m_pending.value(objectId);
+        auto object = pending.object.lock();
+        if (!object) {
+            continue;
+        }
+
+        // Anything but moves and appended strokes needs the whole object
+        auto drawing = std::dynamic_pointer_cast<DrawingObject>(object);
+        bool strokesPresent = std::all_of(pending.strokes.begin(), pending.strokes.end(), [&drawing](int index) {
+            return drawing && index < drawing->strokes().size();
+        });
+        if (pending.written || !strokesPresent ||
+            pending.changes != pending.moves + pending.strokes.size()) {
+            entries.append(JournalEntry::objectWritten(pending.pageId, *object));
+            continue;
+        }
+
+        if (pending.moves > 0) {
+            entries.append(JournalEntry::objectMoved(pending.pageId, *object));
+        }
+        for (int index : pending.strokes) {
+            entries.append(JournalEntry::strokeAppended(pending.pageId, *drawing, index));
+        }
+    }
+
+    m_removals.clear();
+    m_pending.clear();
+    m_pendingOrder.clear();
+    return entries;
+}
+
+void JournalRecorder::clear()
+{
+    m_removals.clear();
+    m_pending.clear();
+    m_pendingOrder.clear();
+    m_needsSnapshot = false;
+}
+
+void JournalRecorder::requestSnapshot()
+{
+    m_needsSnapshot = true;
+}
+
+void JournalRecorder::attachPage(std::shared_ptr<Page> page)
+{
+    connect(page.get(), &Page::titleChanged, this, &JournalRecorder::onStructureChanged);
+    connect(page.get(), &Page::sizeChanged, this, &JournalRecorder::onStructureChanged);
+    connect(page.get(), &Page::backgroundColorChanged, this, &JournalRecorder::onStructureChanged);
+    connect(page.get(), &Page::objectAdded, this, &JournalRecorder::onObjectAdded);
+    connect(page.get(), &Page::objectRemoved, this, &JournalRecorder::onObjectRemoved);
+
+    for (const auto &object : page->objects()) {
+        attachObject(page->id(), object);
+    }
+}
+
+void JournalRecorder::attachObject(const QString &pageId, std::shared_ptr<Object> object)
+{
+    TrackedObject tracked;
+    tracked.pageId = pageId;
+    tracked.object = object;
+    m_objects.insert(object.get(), tracked);
+
+    connect(object.get(), &Object::changed, this, &JournalRecorder::onObjectChanged);
+    connect(object.get(), &Object::boundsChanged, this, &JournalRecorder::onObjectMoved);
+    if (auto drawing = qobject_cast<DrawingObject *>(object.get())) {
+        connect(drawing, &DrawingObject::strokeAdded, this, &JournalRecorder::onStrokeAdded);
+    }
+}
+
+JournalRecorder::PendingObject *JournalRecorder::pendingFor(QObject *object)
+{
+    auto tracked = m_objects.find(object);
+    if (tracked == m_objects.end()) {
+        return nullptr;
+    }
+
+    auto shared = tracked->object.lock();
+    if (!shared) {
+        return nullptr;
+    }
+
+    const QString objectId = shared->id();
+    auto pending = m_pending.find(objectId);
+    if (pending == m_pending.end()) {
+        PendingObject created;
+        created.pageId = tracked->pageId;
+        created.object = shared;
+        pending = m_pending.insert(objectId, created);
+        m_pendingOrder.append(objectId);
+    }
+    return &pending.value();
+}
+
+void JournalRecorder::onStructureChanged()
+{
+    m_needsSnapshot = true;
+}
+
+void JournalRecorder::onPageAdded(std::shared_ptr<Page> page)
+{
+    attachPage(page);
+    m_needsSnapshot = true;
+}
+
+void JournalRecorder::onPageLoaded(std::shared_ptr<Page> page)
+{
+    // Objects read from storage are already stored; only follow their edits
+    for (const auto &object : page->objects()) {
+        attachObject(page->id(), object);
+    }
+}
+
+void JournalRecorder::onObjectAdded(std::shared_ptr<Object> object)
+{
+    Page *page = qobject_cast<Page *>(sender());
+    if (!page || !object) {
+        return;
+    }
+
+    attachObject(page->id(), object);
+    if (PendingObject *pending = pendingFor(object.get())) {
+        pending->written = true;
+    }
+}
+
+void JournalRecorder::onObjectRemoved(std::shared_ptr<Object> object)
+{
+    Page *page = qobject_cast<Page *>(sender());
+    if (!page || !object) {
+        return;
+    }
+
+    disconnect(object.get(), nullptr, this, nullptr);
+    m_objects.remove(object.get());
+
+    // Edits not yet flushed are moot; removals are flushed before writes
+    m_pending.remove(object->id());
+    m_pendingOrder.removeOne(object->id());
+    m_removals.append(JournalEntry::objectRemoved(page->id(), object->id()));
+}
+
+void JournalRecorder::onObjectChanged()
+{
+    if (PendingObject *pending = pendingFor(sender())) {
+        ++pending->changes;
+    }
+}
+
+void JournalRecorder::onObjectMoved()
+{
+    if (PendingObject *pending = pendingFor(sender())) {
+        ++pending->moves;
+    }
+}
+
+void JournalRecorder::onStrokeAdded(int index)
+{
+    if (PendingObject *pending = pendingFor(sender())) {
+        pending->strokes.append(index);
+    }
+}
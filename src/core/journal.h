@@ -0,0 +1,115 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "document.h"
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QHash>
+#include <QByteArray>
+#include <memory>
+
+class DrawingObject;
+
+/**
+ * @brief One edit recorded in the operation journal
+ *
+ * Entries describe a single object edit. Applying an entry is idempotent, so
+ * replaying entries onto a snapshot that already contains them changes
+ * nothing. Entries older than the snapshot would undo newer edits, so the
+ * journal must never keep any: AsyncStorage does not merge a save into a
+ * queued one once an append has been queued behind that save.
+ */
+struct JournalEntry {
+    enum Operation : quint8 {
+        ObjectWritten = 1,      // data holds the encoded object
+        ObjectMoved = 2,        // data holds the new bounds
+        StrokeAppended = 3,     // data holds the stroke and its index
+        ObjectRemoved = 4
+    };
+
+    Operation operation = ObjectWritten;
+    QString pageId;
+    QString objectId;
+    QByteArray data;
+
+    static JournalEntry objectWritten(const QString &pageId, const Object &object);
+    static JournalEntry objectMoved(const QString &pageId, const Object &object);
+    static JournalEntry strokeAppended(const QString &pageId, const DrawingObject &drawing, int index);
+    static JournalEntry objectRemoved(const QString &pageId, const QString &objectId);
+
+    // Applies the entry to a loaded page; false if it no longer applies
+    bool apply(Page &page) const;
+};
+
+/**
+ * @brief Records object edits of a document as journal entries
+ *
+ * Edits are collected per object between flushes. A flush turns an object
+ * that was only moved or drawn on into small move and stroke entries, and
+ * anything else into a full write. Changes to the document or page structure
+ * are not journaled; they set needsSnapshot() instead.
+ */
+class JournalRecorder : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit JournalRecorder(QObject *parent = nullptr);
+    ~JournalRecorder() override;
+
+    void attach(std::shared_ptr<Document> document);
+    void detach();
+
+    // Entries recorded since the last call, removals first
+    QVector<JournalEntry> takeEntries();
+
+    // Drops everything recorded; used once a snapshot covers it
+    void clear();
+
+    // Makes the next save a snapshot, e.g. for a document not stored yet
+    void requestSnapshot();
+
+    bool hasEntries() const { return !m_removals.isEmpty() || !m_pending.isEmpty(); }
+    bool needsSnapshot() const { return m_needsSnapshot; }
+
+private:
+    struct TrackedObject {
+        QString pageId;
+        std::weak_ptr<Object> object;
+    };
+
+    // Edits to one object since the last flush
+    struct PendingObject {
+        QString pageId;
+        std::weak_ptr<Object> object;
+        int changes = 0;
+        int moves = 0;
+        QVector<int> strokes;
+        bool written = false;
+    };
+
+    std::shared_ptr<Document> m_document;
+    QHash<QObject *, TrackedObject> m_objects;
+    QHash<QString, PendingObject> m_pending;
+    QStringList m_pendingOrder;
+    QVector<JournalEntry> m_removals;
+    bool m_needsSnapshot;
+
+    void attachPage(std::shared_ptr<Page> page);
+    void attachObject(const QString &pageId, std::shared_ptr<Object> object);
+    PendingObject *pendingFor(QObject *object);
+
+private slots:
+    void onStructureChanged();
+    void onPageAdded(std::shared_ptr<Page> page);
+    void onPageLoaded(std::shared_ptr<Page> page);
+    void onObjectAdded(std::shared_ptr<Object> object);
+    void onObjectRemoved(std::shared_ptr<Object> object);
+    void onObjectChanged();
+    void onObjectMoved();
+    void onStrokeAdded(int index);
+};
+
+#endif // JOURNAL_H
@@ -1,14 +1,26 @@
 #include "note.h"
+#include <QFutureWatcher>
 #include <QTimer>
 #include <QDebug>
 
+namespace {
+// A snapshot is taken when the journal grows past this many entries...
+const int JournalEntriesPerSnapshot = 2000;
+// ...or after this many auto-saves that only appended to it
+const int AutoSavesPerSnapshot = 10;
+}
+
 Note::Note(QObject *parent)
     : QObject(parent)
-    , m_storage(std::make_unique<Storage>(this))
+    , m_storage(std::make_unique<AsyncStorage>())
     , m_autoSaveTimer(new QTimer(this))
     , m_autoSaveEnabled(false)
     , m_autoSaveInterval(30) // 30 seconds default
     , m_modified(false)
+    , m_journal(new JournalRecorder(this))
+    , m_journalEntries(0)
+    , m_autoSavesSinceSnapshot(0)
+    , m_wikiLinks(new WikiLinkTracker(this))
 {
     setupAutoSave();
 }
@@ -39,10 +51,16 @@ void Note::setCurrentDocument(std::shared_ptr<Document> document)
     // Connect new document signals
     if (m_currentDocument) {
         connectDocumentSignals(m_currentDocument);
+        m_journal->attach(m_currentDocument);
+        m_wikiLinks->attach(m_currentDocument);
         m_modified = m_currentDocument->isModified();
     } else {
+        m_journal->detach();
+        m_wikiLinks->detach();
         m_modified = false;
     }
+    m_journalEntries = 0;
+    m_autoSavesSinceSnapshot = 0;
     
     emit currentDocumentChanged(m_currentDocument);
     emit modifiedChanged(m_modified);
@@ -52,6 +70,9 @@ std::shared_ptr<Document> Note::createNewDocument(const QString &title)
 {
     auto document = std::make_shared<Document>(title.isEmpty() ? "Untitled Document" : title);
     setCurrentDocument(document);
+    
+    // Journal entries need the document's rows to replay onto
+    m_journal->requestSnapshot();
     return document;
 }
 
@@ -62,14 +83,22 @@ bool Note::loadDocument(const QString &documentId)
         return false;
     }
     
-    auto document = m_storage->loadDocument(documentId);
-    if (!document) {
-        emit storageError("Failed to load document");
-        return false;
-    }
-    
-    setCurrentDocument(document);
-    emit documentLoaded(documentId);
+    // Only the current page is built now; the rest load when first shown.
+    // The document becomes current once the worker has read it.
+    auto *watcher = new QFutureWatcher<std::shared_ptr<Document>>(this);
+    connect(watcher, &QFutureWatcher<std::shared_ptr<Document>>::finished, this, [this, watcher, documentId]() {
+        auto document = watcher->result();
+        watcher->deleteLater();
+        
+        if (!document) {
+            emit storageError("Failed to load document");
+            return;
+        }
+        
+        setCurrentDocument(document);
+        emit documentLoaded(documentId);
+    });
+    watcher->setFuture(m_storage->loadDocument(documentId, Storage::LoadLazy));
     return true;
 }
 
@@ -79,15 +108,14 @@ bool Note::saveCurrentDocument()
         return false;
     }
     
-    bool success = m_storage->saveDocument(m_currentDocument);
-    if (success) {
-        m_currentDocument->setModified(false);
-        m_modified = false;
-        emit documentSaved(m_currentDocument->id());
-        emit modifiedChanged(false);
-    }
-    
-    return success;
+    // The write happens on the storage thread; documentSaved or storageError
+    // follows when it completes, and a failed save marks the document modified again.
+    // The snapshot covers everything journaled so far.
+    m_journal->clear();
+    m_journalEntries = 0;
+    m_autoSavesSinceSnapshot = 0;
+    m_storage->saveDocument(m_currentDocument);
+    return true;
 }
 
 bool Note::saveDocumentAs(const QString &title)
@@ -109,6 +137,8 @@ void Note::closeCurrentDocument()
         }
         
         disconnectDocumentSignals(m_currentDocument);
+        m_journal->detach();
+        m_wikiLinks->detach();
         m_currentDocument.reset();
         m_modified = false;
         
@@ -117,21 +147,19 @@ void Note::closeCurrentDocument()
     }
 }
 
-QStringList Note::listDocuments()
+QFuture<QStringList> Note::listDocuments()
 {
-    if (!m_storage || !m_storage->isOpen()) {
-        return QStringList();
-    }
-    
+    // A closed storage yields empty results
     return m_storage->listDocuments();
 }
 
-bool Note::deleteDocument(const QString &documentId)
+QFuture<AsyncStorage::CatalogPage> Note::documentCatalog(int limit, const Storage::CatalogCursor &after)
+{
+    return m_storage->documentCatalog(limit, after);
+}
+
+QFuture<bool> Note::deleteDocument(const QString &documentId)
 {
-    if (!m_storage || !m_storage->isOpen()) {
-        return false;
-    }
-    
     // If we're deleting the current document, close it first
     if (m_currentDocument && m_currentDocument->id() == documentId) {
         closeCurrentDocument();
@@ -146,22 +174,31 @@ bool Note::duplicateDocument(const QString &documentId)
         return false;
     }
     
-    auto originalDocument = m_storage->loadDocument(documentId);
-    if (!originalDocument) {
-        return false;
-    }
-    
-    auto clonedDocument = originalDocument->clone();
-    clonedDocument->setTitle(originalDocument->title() + " (Copy)");
-    
-    setCurrentDocument(std::shared_ptr<Document>(clonedDocument.release()));
-    return saveCurrentDocument();
+    // The copy becomes current, and is saved, once the original has been read
+    auto *watcher = new QFutureWatcher<std::shared_ptr<Document>>(this);
+    connect(watcher, &QFutureWatcher<std::shared_ptr<Document>>::finished, this, [this, watcher]() {
+        auto originalDocument = watcher->result();
+        watcher->deleteLater();
+        
+        if (!originalDocument) {
+            emit storageError("Failed to load document");
+            return;
+        }
+        
+        auto clonedDocument = originalDocument->clone();
+        clonedDocument->setTitle(originalDocument->title() + " (Copy)");
+        
+        setCurrentDocument(std::shared_ptr<Document>(clonedDocument.release()));
+        saveCurrentDocument();
+    });
+    watcher->setFuture(m_storage->loadDocument(documentId, Storage::LoadFull));
+    return true;
 }
 
 bool Note::initializeStorage(const QString &databasePath)
 {
     if (!m_storage) {
-        m_storage = std::make_unique<Storage>(this);
+        m_storage = std::make_unique<AsyncStorage>();
     }
     
     bool success = m_storage->initialize(databasePath);
@@ -206,55 +243,70 @@ void Note::setAutoSaveInterval(int seconds)
 
 void Note::triggerAutoSave()
 {
-    if (m_modified && m_currentDocument) {
+    if (!m_modified || !m_currentDocument || !m_storage || !m_storage->isOpen()) {
+        return;
+    }
+    
+    if (m_journal->needsSnapshot() || m_journalEntries >= JournalEntriesPerSnapshot ||
+        ++m_autoSavesSinceSnapshot >= AutoSavesPerSnapshot) {
         saveCurrentDocument();
-        emit autoSaveTriggered();
+    } else if (m_journal->hasEntries()) {
+        QVector<JournalEntry> entries = m_journal->takeEntries();
+        m_journalEntries += entries.size();
+        m_storage->appendJournal(m_currentDocument->id(), entries);
     }
+    
+    emit autoSaveTriggered();
 }
 
-QStringList Note::searchDocuments(const QString &query)
+QFuture<QStringList> Note::searchDocuments(const QString &query)
 {
-    if (!m_storage || !m_storage->isOpen()) {
-        return QStringList();
-    }
-    
     return m_storage->searchDocuments(query);
 }
 
-QStringList Note::findDocumentsByTag(const QString &tag)
+QFuture<QVector<Storage::SearchHit>> Note::searchContent(const QString &query, int limit)
 {
-    if (!m_storage || !m_storage->isOpen()) {
-        return QStringList();
-    }
-    
-    return m_storage->findDocumentsByTag(tag);
+    return m_storage->searchContent(query, limit);
 }
 
-QVector<QJsonObject> Note::getRecentDocuments(int limit)
+QFuture<QStringList> Note::findDocumentsByTag(const QString &tag)
+{
+    return m_storage->findDocumentsByTags(QStringList{tag});
+}
+
+QFuture<QStringList> Note::findDocumentsByTags(const QStringList &tags, Storage::TagMatch match)
+{
+    return m_storage->findDocumentsByTags(tags, match);
+}
+
+QFuture<QMap<QString, int>> Note::tagCounts()
+{
+    return m_storage->tagCounts();
+}
+
+QFuture<QVector<Storage::Backlink>> Note::backlinks(const QString &pageId)
+{
+    return m_storage->backlinks(pageId);
+}
+
+QFuture<QVector<QJsonObject>> Note::getRecentDocuments(int limit)
 {
-    if (!m_storage || !m_storage->isOpen()) {
-        return QVector<QJsonObject>();
-    }
-    
     return m_storage->getRecentDocuments(limit);
 }
 
-bool Note::createBackup(const QString &backupPath)
+QFuture<bool> Note::createBackup(const QString &backupPath)
 {
-    if (!m_storage || !m_storage->isOpen()) {
-        return false;
-    }
-    
     return m_storage->createBackup(backupPath);
 }
 
-bool Note::restoreFromBackup(const QString &backupPath)
+QFuture<bool> Note::createIncrementalBackup(const QString &backupPath)
 {
-    if (!m_storage) {
-        return false;
-    }
-    
-    // Close current document
+    return m_storage->createIncrementalBackup(backupPath);
+}
+
+QFuture<bool> Note::restoreFromBackup(const QString &backupPath)
+{
+    // Close current document; its final save is queued ahead of the restore
     closeCurrentDocument();
     
     return m_storage->restoreFromBackup(backupPath);
@@ -286,7 +338,9 @@ void Note::setupAutoSave()
     connect(m_autoSaveTimer, &QTimer::timeout, this, &Note::onAutoSaveTimeout);
     
     if (m_storage) {
-        connect(m_storage.get(), &Storage::databaseError, this, &Note::onStorageError);
+        connect(m_storage.get(), &AsyncStorage::databaseError, this, &Note::onStorageError);
+        connect(m_storage.get(), &AsyncStorage::documentSaved, this, &Note::documentSaved);
+        connect(m_storage.get(), &AsyncStorage::backupProgress, this, &Note::backupProgress);
     }
 }
 
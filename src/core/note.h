@@ -2,7 +2,9 @@
 #define NOTE_H
 
 #include "document.h"
-#include "storage.h"
+#include "asyncstorage.h"
+#include "journal.h"
+#include "wikilinks.h"
 #include <QObject>
 #include <QString>
 #include <QTimer>
@@ -32,31 +34,45 @@ public:
     bool saveDocumentAs(const QString &title);
     void closeCurrentDocument();
     
-    // Document operations
-    QStringList listDocuments();
-    bool deleteDocument(const QString &documentId);
+    // Document operations. Storage work runs on its own thread, so results
+    // arrive through the returned futures; nothing here waits for it.
+    QFuture<QStringList> listDocuments();
+    QFuture<AsyncStorage::CatalogPage> documentCatalog(int limit,
+                                                       const Storage::CatalogCursor &after = Storage::CatalogCursor());
+    QFuture<bool> deleteDocument(const QString &documentId);
     bool duplicateDocument(const QString &documentId);
     
     // Storage management
     bool initializeStorage(const QString &databasePath = QString());
     void closeStorage();
     bool isStorageOpen() const;
+    AsyncStorage *storage() const { return m_storage.get(); }
     
-    // Auto-save functionality
+    // Auto-save functionality. Object edits are appended to the journal;
+    // structural changes, and every few rounds the whole document, are saved
+    // as a snapshot.
     void enableAutoSave(bool enable = true);
     void setAutoSaveInterval(int seconds);
     void triggerAutoSave();
     
     // Search functionality
-    QStringList searchDocuments(const QString &query);
-    QStringList findDocumentsByTag(const QString &tag);
+    QFuture<QStringList> searchDocuments(const QString &query);
+    QFuture<QVector<Storage::SearchHit>> searchContent(const QString &query, int limit = 50);
+    QFuture<QStringList> findDocumentsByTag(const QString &tag);
+    QFuture<QStringList> findDocumentsByTags(const QStringList &tags, Storage::TagMatch match = Storage::MatchAll);
+    QFuture<QMap<QString, int>> tagCounts();
+    
+    // Stored links to a page from any document
+    QFuture<QVector<Storage::Backlink>> backlinks(const QString &pageId);
     
     // Recent documents
-    QVector<QJsonObject> getRecentDocuments(int limit = 10);
+    QFuture<QVector<QJsonObject>> getRecentDocuments(int limit = 10);
     
-    // Backup and restore
-    bool createBackup(const QString &backupPath);
-    bool restoreFromBackup(const QString &backupPath);
+    // Backup and restore run on the storage thread: backupProgress reports
+    // the pages copied so far and the futures finish with the outcome
+    QFuture<bool> createBackup(const QString &backupPath);
+    QFuture<bool> createIncrementalBackup(const QString &backupPath);
+    QFuture<bool> restoreFromBackup(const QString &backupPath);
     
     // Application state
     bool isModified() const;
@@ -71,14 +87,19 @@ signals:
     void modifiedChanged(bool modified);
     void autoSaveTriggered();
     void storageError(const QString &error);
+    void backupProgress(qint64 done, qint64 total);
 
 private:
     std::shared_ptr<Document> m_currentDocument;
-    std::unique_ptr<Storage> m_storage;
+    std::unique_ptr<AsyncStorage> m_storage;
     QTimer *m_autoSaveTimer;
     bool m_autoSaveEnabled;
     int m_autoSaveInterval;
     bool m_modified;
+    JournalRecorder *m_journal;
+    int m_journalEntries;           // appended since the last snapshot
+    int m_autoSavesSinceSnapshot;
+    WikiLinkTracker *m_wikiLinks;
     
     void setupAutoSave();
     void connectDocumentSignals(std::shared_ptr<Document> document);
@@ -9,6 +9,7 @@ Object::Object(QObject *parent)
     , m_selected(false)
     , m_layer(0)
     , m_visible(true)
+    , m_dirty(true)
 {
     generateId();
 }
@@ -19,6 +20,7 @@ void Object::setBounds(const QRect &bounds)
         m_bounds = bounds;
         boundsChangedInternal();
         emit boundsChanged(m_bounds);
+        markChanged();
     }
 }
 
@@ -55,6 +57,7 @@ void Object::setLayer(int layer)
     if (m_layer != layer) {
         m_layer = layer;
         emit layerChanged(m_layer);
+        markChanged();
     }
 }
 
@@ -63,6 +66,7 @@ void Object::setVisible(bool visible)
     if (m_visible != visible) {
         m_visible = visible;
         emit visibilityChanged(m_visible);
+        markChanged();
     }
 }
 
@@ -125,6 +129,18 @@ void Object::fromJson(const QJsonObject &json)
     m_visible = json["visible"].toBool();
 }
 
+void Object::writeBinary(QDataStream &out) const
+{
+    out << m_id << m_bounds << static_cast<qint32>(m_layer) << m_visible;
+}
+
+void Object::readBinary(QDataStream &in)
+{
+    qint32 layer = 0;
+    in >> m_id >> m_bounds >> layer >> m_visible;
+    m_layer = layer;
+}
+
 void Object::moveBy(const QPoint &delta)
 {
     setBounds(m_bounds.translated(delta));
@@ -155,6 +171,13 @@ void Object::generateId()
     m_id = QUuid::createUuid().toString(QUuid::WithoutBraces);
 }
 
+void Object::markChanged()
+{
+    // Any change to persisted state makes the object dirty until the next save
+    m_dirty = true;
+    emit changed();
+}
+
 void Object::boundsChangedInternal()
 {
     // Override in derived classes if needed
@@ -7,6 +7,7 @@
 #include <QPainter>
 #include <QJsonObject>
 #include <QJsonDocument>
+#include <QDataStream>
 #include <memory>
 
 /**
@@ -34,6 +35,7 @@ public:
     // Core properties
     virtual Type type() const = 0;
     virtual QString typeName() const = 0;
+    QString id() const { return m_id; }
     
     // Geometry
     QRect bounds() const { return m_bounds; }
@@ -57,6 +59,10 @@ public:
     bool isVisible() const { return m_visible; }
     void setVisible(bool visible);
     
+    // Persistence state
+    bool isDirty() const { return m_dirty; }
+    void setDirty(bool dirty) { m_dirty = dirty; }
+    
     // Rendering
     virtual void paint(QPainter &painter, const QRect &viewport) = 0;
     virtual void paintSelection(QPainter &painter);
@@ -64,6 +70,8 @@ public:
     // Serialization
     virtual QJsonObject toJson() const;
     virtual void fromJson(const QJsonObject &json);
+    virtual void writeBinary(QDataStream &out) const;
+    virtual void readBinary(QDataStream &in);
     
     // Operations
     virtual void moveBy(const QPoint &delta);
@@ -79,6 +87,7 @@ signals:
     void selectionChanged(bool selected);
     void layerChanged(int newLayer);
     void visibilityChanged(bool visible);
+    void changed();
 
 protected:
     QRect m_bounds;
@@ -86,8 +95,10 @@ protected:
     int m_layer;
     bool m_visible;
     QString m_id;
+    bool m_dirty;
     
     void generateId();
+    void markChanged();
     virtual void boundsChangedInternal();
 };
 
@@ -8,12 +8,30 @@
 #include <QPainter>
 #include <QApplication>
 #include <algorithm>
+#include <limits>
+
+namespace {
+
+// Distance between layers assigned when objects are reordered
+const int LayerGap = 1024;
+
+// Selection outlines and resize handles are drawn up to this far outside an object
+const int DamageMargin = 8;
+
+} // namespace
 
 Page::Page(QObject *parent)
     : QObject(parent)
     , m_title("Untitled Page")
     , m_size(800, 600)
     , m_backgroundColor(Qt::white)
+    , m_dirty(true)
+    , m_loaded(true)
+    , m_rewriteObjects(false)
+    , m_nextSequence(0)
+    , m_objectsValid(true)
+    , m_updateDepth(0)
+    , m_changedPending(false)
 {
     generateId();
 }
@@ -23,6 +41,13 @@ Page::Page(const QString &title, QObject *parent)
     , m_title(title)
     , m_size(800, 600)
     , m_backgroundColor(Qt::white)
+    , m_dirty(true)
+    , m_loaded(true)
+    , m_rewriteObjects(false)
+    , m_nextSequence(0)
+    , m_objectsValid(true)
+    , m_updateDepth(0)
+    , m_changedPending(false)
 {
     generateId();
 }
@@ -30,15 +55,19 @@ Page::Page(const QString &title, QObject *parent)
 Page::~Page()
 {
     // Disconnect all object signals
-    for (auto &object : m_objects) {
-        disconnectObjectSignals(object);
+    for (auto &entry : m_stack) {
+        disconnectObjectSignals(entry.second);
     }
 }
 
 void Page::setTitle(const QString &title)
 {
+    // Editing a stub that could not be loaded would overwrite the stored page
+    if (!ensureLoaded()) return;
+    
     if (m_title != title) {
         m_title = title;
+        markDirty();
         emit titleChanged(m_title);
     }
 }
@@ -50,89 +79,267 @@ void Page::setId(const QString &id)
 
 void Page::setSize(const QSize &size)
 {
+    if (!ensureLoaded()) return;
+    
     if (m_size != size) {
+        damage(QRect(QPoint(0, 0), m_size.expandedTo(size)));
         m_size = size;
+        markDirty();
         emit sizeChanged(m_size);
     }
 }
 
 void Page::setBackgroundColor(const QColor &color)
 {
+    if (!ensureLoaded()) return;
+    
     if (m_backgroundColor != color) {
         m_backgroundColor = color;
+        damagePage();
+        markDirty();
         emit backgroundColorChanged(m_backgroundColor);
     }
 }
 
 void Page::addObject(std::shared_ptr<Object> object)
 {
-    if (!object) return;
+    if (!object || m_stackKeys.contains(object.get())) return;
     
-    m_objects.append(object);
-    connectObjectSignals(object);
-    sortObjectsByLayer();
+    if (!ensureLoaded()) return;
+    UpdateScope scope(this);
+    insertObject(object);
+    m_pendingChanges.added.append(object);
+    markDirty();
     emit objectAdded(object);
 }
 
+void Page::addObjects(const QVector<std::shared_ptr<Object>> &objects)
+{
+    if (!ensureLoaded()) return;
+    
+    QVector<std::shared_ptr<Object>> added;
+    added.reserve(objects.size());
+    for (const auto &object : objects) {
+        if (object && !m_stackKeys.contains(object.get())) {
+            added.append(object);
+        }
+    }
+    if (added.isEmpty()) return;
+    
+    UpdateScope scope(this);
+    
+    // One sort for the whole batch, so most inserts land at the top of the stack
+    std::stable_sort(added.begin(), added.end(),
+        [](const std::shared_ptr<Object> &a, const std::shared_ptr<Object> &b) {
+            return a->layer() < b->layer();
+        });
+    for (const auto &object : added) {
+        if (!m_stackKeys.contains(object.get())) {
+            insertObject(object);
+            m_pendingChanges.added.append(object);
+        }
+    }
+    
+    markDirty();
+    for (const auto &object : added) {
+        emit objectAdded(object);
+    }
+}
+
 void Page::removeObject(std::shared_ptr<Object> object)
 {
-    if (!object) return;
+    if (!object || !m_stackKeys.contains(object.get())) return;
     
-    int index = m_objects.indexOf(object);
-    if (index >= 0) {
-        disconnectObjectSignals(object);
-        m_objects.removeAt(index);
-        emit objectRemoved(object);
+    UpdateScope scope(this);
+    eraseObject(object);
+    m_removedObjectIds.append(object->id());
+    
+    // An object added and removed within one batch never shows up in it
+    if (!m_pendingChanges.added.removeOne(object)) {
+        m_pendingChanges.removed.append(object);
     }
+    if (object->isSelected()) {
+        m_pendingChanges.selectionChanged = true;
+    }
+    markDirty();
+    emit objectRemoved(object);
 }
 
 void Page::removeObject(int index)
 {
-    if (index >= 0 && index < m_objects.size()) {
-        auto object = m_objects[index];
-        disconnectObjectSignals(object);
-        m_objects.removeAt(index);
-        emit objectRemoved(object);
+    if (index >= 0 && index < objects().size()) {
+        auto object = objects()[index];
+        removeObject(object);
     }
 }
 
 void Page::clearObjects()
 {
-    for (auto &object : m_objects) {
+    if (!ensureLoaded()) return;
+    
+    UpdateScope scope(this);
+    QVector<std::shared_ptr<Object>> removed = objects();
+    m_stack.clear();
+    m_stackKeys.clear();
+    m_spatialIndex.clear();
+    m_objects.clear();
+    m_objectsValid = true;
+    
+    for (auto &object : removed) {
         disconnectObjectSignals(object);
+        damage(object->bounds());
+        m_removedObjectIds.append(object->id());
+        if (!m_pendingChanges.added.removeOne(object)) {
+            m_pendingChanges.removed.append(object);
+        }
+    }
+    m_pendingChanges.selectionChanged = true;
+    markDirty();
+    
+    for (auto &object : removed) {
+        emit objectRemoved(object);
+    }
+}
+
+void Page::beginUpdate()
+{
+    ++m_updateDepth;
+}
+
+void Page::endUpdate()
+{
+    if (m_updateDepth == 0 || --m_updateDepth > 0) return;
+    
+    flushChanges();
+}
+
+void Page::markDirty()
+{
+    m_dirty = true;
+    if (m_updateDepth > 0) {
+        m_changedPending = true;
+    } else {
+        emit changed();
     }
+}
+
+void Page::markAllDirty()
+{
+    // Used when the stored objects can no longer be trusted to match, for
+    // example after a failed save
+    m_rewriteObjects = true;
+    markDirty();
+}
+
+void Page::markClean()
+{
+    m_dirty = false;
+    m_rewriteObjects = false;
+    m_removedObjectIds.clear();
+    for (const auto &entry : m_stack) {
+        entry.second->setDirty(false);
+    }
+}
+
+bool Page::ensureLoaded()
+{
+    // The owning document resolves the request through its page loader
+    if (!m_loaded) {
+        emit loadRequested();
+    }
+    return m_loaded;
+}
+
+void Page::requestLoad()
+{
+    if (!m_loaded) {
+        emit prefetchRequested();
+    }
+}
+
+void Page::announceLoaded()
+{
+    // Listeners missed the additions, so the whole content is reported as added
+    UpdateScope scope(this);
+    m_pendingChanges.added = objects();
+    damagePage();
+    for (const auto &object : m_pendingChanges.added) {
+        damage(object->bounds());
+    }
+}
+
+void Page::unload()
+{
+    if (!m_loaded) return;
+    
+    for (auto &entry : m_stack) {
+        disconnectObjectSignals(entry.second);
+    }
+    m_stack.clear();
+    m_stackKeys.clear();
+    m_spatialIndex.clear();
     m_objects.clear();
-    emit objectSelectionChanged();
+    m_objectsValid = true;
+    m_removedObjectIds.clear();
+    m_loaded = false;
+    m_dirty = false;
+}
+
+const QVector<std::shared_ptr<Object>> &Page::objects() const
+{
+    if (!m_objectsValid) {
+        m_objects.clear();
+        m_objects.reserve(static_cast<int>(m_stack.size()));
+        for (const auto &entry : m_stack) {
+            m_objects.append(entry.second);
+        }
+        m_objectsValid = true;
+    }
+    return m_objects;
 }
 
 std::shared_ptr<Object> Page::objectAt(const QPoint &point) const
 {
-    // Search from top to bottom (reverse order due to layer sorting)
-    for (int i = m_objects.size() - 1; i >= 0; --i) {
-        if (m_objects[i]->isVisible() && m_objects[i]->contains(point)) {
-            return m_objects[i];
+    // Of the objects under the point, the topmost has the highest stacking key
+    const Object *top = nullptr;
+    StackKey topKey;
+    for (Object *candidate : m_spatialIndex.query(point)) {
+        if (candidate->isVisible() && candidate->contains(point)) {
+            const StackKey key = m_stackKeys.value(candidate);
+            if (!top || topKey < key) {
+                top = candidate;
+                topKey = key;
+            }
         }
     }
-    return nullptr;
+    return top ? m_stack.find(topKey)->second : nullptr;
 }
 
 QVector<std::shared_ptr<Object>> Page::objectsInRect(const QRect &rect) const
 {
-    QVector<std::shared_ptr<Object>> result;
-    for (const auto &object : m_objects) {
-        if (object->isVisible() && object->intersects(rect)) {
-            result.append(object);
+    // Visible objects intersecting the rectangle, bottom to top
+    QVector<StackKey> keys;
+    for (Object *candidate : m_spatialIndex.query(rect)) {
+        if (candidate->isVisible() && candidate->intersects(rect)) {
+            keys.append(m_stackKeys.value(candidate));
         }
     }
+    std::sort(keys.begin(), keys.end());
+    
+    QVector<std::shared_ptr<Object>> result;
+    result.reserve(keys.size());
+    for (const StackKey &key : keys) {
+        result.append(m_stack.find(key)->second);
+    }
     return result;
 }
 
 QVector<std::shared_ptr<Object>> Page::selectedObjects() const
 {
     QVector<std::shared_ptr<Object>> result;
-    for (const auto &object : m_objects) {
-        if (object->isSelected()) {
-            result.append(object);
+    for (const auto &entry : m_stack) {
+        if (entry.second->isSelected()) {
+            result.append(entry.second);
         }
     }
     return result;
@@ -154,23 +361,24 @@ void Page::deselectObject(std::shared_ptr<Object> object)
 
 void Page::selectObjectsInRect(const QRect &rect)
 {
-    for (const auto &object : m_objects) {
-        if (object->isVisible() && object->intersects(rect)) {
-            object->setSelected(true);
-        }
+    UpdateScope scope(this);
+    for (const auto &object : objectsInRect(rect)) {
+        object->setSelected(true);
     }
 }
 
 void Page::clearSelection()
 {
-    for (const auto &object : m_objects) {
+    UpdateScope scope(this);
+    for (const auto &object : objects()) {
         object->setSelected(false);
     }
 }
 
 void Page::selectAll()
 {
-    for (const auto &object : m_objects) {
+    UpdateScope scope(this);
+    for (const auto &object : objects()) {
         if (object->isVisible()) {
             object->setSelected(true);
         }
@@ -179,7 +387,8 @@ void Page::selectAll()
 
 void Page::moveSelectedObjects(const QPoint &delta)
 {
-    for (const auto &object : m_objects) {
+    UpdateScope scope(this);
+    for (const auto &object : objects()) {
         if (object->isSelected()) {
             object->moveBy(delta);
         }
@@ -188,26 +397,19 @@ void Page::moveSelectedObjects(const QPoint &delta)
 
 void Page::deleteSelectedObjects()
 {
-    // Remove selected objects (iterate backwards to avoid index issues)
-    for (int i = m_objects.size() - 1; i >= 0; --i) {
-        if (m_objects[i]->isSelected()) {
-            removeObject(i);
-        }
+    UpdateScope scope(this);
+    // Topmost first, as before
+    const QVector<std::shared_ptr<Object>> selected = selectedObjects();
+    for (int i = selected.size() - 1; i >= 0; --i) {
+        removeObject(selected[i]);
     }
 }
 
 void Page::duplicateSelectedObjects()
 {
-    QVector<std::shared_ptr<Object>> objectsToDuplicate;
-    
-    // Collect selected objects
-    for (const auto &object : m_objects) {
-        if (object->isSelected()) {
-            objectsToDuplicate.append(object);
-        }
-    }
-    
+    UpdateScope scope(this);
     // Clear selection and add duplicates
+    const QVector<std::shared_ptr<Object>> objectsToDuplicate = selectedObjects();
     clearSelection();
     for (const auto &object : objectsToDuplicate) {
         auto clone = object->clone();
@@ -219,45 +421,63 @@ void Page::duplicateSelectedObjects()
 
 void Page::bringToFront(std::shared_ptr<Object> object)
 {
-    if (!object) return;
+    if (!object || !m_stackKeys.contains(object.get())) return;
     
-    int index = m_objects.indexOf(object);
-    if (index >= 0) {
-        m_objects.move(index, m_objects.size() - 1);
-        object->setLayer(m_objects.size() - 1);
+    if (m_stack.rbegin()->second == object) return;
+    if (m_stack.rbegin()->first.first > std::numeric_limits<int>::max() - LayerGap) {
+        renumberLayers();
     }
+    object->setLayer(m_stack.rbegin()->first.first + LayerGap);
 }
 
 void Page::sendToBack(std::shared_ptr<Object> object)
 {
-    if (!object) return;
+    if (!object || !m_stackKeys.contains(object.get())) return;
     
-    int index = m_objects.indexOf(object);
-    if (index >= 0) {
-        m_objects.move(index, 0);
-        object->setLayer(0);
+    if (m_stack.begin()->second == object) return;
+    if (m_stack.begin()->first.first < std::numeric_limits<int>::min() + LayerGap) {
+        renumberLayers();
     }
+    object->setLayer(m_stack.begin()->first.first - LayerGap);
 }
 
 void Page::bringForward(std::shared_ptr<Object> object)
 {
-    if (!object) return;
+    if (!object || !m_stackKeys.contains(object.get())) return;
     
-    int index = m_objects.indexOf(object);
-    if (index >= 0 && index < m_objects.size() - 1) {
-        m_objects.move(index, index + 1);
-        object->setLayer(index + 1);
+    // Move between the object above and the one above that; layers are
+    // spread out again only when there is no room between them
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        auto next = std::next(m_stack.find(m_stackKeys.value(object.get())));
+        if (next == m_stack.end()) return;
+        
+        auto after = std::next(next);
+        const qint64 lower = next->first.first;
+        const qint64 upper = after != m_stack.end() ? after->first.first : lower + 2 * LayerGap;
+        if (upper - lower >= 2 && upper <= std::numeric_limits<int>::max()) {
+            object->setLayer(static_cast<int>(lower + (upper - lower) / 2));
+            return;
+        }
+        renumberLayers();
     }
 }
 
 void Page::sendBackward(std::shared_ptr<Object> object)
 {
-    if (!object) return;
+    if (!object || !m_stackKeys.contains(object.get())) return;
     
-    int index = m_objects.indexOf(object);
-    if (index > 0) {
-        m_objects.move(index, index - 1);
-        object->setLayer(index - 1);
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        auto position = m_stack.find(m_stackKeys.value(object.get()));
+        if (position == m_stack.begin()) return;
+        
+        auto previous = std::prev(position);
+        const qint64 upper = previous->first.first;
+        const qint64 lower = previous != m_stack.begin() ? std::prev(previous)->first.first : upper - 2 * LayerGap;
+        if (upper - lower >= 2 && lower >= std::numeric_limits<int>::min()) {
+            object->setLayer(static_cast<int>(lower + (upper - lower) / 2));
+            return;
+        }
+        renumberLayers();
     }
 }
 
@@ -265,8 +485,8 @@ void Page::setObjectLayer(std::shared_ptr<Object> object, int layer)
 {
     if (!object) return;
     
+    // The layer signal moves the object in the stack
     object->setLayer(layer);
-    sortObjectsByLayer();
 }
 
 void Page::reorderObjectsByLayer()
@@ -274,23 +494,36 @@ void Page::reorderObjectsByLayer()
     sortObjectsByLayer();
 }
 
-void Page::paint(QPainter &painter, const QRect &viewport)
+void Page::paint(QPainter &painter, const QRect &viewport, const QSet<const Object *> &excluded)
 {
     painter.save();
     
     // Draw background
-    painter.fillRect(QRect(QPoint(0, 0), m_size), m_backgroundColor);
+    painter.fillRect(QRect(QPoint(0, 0), m_size).intersected(viewport), m_backgroundColor);
     
-    // Draw all objects in layer order
-    for (const auto &object : m_objects) {
-        if (object->isVisible()) {
-            object->paint(painter, viewport);
+    // Draw the objects reaching into the viewport in layer order; the margin
+    // picks up selection handles of objects just outside it
+    QVector<StackKey> keys;
+    const QRect area = viewport.adjusted(-DamageMargin, -DamageMargin, DamageMargin, DamageMargin);
+    for (Object *candidate : m_spatialIndex.query(area)) {
+        if (candidate->isVisible() && !excluded.contains(candidate)) {
+            keys.append(m_stackKeys.value(candidate));
         }
     }
+    std::sort(keys.begin(), keys.end());
+    
+    for (const StackKey &key : keys) {
+        m_stack.find(key)->second->paint(painter, viewport);
+    }
     
     painter.restore();
 }
 
+QRect Page::paintedRect(const QRect &bounds)
+{
+    return bounds.normalized().adjusted(-DamageMargin, -DamageMargin, DamageMargin, DamageMargin);
+}
+
 QJsonObject Page::toJson() const
 {
     QJsonObject json;
@@ -303,7 +536,7 @@ QJsonObject Page::toJson() const
     json["backgroundColor"] = m_backgroundColor.name();
     
     QJsonArray objectsArray;
-    for (const auto &object : m_objects) {
+    for (const auto &object : objects()) {
         objectsArray.append(object->toJson());
     }
     json["objects"] = objectsArray;
@@ -313,6 +546,9 @@ QJsonObject Page::toJson() const
 
 void Page::fromJson(const QJsonObject &json)
 {
+    UpdateScope scope(this);
+    damagePage();
+    
     m_id = json["id"].toString();
     m_title = json["title"].toString();
     
@@ -320,35 +556,91 @@ void Page::fromJson(const QJsonObject &json)
     m_size = QSize(sizeObj["width"].toInt(), sizeObj["height"].toInt());
     
     m_backgroundColor = QColor(json["backgroundColor"].toString());
+    damagePage();
+    
+    // The page now holds its real content, even if it started as a stub
+    m_loaded = true;
     
     // Clear existing objects
     clearObjects();
     
     // Load objects
     QJsonArray objectsArray = json["objects"].toArray();
+    QVector<std::shared_ptr<Object>> objects;
+    objects.reserve(objectsArray.size());
     for (const QJsonValue &value : objectsArray) {
         QJsonObject objJson = value.toObject();
         Object::Type type = static_cast<Object::Type>(objJson["type"].toInt());
         
-        std::shared_ptr<Object> object;
-        switch (type) {
-        case Object::TextObject:
-            object = std::make_shared<TextObject>();
-            break;
-        case Object::DrawingObject:
-            object = std::make_shared<DrawingObject>();
-            break;
-        case Object::ImageObject:
-        case Object::PDFObject:
-            // TODO: Implement these object types
-            continue;
+        std::shared_ptr<Object> object = createObject(type);
+        if (object) {
+            object->fromJson(objJson);
+            objects.append(object);
         }
+    }
+    addObjects(objects);
+}
+
+void Page::writeBinary(QDataStream &out) const
+{
+    writeHeader(out);
+    
+    // Each object is tagged with its type and length-prefixed so readers can
+    // skip object types they do not know about
+    out << static_cast<qint32>(m_stack.size());
+    for (const auto &object : objects()) {
+        QByteArray payload;
+        QDataStream objectOut(&payload, QIODevice::WriteOnly);
+        objectOut.setVersion(out.version());
+        object->writeBinary(objectOut);
         
+        out << static_cast<quint8>(object->type()) << payload;
+    }
+}
+
+void Page::readBinary(QDataStream &in)
+{
+    UpdateScope scope(this);
+    
+    readHeader(in);
+    
+    qint32 objectCount = 0;
+    in >> objectCount;
+    QVector<std::shared_ptr<Object>> objects;
+    for (qint32 i = 0; i < objectCount && in.status() == QDataStream::Ok; ++i) {
+        quint8 type = 0;
+        QByteArray payload;
+        in >> type >> payload;
+        
+        std::shared_ptr<Object> object = createObject(static_cast<Object::Type>(type));
         if (object) {
-            object->fromJson(objJson);
-            addObject(object);
+            QDataStream objectIn(payload);
+            objectIn.setVersion(in.version());
+            object->readBinary(objectIn);
+            objects.append(object);
         }
     }
+    addObjects(objects);
+}
+
+void Page::writeHeader(QDataStream &out) const
+{
+    out << m_id << m_title << m_size << m_backgroundColor;
+}
+
+void Page::readHeader(QDataStream &in)
+{
+    UpdateScope scope(this);
+    damagePage();
+    
+    in >> m_id >> m_title >> m_size >> m_backgroundColor;
+    damagePage();
+    
+    // The page now holds its real content, even if it started as a stub
+    m_loaded = true;
+    
+    // Clear existing objects
+    clearObjects();
 }
 
 std::unique_ptr<Page> Page::clone() const
@@ -371,7 +663,7 @@ void Page::setState(const QJsonObject &state)
 QVector<std::shared_ptr<Object>> Page::findObjectsByType(Object::Type type) const
 {
     QVector<std::shared_ptr<Object>> result;
-    for (const auto &object : m_objects) {
+    for (const auto &object : objects()) {
         if (object->type() == type) {
             result.append(object);
         }
@@ -382,7 +674,7 @@ QVector<std::shared_ptr<Object>> Page::findObjectsByType(Object::Type type) cons
 QVector<std::shared_ptr<Object>> Page::findObjectsContaining(const QString &text) const
 {
     QVector<std::shared_ptr<Object>> result;
-    for (const auto &object : m_objects) {
+    for (const auto &object : objects()) {
         if (object->type() == Object::TextObject) {
             auto textObject = std::dynamic_pointer_cast<TextObject>(object);
             if (textObject && textObject->content().contains(text, Qt::CaseInsensitive)) {
@@ -393,6 +685,21 @@ QVector<std::shared_ptr<Object>> Page::findObjectsContaining(const QString &text
     return result;
 }
 
+std::shared_ptr<Object> Page::createObject(Object::Type type)
+{
+    switch (type) {
+    case Object::TextObject:
+        return std::make_shared<TextObject>();
+    case Object::DrawingObject:
+        return std::make_shared<DrawingObject>();
+    case Object::ImageObject:
+    case Object::PDFObject:
+        // TODO: Implement these object types
+        break;
+    }
+    return nullptr;
+}
+
 void Page::generateId()
 {
     m_id = QUuid::createUuid().toString(QUuid::WithoutBraces);
@@ -404,6 +711,7 @@ void Page::connectObjectSignals(std::shared_ptr<Object> object)
     connect(object.get(), &Object::selectionChanged, this, &Page::onObjectSelectionChanged);
     connect(object.get(), &Object::layerChanged, this, &Page::onObjectLayerChanged);
     connect(object.get(), &Object::visibilityChanged, this, &Page::onObjectVisibilityChanged);
+    connect(object.get(), &Object::changed, this, &Page::onObjectChanged);
 }
 
 void Page::disconnectObjectSignals(std::shared_ptr<Object> object)
@@ -412,36 +720,176 @@ void Page::disconnectObjectSignals(std::shared_ptr<Object> object)
     disconnect(object.get(), &Object::selectionChanged, this, &Page::onObjectSelectionChanged);
     disconnect(object.get(), &Object::layerChanged, this, &Page::onObjectLayerChanged);
     disconnect(object.get(), &Object::visibilityChanged, this, &Page::onObjectVisibilityChanged);
+    disconnect(object.get(), &Object::changed, this, &Page::onObjectChanged);
+}
+
+void Page::insertObject(std::shared_ptr<Object> object)
+{
+    // Later objects go above earlier ones on the same layer
+    const StackKey key(object->layer(), m_nextSequence++);
+    m_stack.emplace_hint(m_stack.end(), key, object);
+    m_stackKeys.insert(object.get(), key);
+    m_spatialIndex.insert(object.get(), object->bounds());
+    m_objectsValid = false;
+    connectObjectSignals(object);
+    damage(object->bounds());
+}
+
+void Page::eraseObject(std::shared_ptr<Object> object)
+{
+    disconnectObjectSignals(object);
+    m_stack.erase(m_stackKeys.take(object.get()));
+    m_spatialIndex.remove(object.get());
+    m_objectsValid = false;
+    damage(object->bounds());
+}
+
+void Page::restackObject(Object *object, int layer)
+{
+    auto key = m_stackKeys.find(object);
+    if (key == m_stackKeys.end() || key->first == layer) {
+        return;
+    }
+    
+    // An object moved to a layer goes above the objects already on it
+    auto entry = m_stack.find(*key);
+    std::shared_ptr<Object> shared = entry->second;
+    m_stack.erase(entry);
+    
+    *key = StackKey(layer, m_nextSequence++);
+    m_stack.emplace(*key, shared);
+    m_objectsValid = false;
 }
 
 void Page::sortObjectsByLayer()
 {
-    std::sort(m_objects.begin(), m_objects.end(), 
-        [](const std::shared_ptr<Object> &a, const std::shared_ptr<Object> &b) {
-            return a->layer() < b->layer();
-        });
+    // Picks up layers changed while the page was not listening
+    std::map<StackKey, std::shared_ptr<Object>> stack;
+    for (const auto &entry : m_stack) {
+        const StackKey key(entry.second->layer(), entry.first.second);
+        stack.emplace(key, entry.second);
+        m_stackKeys.insert(entry.second.get(), key);
+    }
+    m_stack.swap(stack);
+    m_objectsValid = false;
+}
+
+void Page::renumberLayers()
+{
+    // Spread the layers out evenly, in stacking order, to make room between neighbours
+    const qint64 count = static_cast<qint64>(m_stack.size());
+    const int spacing = static_cast<int>(qBound<qint64>(1, std::numeric_limits<int>::max() / 2 / (count + 1), LayerGap));
+    
+    std::map<StackKey, std::shared_ptr<Object>> stack;
+    QVector<std::shared_ptr<Object>> changed;
+    int layer = 0;
+    for (const auto &entry : m_stack) {
+        const StackKey key(layer, entry.first.second);
+        stack.emplace_hint(stack.end(), key, entry.second);
+        m_stackKeys.insert(entry.second.get(), key);
+        if (entry.second->layer() != layer) {
+            changed.append(entry.second);
+        }
+        layer += spacing;
+    }
+    m_stack.swap(stack);
+    
+    // The keys already match, so these layer changes leave the stack alone
+    UpdateScope scope(this);
+    for (const auto &object : changed) {
+        object->setLayer(m_stackKeys.value(object.get()).first);
+    }
 }
 
 void Page::onObjectBoundsChanged(const QRect &newBounds)
 {
-    // Handle object bounds changes if needed
-    Q_UNUSED(newBounds)
+    Object *object = qobject_cast<Object *>(sender());
+    if (object) {
+        // Both where the object was and where it is now need repainting
+        UpdateScope scope(this);
+        damage(m_spatialIndex.bounds(object));
+        m_spatialIndex.update(object, newBounds);
+        damage(newBounds);
+    }
+}
+
+void Page::damage(const QRect &bounds)
+{
+    if (bounds.isNull()) return;
+    
+    m_pendingDamage += paintedRect(bounds);
+    if (m_updateDepth == 0) {
+        flushChanges();
+    }
+}
+
+void Page::damagePage()
+{
+    damage(QRect(QPoint(0, 0), m_size));
+}
+
+void Page::flushChanges()
+{
+    // Taken first, so slots may start batches of their own
+    ChangeSet changes;
+    std::swap(changes, m_pendingChanges);
+    const bool changedPending = m_changedPending;
+    m_changedPending = false;
+    QRegion damage;
+    damage.swap(m_pendingDamage);
+    
+    if (changedPending) {
+        emit changed();
+    }
+    if (changes.selectionChanged) {
+        emit objectSelectionChanged();
+    }
+    if (!changes.isEmpty()) {
+        emit objectsChanged(changes);
+    }
+    if (!damage.isEmpty()) {
+        emit damaged(damage);
+    }
 }
 
 void Page::onObjectSelectionChanged(bool selected)
 {
     Q_UNUSED(selected)
-    emit objectSelectionChanged();
+    m_pendingChanges.selectionChanged = true;
+    
+    Object *object = qobject_cast<Object *>(sender());
+    if (object) {
+        m_pendingDamage += paintedRect(object->bounds());
+    }
+    if (m_updateDepth == 0) {
+        flushChanges();
+    }
 }
 
 void Page::onObjectLayerChanged(int newLayer)
 {
-    Q_UNUSED(newLayer)
-    sortObjectsByLayer();
+    Object *object = qobject_cast<Object *>(sender());
+    if (object) {
+        restackObject(object, newLayer);
+    }
 }
 
 void Page::onObjectVisibilityChanged(bool visible)
 {
     Q_UNUSED(visible)
-    emit objectSelectionChanged();
+    m_pendingChanges.selectionChanged = true;
+    if (m_updateDepth == 0) {
+        flushChanges();
+    }
+}
+
+void Page::onObjectChanged()
+{
+    // Content, layer and visibility changes repaint the object where it is
+    Object *object = qobject_cast<Object *>(sender());
+    UpdateScope scope(this);
+    if (object) {
+        damage(object->bounds());
+    }
+    markDirty();
 }
@@ -2,14 +2,21 @@
 #define PAGE_H
 
 #include "object.h"
+#include "spatialindex.h"
 #include <QObject>
 #include <QString>
+#include <QStringList>
 #include <QVector>
+#include <QHash>
+#include <QSet>
 #include <QJsonObject>
 #include <QJsonDocument>
 #include <QSize>
 #include <QColor>
+#include <QRegion>
+#include <map>
 #include <memory>
+#include <utility>
 
 /**
  * @brief A page that contains multiple objects and manages their layout
@@ -23,6 +30,33 @@ class Page : public QObject
     Q_OBJECT
 
 public:
+    /**
+     * @brief What changed on a page since the last objectsChanged() signal
+     */
+    struct ChangeSet {
+        QVector<std::shared_ptr<Object>> added;
+        QVector<std::shared_ptr<Object>> removed;
+        bool selectionChanged = false;
+        
+        bool isEmpty() const { return added.isEmpty() && removed.isEmpty() && !selectionChanged; }
+    };
+    
+    /**
+     * @brief Batches the changes made to a page for as long as it lives
+     */
+    class UpdateScope
+    {
+    public:
+        explicit UpdateScope(Page *page) : m_page(page) { m_page->beginUpdate(); }
+        ~UpdateScope() { m_page->endUpdate(); }
+        
+        UpdateScope(const UpdateScope &) = delete;
+        UpdateScope &operator=(const UpdateScope &) = delete;
+        
+    private:
+        Page *m_page;
+    };
+    
     explicit Page(QObject *parent = nullptr);
     explicit Page(const QString &title, QObject *parent = nullptr);
     ~Page() override;
@@ -40,9 +74,37 @@ public:
     QColor backgroundColor() const { return m_backgroundColor; }
     void setBackgroundColor(const QColor &color);
     
-    // Object management
-    const QVector<std::shared_ptr<Object>> &objects() const { return m_objects; }
+    // Sort key within the document, kept by Document
+    QString position() const { return m_position; }
+    void setPosition(const QString &position) { m_position = position; }
+    
+    // Persistence state
+    bool isDirty() const { return m_dirty; }
+    void markDirty();
+    void markAllDirty();
+    void markClean();
+    QStringList removedObjectIds() const { return m_removedObjectIds; }
+    bool objectsNeedRewrite() const { return m_rewriteObjects; }
+    
+    // Lazy loading: an unloaded page is a stub holding only id, title and size
+    bool isLoaded() const { return m_loaded; }
+    void setLoaded(bool loaded) { m_loaded = loaded; }
+    bool ensureLoaded();        // false when the content could not be loaded
+    void requestLoad();         // like ensureLoaded(), but returns before the content is in
+    void announceLoaded();      // reports content filled in while signals were blocked
+    void unload();
+    
+    // Batched updates: objectSelectionChanged, changed, objectsChanged and
+    // damaged are held back until the outermost endUpdate() and then emitted
+    // at most once
+    void beginUpdate();
+    void endUpdate();
+    bool isUpdating() const { return m_updateDepth > 0; }
+    
+    // Object management; objects() is in stacking order, bottom to top
+    const QVector<std::shared_ptr<Object>> &objects() const;
     void addObject(std::shared_ptr<Object> object);
+    void addObjects(const QVector<std::shared_ptr<Object>> &objects);
     void removeObject(std::shared_ptr<Object> object);
     void removeObject(int index);
     void clearObjects();
@@ -72,12 +134,23 @@ public:
     void setObjectLayer(std::shared_ptr<Object> object, int layer);
     void reorderObjectsByLayer();
     
-    // Rendering
-    void paint(QPainter &painter, const QRect &viewport);
+    // Rendering; only objects that intersect the viewport are painted, less
+    // any the caller draws itself
+    void paint(QPainter &painter, const QRect &viewport,
+               const QSet<const Object *> &excluded = QSet<const Object *>());
+    
+    // How far an object's painting reaches beyond its bounds (selection handles)
+    static QRect paintedRect(const QRect &bounds);
     
     // Serialization
     QJsonObject toJson() const;
     void fromJson(const QJsonObject &json);
+    void writeBinary(QDataStream &out) const;
+    void readBinary(QDataStream &in);
+    
+    // Page attributes only; objects are stored separately
+    void writeHeader(QDataStream &out) const;
+    void readHeader(QDataStream &in);
     
     // Operations
     std::unique_ptr<Page> clone() const;
@@ -89,6 +162,9 @@ public:
     // Search and filtering
     QVector<std::shared_ptr<Object>> findObjectsByType(Object::Type type) const;
     QVector<std::shared_ptr<Object>> findObjectsContaining(const QString &text) const;
+    
+    // Object factory
+    static std::shared_ptr<Object> createObject(Object::Type type);
 
 signals:
     void titleChanged(const QString &newTitle);
@@ -98,24 +174,62 @@ signals:
     void objectRemoved(std::shared_ptr<Object> object);
     void objectSelectionChanged();
     void objectLayerChanged(std::shared_ptr<Object> object, int newLayer);
+    void changed();
+    
+    // One per batch, or per change made outside a batch
+    void objectsChanged(const Page::ChangeSet &changes);
+    
+    // Page-coordinate areas whose rendering is out of date
+    void damaged(const QRegion &region);
+    void loadRequested();
+    void prefetchRequested();
 
 private:
     QString m_title;
     QString m_id;
     QSize m_size;
     QColor m_backgroundColor;
-    QVector<std::shared_ptr<Object>> m_objects;
+    QString m_position;
+    bool m_dirty;
+    bool m_loaded;
+    QStringList m_removedObjectIds;   // objects removed since the last save
+    bool m_rewriteObjects;            // every object must be written again
+    
+    // Objects ordered by layer, then by when they joined it
+    using StackKey = std::pair<int, quint64>;
+    std::map<StackKey, std::shared_ptr<Object>> m_stack;
+    QHash<const Object *, StackKey> m_stackKeys;
+    quint64 m_nextSequence;
+    SpatialIndex m_spatialIndex;      // object bounds for hit-testing
+    
+    // m_stack as a vector, rebuilt when read after the stack changed
+    mutable QVector<std::shared_ptr<Object>> m_objects;
+    mutable bool m_objectsValid;
+    
+    // Notifications held back by beginUpdate()
+    int m_updateDepth;
+    ChangeSet m_pendingChanges;
+    bool m_changedPending;
+    QRegion m_pendingDamage;
     
     void generateId();
     void connectObjectSignals(std::shared_ptr<Object> object);
     void disconnectObjectSignals(std::shared_ptr<Object> object);
+    void insertObject(std::shared_ptr<Object> object);
+    void eraseObject(std::shared_ptr<Object> object);
+    void restackObject(Object *object, int layer);
     void sortObjectsByLayer();
+    void renumberLayers();
+    void damage(const QRect &bounds);
+    void damagePage();
+    void flushChanges();
 
 private slots:
     void onObjectBoundsChanged(const QRect &newBounds);
     void onObjectSelectionChanged(bool selected);
     void onObjectLayerChanged(int newLayer);
     void onObjectVisibilityChanged(bool visible);
+    void onObjectChanged();
 };
 
 #endif // PAGE_H
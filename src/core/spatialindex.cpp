@@ -0,0 +1,268 @@
+#include "spatialindex.h"
+
+namespace {
+
+const int NodeCapacity = 8;         // entries a cell holds before it splits
+const int MinCellSize = 16;
+const int InitialCellSize = 1024;   // covers a default page in one cell
+const int MaxCellSize = 1 << 29;    // keeps cell coordinates inside int
+
+int alignDown(int value, int size)
+{
+    return value >= 0 ? value / size * size : -((-value + size - 1) / size) * size;
+}
+
+} // namespace
+
+SpatialIndex::SpatialIndex()
+{
+}
+
+SpatialIndex::~SpatialIndex()
+{
+}
+
+void SpatialIndex::insert(Object *object, const QRect &bounds)
+{
+    if (!object) {
+        return;
+    }
+    if (m_locations.contains(object)) {
+        update(object, bounds);
+        return;
+    }
+
+    const Entry entry{object, bounds.normalized()};
+    growToFit(entry.bounds);
+    insertEntry(m_root.get(), entry);
+}
+
+void SpatialIndex::update(Object *object, const QRect &bounds)
+{
+    auto location = m_locations.find(object);
+    if (location == m_locations.end()) {
+        insert(object, bounds);
+        return;
+    }
+
+    const QRect normalized = bounds.normalized();
+    Node *node = location->node;
+    Entry &entry = node->entries[location->index];
+    if (entry.bounds == normalized) {
+        return;
+    }
+
+    // Small moves usually leave the object in the same cell
+    const int half = node->cell.width() / 2;
+    const bool fitsChild = node->split && normalized.width() <= half && normalized.height() <= half;
+    if (fits(node->cell, normalized) && !fitsChild) {
+        entry.bounds = normalized;
+        return;
+    }
+
+    remove(object);
+    insert(object, normalized);
+}
+
+void SpatialIndex::remove(Object *object)
+{
+    auto location = m_locations.find(object);
+    if (location == m_locations.end()) {
+        return;
+    }
+
+    Node *node = location->node;
+    const int index = location->index;
+    m_locations.erase(location);
+    removeFromNode(node, index);
+
+    if (m_locations.isEmpty()) {
+        m_root.reset();
+    } else {
+        prune(node);
+    }
+}
+
+void SpatialIndex::clear()
+{
+    m_locations.clear();
+    m_root.reset();
+}
+
+QRect SpatialIndex::bounds(Object *object) const
+{
+    auto location = m_locations.find(object);
+    if (location == m_locations.end()) {
+        return QRect();
+    }
+    return location->node->entries[location->index].bounds;
+}
+
+QVector<Object *> SpatialIndex::query(const QRect &rect) const
+{
+    QVector<Object *> result;
+    const QRect area = rect.normalized();
+    if (!m_root || area.isNull()) {
+        return result;
+    }
+
+    // The root is always searched: an object too large for any cell stays there
+    QVector<const Node *> stack;
+    stack.append(m_root.get());
+    while (!stack.isEmpty()) {
+        const Node *node = stack.takeLast();
+        for (const Entry &entry : node->entries) {
+            if (entry.bounds.intersects(area)) {
+                result.append(entry.object);
+            }
+        }
+        for (const auto &child : node->children) {
+            if (child && looseBounds(child->cell).intersects(area)) {
+                stack.append(child.get());
+            }
+        }
+    }
+    return result;
+}
+
+QVector<Object *> SpatialIndex::query(const QPoint &point) const
+{
+    return query(QRect(point, QSize(1, 1)));
+}
+
+QRect SpatialIndex::looseBounds(const QRect &cell)
+{
+    const int half = cell.width() / 2;
+    return cell.adjusted(-half, -half, half, half);
+}
+
+QPoint SpatialIndex::centerOf(const QRect &bounds)
+{
+    return QPoint(bounds.x() + bounds.width() / 2, bounds.y() + bounds.height() / 2);
+}
+
+bool SpatialIndex::fits(const QRect &cell, const QRect &bounds)
+{
+    return bounds.width() <= cell.width() && bounds.height() <= cell.height() &&
+           cell.contains(centerOf(bounds));
+}
+
+int SpatialIndex::quadrant(const QRect &cell, const QPoint &point)
+{
+    const int half = cell.width() / 2;
+    return (point.x() >= cell.x() + half ? 1 : 0) | (point.y() >= cell.y() + half ? 2 : 0);
+}
+
+QRect SpatialIndex::childCell(const QRect &cell, int quadrant)
+{
+    const int half = cell.width() / 2;
+    return QRect(cell.x() + ((quadrant & 1) ? half : 0), cell.y() + ((quadrant & 2) ? half : 0), half, half);
+}
+
+void SpatialIndex::growToFit(const QRect &bounds)
+{
+    if (!m_root) {
+        int size = InitialCellSize;
+        while (size < MaxCellSize && (size < bounds.width() || size < bounds.height())) {
+            size *= 2;
+        }
+
+        const QPoint center = centerOf(bounds);
+        m_root = std::make_unique<Node>();
+        m_root->cell = QRect(alignDown(center.x(), size), alignDown(center.y(), size), size, size);
+        return;
+    }
+
+    // Double the root towards the object until it fits; the old root becomes a quadrant
+    while (!fits(m_root->cell, bounds) && m_root->cell.width() < MaxCellSize) {
+        const QRect cell = m_root->cell;
+        const int size = cell.width();
+        const QPoint center = centerOf(bounds);
+        const int left = center.x() < cell.x() ? cell.x() - size : cell.x();
+        const int top = center.y() < cell.y() ? cell.y() - size : cell.y();
+
+        auto root = std::make_unique<Node>();
+        root->cell = QRect(left, top, size * 2, size * 2);
+        root->split = true;
+
+        const int quadrant = (cell.x() > left ? 1 : 0) | (cell.y() > top ? 2 : 0);
+        m_root->parent = root.get();
+        root->children[quadrant] = std::move(m_root);
+        m_root = std::move(root);
+    }
+}
+
+void SpatialIndex::insertEntry(Node *node, const Entry &entry)
+{
+    const QPoint center = centerOf(entry.bounds);
+    while (node->split) {
+        const int half = node->cell.width() / 2;
+        if (entry.bounds.width() > half || entry.bounds.height() > half || !node->cell.contains(center)) {
+            break;
+        }
+
+        const int index = quadrant(node->cell, center);
+        if (!node->children[index]) {
+            node->children[index] = std::make_unique<Node>();
+            node->children[index]->cell = childCell(node->cell, index);
+            node->children[index]->parent = node;
+        }
+        node = node->children[index].get();
+    }
+
+    addToNode(node, entry);
+    if (!node->split && node->entries.size() > NodeCapacity && node->cell.width() > MinCellSize) {
+        splitNode(node);
+    }
+}
+
+void SpatialIndex::addToNode(Node *node, const Entry &entry)
+{
+    node->entries.append(entry);
+    m_locations.insert(entry.object, Location{node, static_cast<int>(node->entries.size()) - 1});
+}
+
+void SpatialIndex::removeFromNode(Node *node, int index)
+{
+    // Swap with the last entry so removal does not shift the others
+    const int last = node->entries.size() - 1;
+    if (index != last) {
+        node->entries[index] = node->entries[last];
+        m_locations[node->entries[index].object].index = index;
+    }
+    node->entries.removeLast();
+}
+
+void SpatialIndex::splitNode(Node *node)
+{
+    // Entries too large for a quadrant stay; a node splits only once, so
+    // piles of large objects do not make every insert retry the split
+    node->split = true;
+
+    QVector<Entry> entries;
+    entries.swap(node->entries);
+    for (const Entry &entry : entries) {
+        insertEntry(node, entry);
+    }
+}
+
+void SpatialIndex::prune(Node *node)
+{
+    // Drop cells left with nothing in or below them
+    while (node && node->parent && node->entries.isEmpty()) {
+        for (const auto &child : node->children) {
+            if (child) {
+                return;
+            }
+        }
+
+        Node *parent = node->parent;
+        for (auto &child : parent->children) {
+            if (child.get() == node) {
+                child.reset();
+                break;
+            }
+        }
+        node = parent;
+    }
+}
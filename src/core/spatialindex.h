@@ -0,0 +1,84 @@
+#ifndef SPATIALINDEX_H
+#define SPATIALINDEX_H
+
+#include <QHash>
+#include <QPoint>
+#include <QRect>
+#include <QVector>
+#include <memory>
+
+class Object;
+
+/**
+ * @brief Loose quadtree over object bounds
+ *
+ * Each object is kept in the smallest cell that contains its center and is
+ * at least as large as the object; a cell's loose bounds extend half a cell
+ * beyond it on every side, so they always hold its objects entirely and an
+ * object never straddles a split. Cells split once they hold more than a
+ * few objects and the tree grows outwards when an object lands outside it.
+ *
+ * Insert, update and remove take O(log n); queries return candidates in no
+ * particular order, leaving layer order to the caller.
+ */
+class SpatialIndex
+{
+public:
+    SpatialIndex();
+    ~SpatialIndex();
+
+    SpatialIndex(const SpatialIndex &) = delete;
+    SpatialIndex &operator=(const SpatialIndex &) = delete;
+
+    void insert(Object *object, const QRect &bounds);
+    void update(Object *object, const QRect &bounds);
+    void remove(Object *object);
+    void clear();
+
+    bool contains(Object *object) const { return m_locations.contains(object); }
+    int size() const { return m_locations.size(); }
+
+    // The bounds an object was last indexed with, or a null rectangle
+    QRect bounds(Object *object) const;
+
+    // Objects whose indexed bounds intersect the rectangle or hold the point
+    QVector<Object *> query(const QRect &rect) const;
+    QVector<Object *> query(const QPoint &point) const;
+
+private:
+    struct Entry {
+        Object *object;
+        QRect bounds;
+    };
+
+    struct Node {
+        QRect cell;
+        Node *parent = nullptr;
+        std::unique_ptr<Node> children[4];
+        QVector<Entry> entries;
+        bool split = false;
+    };
+
+    struct Location {
+        Node *node;
+        int index;
+    };
+
+    std::unique_ptr<Node> m_root;
+    QHash<Object *, Location> m_locations;
+
+    static QRect looseBounds(const QRect &cell);
+    static QPoint centerOf(const QRect &bounds);
+    static bool fits(const QRect &cell, const QRect &bounds);
+    static int quadrant(const QRect &cell, const QPoint &point);
+    static QRect childCell(const QRect &cell, int quadrant);
+
+    void growToFit(const QRect &bounds);
+    void insertEntry(Node *node, const Entry &entry);
+    void addToNode(Node *node, const Entry &entry);
+    void removeFromNode(Node *node, int index);
+    void splitNode(Node *node);
+    void prune(Node *node);
+};
+
+#endif // SPATIALINDEX_H
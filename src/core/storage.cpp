@@ -1,18 +1,58 @@
 #include "storage.h"
+#include "blobcodec.h"
+#include "fractionalindex.h"
+#include "textobject.h"
 #include <QSqlDatabase>
 #include <QSqlQuery>
 #include <QSqlError>
+#include <QSqlDriver>
 #include <QJsonObject>
 #include <QJsonDocument>
 #include <QStandardPaths>
 #include <QDir>
+#include <QFile>
 #include <QFileInfo>
 #include <QDateTime>
+#include <QHash>
+#include <QPointer>
+#include <QRegularExpression>
+#include <QThread>
+#include <QtConcurrent>
+#include <QCryptographicHash>
 #include <QDebug>
+#include <algorithm>
+#include <numeric>
+#include <sqlite3.h>
+
+namespace {
+// SQLite's default limit on bound parameters per statement before 3.32
+const int MaxBindValues = 999;
+
+// Saves with fewer blobs than this are compressed without the thread pool
+const int ParallelEncodeThreshold = 8;
+
+QString placeholderRows(int rows, int columns)
+{
+    QStringList columnPlaceholders;
+    for (int i = 0; i < columns; ++i) {
+        columnPlaceholders.append("?");
+    }
+    const QString row = columns > 1 ? "(" + columnPlaceholders.join(", ") + ")" : columnPlaceholders.join(", ");
+    
+    QStringList placeholders;
+    for (int i = 0; i < rows; ++i) {
+        placeholders.append(row);
+    }
+    return placeholders.join(", ");
+}
+}
 
 Storage::Storage(QObject *parent)
     : QObject(parent)
     , m_initialized(false)
+    , m_fullTextSearch(false)
+    , m_tuningEnabled(true)
+    , m_sharedSqlite(false)
 {
 }
 
@@ -45,24 +85,51 @@ bool Storage::initialize(const QString &databasePath)
         return false;
     }
     
+    if (m_tuningEnabled && !applyPragmas()) {
+        emit databaseError("Failed to configure database: " + m_database.lastError().text());
+        return false;
+    }
+    
+    // Qt builds that bundle their own SQLite cannot share connection handles
+    // with the library linked here; backups then go through the driver
+    m_sharedSqlite = usesLinkedSqlite();
+    if (!m_sharedSqlite) {
+        qWarning() << "Qt's SQLite driver does not use the linked SQLite library;"
+                   << "backups use VACUUM INTO and in-place restore is unavailable";
+    }
+    
     // Create tables
     if (!createTables()) {
         emit databaseError("Failed to create database tables");
         return false;
     }
     
+    // Stored blobs may reference any dictionary ever trained
+    if (!loadDictionaries()) {
+        emit databaseError("Failed to load compression dictionaries");
+        return false;
+    }
+    
     // Run migrations
     if (!migrateDatabase()) {
         emit databaseError("Failed to migrate database");
         return false;
     }
     
+    // The first dictionary is trained once there are enough objects to learn from
+    if (BlobCodec::hasZstd() && !hasDictionary()) {
+        trainDictionary();
+    }
+    
     m_initialized = true;
     return true;
 }
 
 void Storage::close()
 {
+    // Prepared statements must go before the connection they belong to
+    m_statements.clear();
+    
     if (m_database.isOpen()) {
         m_database.close();
     }
@@ -80,22 +147,41 @@ bool Storage::saveDocument(std::shared_ptr<Document> document)
         return false;
     }
     
+    if (!saveDocument(snapshotDocument(*document))) {
+        return false;
+    }
+    
+    document->markSaved();
+    return true;
+}
+
+bool Storage::saveDocument(DocumentSnapshot snapshot)
+{
+    if (!m_initialized || snapshot.id.isEmpty()) {
+        return false;
+    }
+    
+    // Compressed and hashed on this thread, before the transaction opens
+    sealSnapshot(snapshot);
+    
+    m_lastSave = SaveStatistics();
     beginTransaction();
     
     try {
-        // Save document metadata
+        // Save document metadata; the data column only holds the page manifest
         QSqlQuery query = prepareQuery(
-            "INSERT OR REPLACE INTO documents (id, title, description, created_date, modified_date, tags, data) "
-            "VALUES (?, ?, ?, ?, ?, ?, ?)"
+            "INSERT OR REPLACE INTO documents (id, title, description, created_date, modified_date, tags, page_count, data) "
+            "VALUES (?, ?, ?, ?, ?, ?, ?, ?)"
         );
         
-        query.addBindValue(document->id());
-        query.addBindValue(document->title());
-        query.addBindValue(document->description());
-        query.addBindValue(document->createdDate());
-        query.addBindValue(document->modifiedDate());
-        query.addBindValue(QStringList(document->tags()).join(","));
-        query.addBindValue(documentToBlob(document));
+        query.addBindValue(snapshot.id);
+        query.addBindValue(snapshot.title);
+        query.addBindValue(snapshot.description);
+        query.addBindValue(snapshot.createdDate);
+        query.addBindValue(snapshot.modifiedDate);
+        query.addBindValue(snapshot.tags.join(","));
+        query.addBindValue(snapshot.pageCount);
+        query.addBindValue(snapshot.manifest);
         
         if (!query.exec()) {
             rollbackTransaction();
@@ -103,16 +189,60 @@ bool Storage::saveDocument(std::shared_ptr<Document> document)
             return false;
         }
         
-        // Save pages
-        for (const auto &page : document->pages()) {
-            if (!savePage(document->id(), page)) {
+        if (!writeDocumentTags(snapshot.id, snapshot.tags) ||
+            !indexDocumentMetadata(snapshot.id, snapshot.title, snapshot.description, snapshot.tags)) {
+            rollbackTransaction();
+            return false;
+        }
+        
+        // Drop pages removed since the last save
+        for (const QString &pageId : snapshot.removedPageIds) {
+            if (!deletePage(pageId)) {
+                rollbackTransaction();
+                return false;
+            }
+        }
+        
+        // The snapshot only carries pages that changed since the last save
+        for (const auto &page : snapshot.pages) {
+            if (!savePage(snapshot.id, page)) {
                 rollbackTransaction();
                 return false;
             }
         }
         
+        // A reordered page only needs its position column
+        for (auto it = snapshot.movedPages.begin(); it != snapshot.movedPages.end(); ++it) {
+            QSqlQuery move = prepareQuery("UPDATE pages SET position = ? WHERE id = ?");
+            move.addBindValue(it.value());
+            move.addBindValue(it.key());
+            if (!move.exec()) {
+                rollbackTransaction();
+                emit databaseError("Failed to save page order: " + move.lastError().text());
+                return false;
+            }
+        }
+        
+        if (snapshot.linksChanged && !writeDocumentLinks(snapshot.id, snapshot.links)) {
+            rollbackTransaction();
+            return false;
+        }
+        
+        // Journal entries queued before this save are part of the snapshot
+        QSqlQuery clearJournal = prepareQuery("DELETE FROM journal WHERE document_id = ?");
+        clearJournal.addBindValue(snapshot.id);
+        if (!clearJournal.exec()) {
+            rollbackTransaction();
+            emit databaseError("Failed to clear journal: " + clearJournal.lastError().text());
+            return false;
+        }
+        
         commitTransaction();
-        emit documentSaved(document->id());
+        m_totalSaves.pagesWritten += m_lastSave.pagesWritten;
+        m_totalSaves.pagesSkipped += m_lastSave.pagesSkipped;
+        m_totalSaves.objectsWritten += m_lastSave.objectsWritten;
+        m_totalSaves.objectsSkipped += m_lastSave.objectsSkipped;
+        emit documentSaved(snapshot.id);
         return true;
         
     } catch (...) {
@@ -122,12 +252,135 @@ bool Storage::saveDocument(std::shared_ptr<Document> document)
     }
 }
 
-std::shared_ptr<Document> Storage::loadDocument(const QString &documentId)
+Storage::DocumentSnapshot Storage::snapshotDocument(const Document &document)
+{
+    DocumentSnapshot snapshot;
+    snapshot.id = document.id();
+    snapshot.title = document.title();
+    snapshot.description = document.description();
+    snapshot.createdDate = document.createdDate();
+    snapshot.modifiedDate = document.modifiedDate();
+    snapshot.tags = document.tags();
+    snapshot.pageCount = document.pages().size();
+    snapshot.manifestPayload = BlobCodec::encodeManifestPayload(document);
+    snapshot.removedPageIds = document.removedPageIds();
+    snapshot.linksChanged = document.linksChanged();
+    if (snapshot.linksChanged) {
+        snapshot.links = document.links();
+    }
+    
+    const QStringList movedPageIds = document.movedPageIds();
+    QVector<const Page *> dirtyPages;
+    for (const auto &page : document.pages()) {
+        // A stub holds no content, so writing it would replace the stored page
+        if (page->isLoaded() && page->isDirty()) {
+            dirtyPages.append(page.get());
+        } else if (movedPageIds.contains(page->id())) {
+            snapshot.movedPages.insert(page->id(), page->position());
+        }
+    }
+    snapshot.pages = snapshotPages(dirtyPages);
+    
+    return snapshot;
+}
+
+Storage::PageSnapshot Storage::snapshotPage(const Page &page)
+{
+    return snapshotPages(QVector<const Page *>{&page}).first();
+}
+
+QVector<Storage::PageSnapshot> Storage::snapshotPages(const QVector<const Page *> &pages)
+{
+    // Only the plain encodings are taken here, on the pages' thread; the
+    // compression and hashing that cost more are left to sealPages(). Which
+    // objects go out is decided here too; unchanged objects keep their stored rows.
+    QVector<PageSnapshot> snapshots;
+    snapshots.reserve(pages.size());
+    for (const Page *page : pages) {
+        PageSnapshot snapshot;
+        snapshot.id = page->id();
+        snapshot.title = page->title();
+        snapshot.position = page->position();
+        snapshot.replaceObjects = page->objectsNeedRewrite();
+        snapshot.removedObjectIds = page->removedObjectIds();
+        snapshot.payload = BlobCodec::encodePageHeaderPayload(*page);
+        
+        for (const auto &object : page->objects()) {
+            if (!snapshot.replaceObjects && !object->isDirty()) {
+                continue;
+            }
+            
+            ObjectSnapshot objectSnapshot;
+            objectSnapshot.id = object->id();
+            objectSnapshot.type = object->type();
+            objectSnapshot.payload = BlobCodec::encodeObjectPayload(*object);
+            if (auto textObject = std::dynamic_pointer_cast<TextObject>(object)) {
+                objectSnapshot.text = textObject->content();
+            }
+            snapshot.objects.append(objectSnapshot);
+        }
+        
+        snapshots.append(snapshot);
+    }
+    
+    return snapshots;
+}
+
+void Storage::sealSnapshot(DocumentSnapshot &snapshot)
+{
+    if (snapshot.manifest.isEmpty()) {
+        snapshot.manifest = BlobCodec::seal(BlobCodec::ManifestBlob, snapshot.manifestPayload);
+    }
+    sealPages(snapshot.pages);
+}
+
+void Storage::sealPages(QVector<PageSnapshot> &pages)
+{
+    struct SealJob {
+        BlobCodec::Kind kind;
+        const QByteArray *payload;
+        QByteArray *data;
+        QByteArray *hash;
+    };
+    
+    // Blobs sealed before, e.g. by an earlier attempt, are kept
+    QVector<SealJob> jobs;
+    for (PageSnapshot &page : pages) {
+        if (page.data.isEmpty()) {
+            jobs.append({BlobCodec::PageHeaderBlob, &page.payload, &page.data, &page.hash});
+        }
+        for (ObjectSnapshot &object : page.objects) {
+            if (object.data.isEmpty()) {
+                jobs.append({BlobCodec::ObjectBlob, &object.payload, &object.data, &object.hash});
+            }
+        }
+    }
+    
+    // The hash covers the payload, not the compressed blob, so it survives
+    // a change of compression or dictionary. A few blobs, as in most
+    // auto-saves, cost less to compress here than to hand off.
+    auto seal = [](const SealJob &job) {
+        *job.data = BlobCodec::seal(job.kind, *job.payload);
+        *job.hash = QCryptographicHash::hash(*job.payload, QCryptographicHash::Md5);
+    };
+    if (jobs.size() < ParallelEncodeThreshold) {
+        std::for_each(jobs.begin(), jobs.end(), seal);
+    } else {
+        QtConcurrent::blockingMap(jobs, seal);
+    }
+}
+
+std::shared_ptr<Document> Storage::loadDocument(const QString &documentId, LoadMode mode)
 {
     if (!m_initialized || documentId.isEmpty()) {
         return nullptr;
     }
     
+    // Edits journaled after the last snapshot, e.g. before a crash
+    if (!replayJournal(documentId)) {
+        return nullptr;
+    }
+    
     QSqlQuery query = prepareQuery("SELECT data FROM documents WHERE id = ?");
     query.addBindValue(documentId);
     
@@ -137,7 +390,7 @@ std::shared_ptr<Document> Storage::loadDocument(const QString &documentId)
     }
     
     QByteArray blob = query.value(0).toByteArray();
-    return documentFromBlob(blob);
+    return documentFromBlob(blob, mode);
 }
 
 std::shared_ptr<Document> Storage::loadDocumentByTitle(const QString &title)
@@ -166,7 +419,30 @@ bool Storage::deleteDocument(const QString &documentId)
     
     beginTransaction();
     
-    // Delete pages first
+    // Links, objects, then pages, then the document itself; the page
+    // subqueries are served by idx_pages_document
+    QSqlQuery deleteLinks = prepareQuery(
+        "DELETE FROM links WHERE from_page_id IN (SELECT id FROM pages WHERE document_id = ?) "
+        "OR to_page_id IN (SELECT id FROM pages WHERE document_id = ?)"
+    );
+    deleteLinks.addBindValue(documentId);
+    deleteLinks.addBindValue(documentId);
+    if (!deleteLinks.exec()) {
+        rollbackTransaction();
+        emit databaseError("Failed to delete document links: " + deleteLinks.lastError().text());
+        return false;
+    }
+    
+    QSqlQuery deleteObjects = prepareQuery(
+        "DELETE FROM objects WHERE page_id IN (SELECT id FROM pages WHERE document_id = ?)"
+    );
+    deleteObjects.addBindValue(documentId);
+    if (!deleteObjects.exec()) {
+        rollbackTransaction();
+        emit databaseError("Failed to delete document objects: " + deleteObjects.lastError().text());
+        return false;
+    }
+    
     QSqlQuery deletePages = prepareQuery("DELETE FROM pages WHERE document_id = ?");
     deletePages.addBindValue(documentId);
     if (!deletePages.exec()) {
@@ -175,6 +451,22 @@ bool Storage::deleteDocument(const QString &documentId)
         return false;
     }
     
+    QSqlQuery deleteTags = prepareQuery("DELETE FROM document_tags WHERE document_id = ?");
+    deleteTags.addBindValue(documentId);
+    if (!deleteTags.exec()) {
+        rollbackTransaction();
+        emit databaseError("Failed to delete document tags: " + deleteTags.lastError().text());
+        return false;
+    }
+    
+    QSqlQuery deleteJournal = prepareQuery("DELETE FROM journal WHERE document_id = ?");
+    deleteJournal.addBindValue(documentId);
+    if (!deleteJournal.exec()) {
+        rollbackTransaction();
+        emit databaseError("Failed to delete document journal: " + deleteJournal.lastError().text());
+        return false;
+    }
+    
     // Delete document
     QSqlQuery deleteDoc = prepareQuery("DELETE FROM documents WHERE id = ?");
     deleteDoc.addBindValue(documentId);
@@ -184,6 +476,11 @@ bool Storage::deleteDocument(const QString &documentId)
         return false;
     }
     
+    if (!removeDocumentFromIndex(documentId)) {
+        rollbackTransaction();
+        return false;
+    }
+    
     commitTransaction();
     emit documentDeleted(documentId);
     return true;
@@ -197,7 +494,8 @@ QStringList Storage::listDocuments()
         return documents;
     }
     
-    QSqlQuery query = prepareQuery("SELECT id, title FROM documents ORDER BY modified_date DESC");
+    // A scan of idx_documents_modified alone; the table is not read
+    QSqlQuery query = prepareQuery("SELECT id FROM documents ORDER BY modified_date DESC, id DESC");
     if (query.exec()) {
         while (query.next()) {
             documents.append(query.value(0).toString());
@@ -209,441 +507,2397 @@ QStringList Storage::listDocuments()
     return documents;
 }
 
-bool Storage::savePage(const QString &documentId, std::shared_ptr<Page> page)
+QVector<Storage::CatalogEntry> Storage::documentCatalog(int limit, const CatalogCursor &after,
+                                                         CatalogCursor *next)
 {
-    if (!m_initialized || !page) {
-        return false;
+    QVector<CatalogEntry> entries;
+    
+    if (next) {
+        *next = CatalogCursor();
     }
     
-    QSqlQuery query = prepareQuery(
-        "INSERT OR REPLACE INTO pages (id, document_id, title, data) VALUES (?, ?, ?, ?)"
-    );
+    if (!m_initialized || limit <= 0) {
+        return entries;
+    }
     
-    query.addBindValue(page->id());
-    query.addBindValue(documentId);
-    query.addBindValue(page->title());
-    query.addBindValue(pageToBlob(page));
+    // Keyset pagination over idx_documents_modified; one extra row tells
+    // whether another page follows without a separate COUNT
+    QString sql =
+        "SELECT d.id, d.title, d.modified_date, d.page_count, "
+        "(SELECT group_concat(t.tag, char(31)) FROM document_tags t WHERE t.document_id = d.id) "
+        "FROM documents d ";
+    if (!after.isNull()) {
+        sql += "WHERE d.modified_date < ? OR (d.modified_date = ? AND d.id < ?) ";
+    }
+    sql += "ORDER BY d.modified_date DESC, d.id DESC LIMIT ?";
+    
+    QSqlQuery query = prepareQuery(sql);
+    if (!after.isNull()) {
+        query.addBindValue(after.modifiedDate);
+        query.addBindValue(after.modifiedDate);
+        query.addBindValue(after.id);
+    }
+    query.addBindValue(limit + 1);
     
     if (!query.exec()) {
-        emit databaseError("Failed to save page: " + query.lastError().text());
-        return false;
+        emit databaseError("Failed to read document catalog: " + query.lastError().text());
+        return entries;
     }
     
-    return true;
+    QString lastModified;
+    while (query.next()) {
+        if (entries.size() == limit) {
+            if (next) {
+                next->modifiedDate = lastModified;
+                next->id = entries.last().id;
+            }
+            break;
+        }
+        
+        CatalogEntry entry;
+        entry.id = query.value(0).toString();
+        entry.title = query.value(1).toString();
+        lastModified = query.value(2).toString();
+        entry.modifiedDate = QDateTime::fromString(lastModified, Qt::ISODateWithMs);
+        entry.pageCount = query.value(3).toInt();
+        entry.tags = query.value(4).toString().split(QChar(31), Qt::SkipEmptyParts);
+        entries.append(entry);
+    }
+    
+    return entries;
 }
 
-std::shared_ptr<Page> Storage::loadPage(const QString &pageId)
+bool Storage::savePage(const QString &documentId, std::shared_ptr<Page> page)
 {
-    if (!m_initialized || pageId.isEmpty()) {
-        return nullptr;
-    }
-    
-    QSqlQuery query = prepareQuery("SELECT data FROM pages WHERE id = ?");
-    query.addBindValue(pageId);
-    
-    if (!query.exec() || !query.next()) {
-        emit databaseError("Failed to load page: " + query.lastError().text());
-        return nullptr;
+    if (!m_initialized || !page) {
+        return false;
     }
     
-    QByteArray blob = query.value(0).toByteArray();
-    return pageFromBlob(blob);
+    return savePage(documentId, snapshotPage(*page));
 }
 
-bool Storage::deletePage(const QString &pageId)
+bool Storage::savePage(const QString &documentId, PageSnapshot snapshot)
 {
-    if (!m_initialized || pageId.isEmpty()) {
+    if (!m_initialized || snapshot.id.isEmpty()) {
         return false;
     }
     
-    QSqlQuery query = prepareQuery("DELETE FROM pages WHERE id = ?");
-    query.addBindValue(pageId);
+    // A no-op for pages saveDocument() has sealed already
+    if (snapshot.data.isEmpty()) {
+        QVector<PageSnapshot> pages{snapshot};
+        sealPages(pages);
+        snapshot = pages.first();
+    }
+    
+    // The page row holds only the header, so an upsert never touches its objects.
+    // Pages saved outside a document, by journal replay or a migration, have
+    // no position and keep the stored one.
+    // A row whose hash and position already match is left untouched, so it
+    // neither dirties database pages nor shows up in the change log.
+    const bool hasPosition = !snapshot.position.isEmpty();
+    QSqlQuery query = hasPosition
+        ? prepareQuery(
+              "INSERT INTO pages (id, document_id, title, position, data, hash) VALUES (?, ?, ?, ?, ?, ?) "
+              "ON CONFLICT(id) DO UPDATE SET document_id = excluded.document_id, "
+              "title = excluded.title, position = excluded.position, data = excluded.data, hash = excluded.hash "
+              "WHERE pages.hash IS NOT excluded.hash OR pages.position IS NOT excluded.position "
+              "OR pages.document_id IS NOT excluded.document_id")
+        : prepareQuery(
+              "INSERT INTO pages (id, document_id, title, data, hash) VALUES (?, ?, ?, ?, ?) "
+              "ON CONFLICT(id) DO UPDATE SET document_id = excluded.document_id, "
+              "title = excluded.title, data = excluded.data, hash = excluded.hash "
+              "WHERE pages.hash IS NOT excluded.hash OR pages.document_id IS NOT excluded.document_id");
+    
+    query.addBindValue(snapshot.id);
+    query.addBindValue(documentId);
+    query.addBindValue(snapshot.title);
+    if (hasPosition) {
+        query.addBindValue(snapshot.position);
+    }
+    query.addBindValue(snapshot.data);
+    query.addBindValue(snapshot.hash);
     
     if (!query.exec()) {
-        emit databaseError("Failed to delete page: " + query.lastError().text());
+        emit databaseError("Failed to save page: " + query.lastError().text());
         return false;
     }
     
-    return true;
-}
-
-QStringList Storage::searchDocuments(const QString &query)
-{
-    QStringList results;
-    
-    if (!m_initialized || query.isEmpty()) {
-        return results;
+    const bool headerWritten = query.numRowsAffected() > 0;
+    if (headerWritten) {
+        ++m_lastSave.pagesWritten;
+    } else {
+        ++m_lastSave.pagesSkipped;
     }
     
-    QSqlQuery sqlQuery = prepareQuery(
-        "SELECT id FROM documents WHERE title LIKE ? OR description LIKE ? OR tags LIKE ?"
-    );
+    // Removals go first so an object removed and added back ends up stored
+    if (snapshot.replaceObjects) {
+        QSqlQuery clear = prepareQuery("DELETE FROM objects WHERE page_id = ?");
+        clear.addBindValue(snapshot.id);
+        if (!clear.exec()) {
+            emit databaseError("Failed to save page objects: " + clear.lastError().text());
+            return false;
+        }
+    } else {
+        for (const QString &objectId : snapshot.removedObjectIds) {
+            QSqlQuery remove = prepareQuery("DELETE FROM objects WHERE id = ?");
+            remove.addBindValue(objectId);
+            if (!remove.exec()) {
+                emit databaseError("Failed to save page objects: " + remove.lastError().text());
+                return false;
+            }
+        }
+    }
     
-    QString searchPattern = "%" + query + "%";
-    sqlQuery.addBindValue(searchPattern);
-    sqlQuery.addBindValue(searchPattern);
-    sqlQuery.addBindValue(searchPattern);
+    // Only objects that were written need their search entries replaced
+    PageSnapshot written = snapshot;
+    written.objects.clear();
     
-    if (sqlQuery.exec()) {
-        while (sqlQuery.next()) {
-            results.append(sqlQuery.value(0).toString());
+    for (const auto &object : snapshot.objects) {
+        QSqlQuery upsert = prepareQuery(
+            "INSERT INTO objects (id, page_id, type, data, hash) VALUES (?, ?, ?, ?, ?) "
+            "ON CONFLICT(id) DO UPDATE SET page_id = excluded.page_id, "
+            "type = excluded.type, data = excluded.data, hash = excluded.hash "
+            "WHERE objects.hash IS NOT excluded.hash OR objects.page_id IS NOT excluded.page_id"
+        );
+        upsert.addBindValue(object.id);
+        upsert.addBindValue(snapshot.id);
+        upsert.addBindValue(object.type);
+        upsert.addBindValue(object.data);
+        upsert.addBindValue(object.hash);
+        if (!upsert.exec()) {
+            emit databaseError("Failed to save page objects: " + upsert.lastError().text());
+            return false;
+        }
+        
+        if (upsert.numRowsAffected() > 0) {
+            written.objects.append(object);
+            ++m_lastSave.objectsWritten;
+        } else {
+            ++m_lastSave.objectsSkipped;
         }
-    } else {
-        emit databaseError("Failed to search documents: " + sqlQuery.lastError().text());
     }
     
-    return results;
+    if (!headerWritten && written.objects.isEmpty() &&
+        !snapshot.replaceObjects && snapshot.removedObjectIds.isEmpty()) {
+        return true;
+    }
+    return indexPage(documentId, written);
 }
 
-QStringList Storage::findDocumentsByTag(const QString &tag)
+Storage::PageRecord Storage::loadPageRecord(const QString &pageId)
 {
-    QStringList results;
+    PageRecord record;
     
-    if (!m_initialized || tag.isEmpty()) {
-        return results;
+    if (!m_initialized || pageId.isEmpty()) {
+        return record;
     }
     
-    QSqlQuery query = prepareQuery("SELECT id FROM documents WHERE tags LIKE ?");
-    query.addBindValue("%" + tag + "%");
+    QSqlQuery query = prepareQuery("SELECT data FROM pages WHERE id = ?");
+    query.addBindValue(pageId);
     
-    if (query.exec()) {
-        while (query.next()) {
-            results.append(query.value(0).toString());
+    if (!query.exec() || !query.next()) {
+        emit databaseError("Failed to load page: " + query.lastError().text());
+        return record;
+    }
+    
+    record.data = query.value(0).toByteArray();
+    
+    // Pages written before object rows carry their objects in the page blob
+    if (BlobCodec::isPageHeader(record.data)) {
+        QSqlQuery objects = prepareQuery("SELECT data FROM objects WHERE page_id = ? ORDER BY rowid");
+        objects.addBindValue(pageId);
+        
+        if (!objects.exec()) {
+            emit databaseError("Failed to load page objects: " + objects.lastError().text());
+            return PageRecord();
+        }
+        while (objects.next()) {
+            record.objects.append(objects.value(0).toByteArray());
         }
-    } else {
-        emit databaseError("Failed to find documents by tag: " + query.lastError().text());
     }
     
-    return results;
+    return record;
 }
 
-QVector<QJsonObject> Storage::getRecentDocuments(int limit)
+bool Storage::decodePageRecord(const PageRecord &record, Page &page)
 {
-    QVector<QJsonObject> results;
-    
-    if (!m_initialized) {
-        return results;
+    if (record.data.isEmpty()) {
+        return false;
     }
     
-    QSqlQuery query = prepareQuery(
-        "SELECT id, title, description, modified_date FROM documents "
-        "ORDER BY modified_date DESC LIMIT ?"
-    );
-    query.addBindValue(limit);
+    return fillPage(record.data, decodeObjects(record.objects), page);
+}
+
+QVector<std::shared_ptr<Object>> Storage::decodeObjects(const QVector<QByteArray> &blobs)
+{
+    QVector<std::shared_ptr<Object>> objects(blobs.size());
+    if (blobs.isEmpty()) {
+        return objects;
+    }
     
-    if (query.exec()) {
-        while (query.next()) {
-            QJsonObject doc;
-            doc["id"] = query.value(0).toString();
-            doc["title"] = query.value(1).toString();
-            doc["description"] = query.value(2).toString();
-            doc["modifiedDate"] = query.value(3).toString();
-            results.append(doc);
+    // Decoding parses every text and stroke, so it is spread over the global
+    // pool. Each object is pushed to the caller's thread by the thread that
+    // built it; no signal is connected until the objects join their page.
+    QThread *owner = QThread::currentThread();
+    std::shared_ptr<Object> *results = objects.data();
+    QVector<int> indexes(blobs.size());
+    std::iota(indexes.begin(), indexes.end(), 0);
+    
+    QtConcurrent::blockingMap(indexes, [&blobs, results, owner](int index) {
+        std::shared_ptr<Object> object = BlobCodec::decodeObject(blobs.at(index));
+        if (object) {
+            object->moveToThread(owner);
         }
-    } else {
-        emit databaseError("Failed to get recent documents: " + query.lastError().text());
-    }
+        results[index] = object;
+    });
     
-    return results;
+    return objects;
 }
 
-bool Storage::createBackup(const QString &backupPath)
+bool Storage::fillPage(const QByteArray &header, const QVector<std::shared_ptr<Object>> &objects, Page &page)
 {
-    if (!m_initialized) {
+    if (!BlobCodec::decodePage(header, page)) {
         return false;
     }
     
-    // Simple file copy backup
-    if (QFile::exists(m_databasePath)) {
-        return QFile::copy(m_databasePath, backupPath);
-    }
-    
-    return false;
+    page.addObjects(objects);
+    page.markClean();
+    return true;
 }
 
-bool Storage::restoreFromBackup(const QString &backupPath)
+QVector<std::shared_ptr<Object>> Storage::loadObjects(const QString &pageId, const QList<Object::Type> &types)
 {
-    if (!QFile::exists(backupPath)) {
-        return false;
+    QVector<std::shared_ptr<Object>> objects;
+    
+    if (!m_initialized || pageId.isEmpty()) {
+        return objects;
     }
     
-    close();
+    // Served from idx_objects_page; blobs of other types are never read
+    QString sql = "SELECT data FROM objects WHERE page_id = ?";
+    if (!types.isEmpty()) {
+        QStringList placeholders;
+        for (int i = 0; i < types.size(); ++i) {
+            placeholders.append("?");
+        }
+        sql += " AND type IN (" + placeholders.join(", ") + ")";
+    }
+    sql += " ORDER BY rowid";
     
-    if (QFile::exists(m_databasePath)) {
-        QFile::remove(m_databasePath);
+    QSqlQuery query = prepareQuery(sql);
+    query.addBindValue(pageId);
+    for (Object::Type type : types) {
+        query.addBindValue(static_cast<int>(type));
     }
     
-    bool success = QFile::copy(backupPath, m_databasePath);
+    if (!query.exec()) {
+        emit databaseError("Failed to load objects: " + query.lastError().text());
+        return objects;
+    }
     
-    if (success) {
-        initialize(m_databasePath);
+    while (query.next()) {
+        if (auto object = BlobCodec::decodeObject(query.value(0).toByteArray())) {
+            object->setDirty(false);
+            objects.append(object);
+        }
     }
     
-    return success;
+    return objects;
 }
 
-bool Storage::updateDocumentMetadata(const QString &documentId, const QJsonObject &metadata)
+bool Storage::appendJournal(const QString &documentId, const QVector<JournalEntry> &entries)
 {
     if (!m_initialized || documentId.isEmpty()) {
         return false;
     }
     
+    beginTransaction();
+    
+    for (const JournalEntry &entry : entries) {
+        QSqlQuery insert = prepareQuery(
+            "INSERT INTO journal (document_id, page_id, object_id, operation, data) VALUES (?, ?, ?, ?, ?)"
+        );
+        insert.addBindValue(documentId);
+        insert.addBindValue(entry.pageId);
+        insert.addBindValue(entry.objectId);
+        insert.addBindValue(static_cast<int>(entry.operation));
+        insert.addBindValue(entry.data);
+        if (!insert.exec()) {
+            rollbackTransaction();
+            emit databaseError("Failed to append to journal: " + insert.lastError().text());
+            return false;
+        }
+    }
+    
+    return commitTransaction();
+}
+
+bool Storage::replayJournal(const QString &documentId)
+{
+    QVector<JournalEntry> entries;
+    QSqlQuery query = prepareQuery(
+        "SELECT page_id, object_id, operation, data FROM journal WHERE document_id = ? ORDER BY seq"
+    );
+    query.addBindValue(documentId);
+    if (!query.exec()) {
+        emit databaseError("Failed to read journal: " + query.lastError().text());
+        return false;
+    }
+    while (query.next()) {
+        JournalEntry entry;
+        entry.pageId = query.value(0).toString();
+        entry.objectId = query.value(1).toString();
+        entry.operation = static_cast<JournalEntry::Operation>(query.value(2).toInt());
+        entry.data = query.value(3).toByteArray();
+        entries.append(entry);
+    }
+    
+    if (entries.isEmpty()) {
+        return true;
+    }
+    
+    // Apply the entries to the stored pages; entries for pages that no
+    // longer exist are dropped
+    QHash<QString, std::shared_ptr<Page>> pages;
+    QStringList pageOrder;
+    for (const JournalEntry &entry : entries) {
+        if (!pages.contains(entry.pageId)) {
+            std::shared_ptr<Page> page;
+            QSqlQuery exists = prepareQuery("SELECT 1 FROM pages WHERE id = ?");
+            exists.addBindValue(entry.pageId);
+            if (exists.exec() && exists.next()) {
+                page = std::make_shared<Page>();
+                if (!decodePageRecord(loadPageRecord(entry.pageId), *page)) {
+                    page.reset();
+                }
+            }
+            pages.insert(entry.pageId, page);
+            pageOrder.append(entry.pageId);
+        }
+        
+        if (auto page = pages.value(entry.pageId)) {
+            entry.apply(*page);
+        }
+    }
+    
+    // Fold the changed pages into the snapshot and drop the entries together
+    beginTransaction();
+    
+    for (const QString &pageId : pageOrder) {
+        auto page = pages.value(pageId);
+        if (page && page->isDirty() && !savePage(documentId, snapshotPage(*page))) {
+            rollbackTransaction();
+            return false;
+        }
+    }
+    
+    QSqlQuery clear = prepareQuery("DELETE FROM journal WHERE document_id = ?");
+    clear.addBindValue(documentId);
+    if (!clear.exec()) {
+        rollbackTransaction();
+        emit databaseError("Failed to clear journal: " + clear.lastError().text());
+        return false;
+    }
+    
+    return commitTransaction();
+}
+
+std::shared_ptr<Page> Storage::loadPage(const QString &pageId)
+{
+    auto page = std::make_shared<Page>();
+    if (!decodePageRecord(loadPageRecord(pageId), *page)) {
+        return nullptr;
+    }
+    return page;
+}
+
+bool Storage::loadPage(std::shared_ptr<Page> page)
+{
+    if (!m_initialized || !page) {
+        return false;
+    }
+    
+    return decodePageRecord(loadPageRecord(page->id()), *page);
+}
+
+bool Storage::deletePage(const QString &pageId)
+{
+    if (!m_initialized || pageId.isEmpty()) {
+        return false;
+    }
+    
+    QSqlQuery objects = prepareQuery("DELETE FROM objects WHERE page_id = ?");
+    objects.addBindValue(pageId);
+    
+    if (!objects.exec()) {
+        emit databaseError("Failed to delete page objects: " + objects.lastError().text());
+        return false;
+    }
+    
+    QSqlQuery links = prepareQuery("DELETE FROM links WHERE from_page_id = ? OR to_page_id = ?");
+    links.addBindValue(pageId);
+    links.addBindValue(pageId);
+    
+    if (!links.exec()) {
+        emit databaseError("Failed to delete page links: " + links.lastError().text());
+        return false;
+    }
+    
+    QSqlQuery query = prepareQuery("DELETE FROM pages WHERE id = ?");
+    query.addBindValue(pageId);
+    
+    if (!query.exec()) {
+        emit databaseError("Failed to delete page: " + query.lastError().text());
+        return false;
+    }
+    
+    return removePageFromIndex(pageId);
+}
+
+QStringList Storage::searchDocuments(const QString &query)
+{
+    QStringList results;
+    
+    if (!m_initialized || query.isEmpty()) {
+        return results;
+    }
+    
+    QSqlQuery sqlQuery;
+    if (m_fullTextSearch) {
+        QString fullTextQuery = toFullTextQuery(query);
+        if (fullTextQuery.isEmpty()) {
+            return results;
+        }
+        
+        // Documents ranked by their best matching title, page or text object
+        sqlQuery = prepareQuery(
+            "SELECT e.document_id FROM "
+            "(SELECT rowid, rank FROM search_index WHERE search_index MATCH ?) AS hits "
+            "JOIN search_entries e ON e.id = hits.rowid "
+            "GROUP BY e.document_id ORDER BY MIN(hits.rank)"
+        );
+        sqlQuery.addBindValue(fullTextQuery);
+    } else {
+        sqlQuery = prepareQuery(
+            "SELECT id FROM documents WHERE title LIKE ? OR description LIKE ? OR EXISTS "
+            "(SELECT 1 FROM document_tags t WHERE t.document_id = documents.id AND t.tag LIKE ?)"
+        );
+        
+        QString searchPattern = "%" + query + "%";
+        sqlQuery.addBindValue(searchPattern);
+        sqlQuery.addBindValue(searchPattern);
+        sqlQuery.addBindValue(searchPattern);
+    }
+    
+    if (sqlQuery.exec()) {
+        while (sqlQuery.next()) {
+            results.append(sqlQuery.value(0).toString());
+        }
+    } else {
+        emit databaseError("Failed to search documents: " + sqlQuery.lastError().text());
+    }
+    
+    return results;
+}
+
+QVector<Storage::SearchHit> Storage::searchContent(const QString &query, int limit)
+{
+    QVector<SearchHit> results;
+    
+    if (!m_initialized || !m_fullTextSearch) {
+        return results;
+    }
+    
+    QString fullTextQuery = toFullTextQuery(query);
+    if (fullTextQuery.isEmpty()) {
+        return results;
+    }
+    
+    QSqlQuery sqlQuery = prepareQuery(
+        "SELECT e.document_id, e.page_id, e.object_id, hits.snippet, hits.rank FROM "
+        "(SELECT rowid, rank, snippet(search_index, 0, '[', ']', '...', 12) AS snippet "
+        " FROM search_index WHERE search_index MATCH ? ORDER BY rank LIMIT ?) AS hits "
+        "JOIN search_entries e ON e.id = hits.rowid "
+        "ORDER BY hits.rank"
+    );
+    sqlQuery.addBindValue(fullTextQuery);
+    sqlQuery.addBindValue(limit);
+    
+    if (sqlQuery.exec()) {
+        while (sqlQuery.next()) {
+            SearchHit hit;
+            hit.documentId = sqlQuery.value(0).toString();
+            hit.pageId = sqlQuery.value(1).toString();
+            hit.objectId = sqlQuery.value(2).toString();
+            hit.snippet = sqlQuery.value(3).toString();
+            hit.rank = sqlQuery.value(4).toDouble();
+            results.append(hit);
+        }
+    } else {
+        emit databaseError("Failed to search content: " + sqlQuery.lastError().text());
+    }
+    
+    return results;
+}
+
+QStringList Storage::findDocumentsByTag(const QString &tag)
+{
+    QStringList results;
+    
+    if (!m_initialized || tag.isEmpty()) {
+        return results;
+    }
+    
+    return findDocumentsByTags(QStringList{tag});
+}
+
+QStringList Storage::findDocumentsByTags(const QStringList &tags, TagMatch match)
+{
+    QStringList results;
+    QStringList normalized = normalizeTags(tags);
+    
+    if (!m_initialized || normalized.isEmpty()) {
+        return results;
+    }
+    
+    // Both forms are answered from idx_document_tags_tag without touching documents
+    QStringList placeholders;
+    for (int i = 0; i < normalized.size(); ++i) {
+        placeholders.append("?");
+    }
+    
+    QString sql = "SELECT document_id FROM document_tags WHERE tag IN (" + placeholders.join(", ") + ") "
+                  "GROUP BY document_id";
+    if (match == MatchAll) {
+        sql += " HAVING COUNT(*) = ?";
+    }
+    
+    QSqlQuery query = prepareQuery(sql);
+    for (const QString &tag : normalized) {
+        query.addBindValue(tag);
+    }
+    if (match == MatchAll) {
+        query.addBindValue(normalized.size());
+    }
+    
+    if (query.exec()) {
+        while (query.next()) {
+            results.append(query.value(0).toString());
+        }
+    } else {
+        emit databaseError("Failed to find documents by tag: " + query.lastError().text());
+    }
+    
+    return results;
+}
+
+QMap<QString, int> Storage::tagCounts()
+{
+    QMap<QString, int> results;
+    
+    if (!m_initialized) {
+        return results;
+    }
+    
+    QSqlQuery query = prepareQuery("SELECT tag, COUNT(*) FROM document_tags GROUP BY tag");
+    
+    if (query.exec()) {
+        while (query.next()) {
+            results.insert(query.value(0).toString(), query.value(1).toInt());
+        }
+    } else {
+        emit databaseError("Failed to count tags: " + query.lastError().text());
+    }
+    
+    return results;
+}
+
+QVector<Storage::Backlink> Storage::backlinks(const QString &pageId)
+{
+    QVector<Backlink> results;
+    
+    if (!m_initialized || pageId.isEmpty()) {
+        return results;
+    }
+    
+    // Served by idx_links_to; pages of every document are included
+    QSqlQuery query = prepareQuery(
+        "SELECT pages.document_id, pages.id, pages.title FROM links "
+        "JOIN pages ON pages.id = links.from_page_id "
+        "WHERE links.to_page_id = ?"
+    );
+    query.addBindValue(pageId);
+    
+    if (!query.exec()) {
+        emit databaseError("Failed to find backlinks: " + query.lastError().text());
+        return results;
+    }
+    while (query.next()) {
+        Backlink backlink;
+        backlink.documentId = query.value(0).toString();
+        backlink.pageId = query.value(1).toString();
+        backlink.pageTitle = query.value(2).toString();
+        results.append(backlink);
+    }
+    
+    return results;
+}
+
+QVector<QJsonObject> Storage::getRecentDocuments(int limit)
+{
+    QVector<QJsonObject> results;
+    
+    if (!m_initialized) {
+        return results;
+    }
+    
     QSqlQuery query = prepareQuery(
-        "INSERT OR REPLACE INTO metadata (document_id, key, value) VALUES (?, ?, ?)"
+        "SELECT id, title, description, modified_date FROM documents "
+        "ORDER BY modified_date DESC, id DESC LIMIT ?"
     );
+    query.addBindValue(limit);
+    
+    if (query.exec()) {
+        while (query.next()) {
+            QJsonObject doc;
+            doc["id"] = query.value(0).toString();
+            doc["title"] = query.value(1).toString();
+            doc["description"] = query.value(2).toString();
+            doc["modifiedDate"] = query.value(3).toString();
+            results.append(doc);
+        }
+    } else {
+        emit databaseError("Failed to get recent documents: " + query.lastError().text());
+    }
+    
+    return results;
+}
+
+bool Storage::createBackup(const QString &backupPath)
+{
+    if (!m_initialized || backupPath.isEmpty()) {
+        return false;
+    }
+    
+    // Copy into a side file so an existing backup survives a failed run
+    const QString partialPath = backupPath + ".partial";
+    QFile::remove(partialPath);
+    
+    if (!m_sharedSqlite) {
+        if (!vacuumInto(partialPath, lastChangeSeq())) {
+            QFile::remove(partialPath);
+            return false;
+        }
+        QFile::remove(backupPath);
+        return QFile::rename(partialPath, backupPath);
+    }
+    
+    sqlite3 *destination = nullptr;
+    if (sqlite3_open_v2(QFile::encodeName(partialPath).constData(), &destination,
+                        SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr) != SQLITE_OK) {
+        emit databaseError("Failed to create backup: " + QString::fromUtf8(sqlite3_errmsg(destination)));
+        sqlite3_close(destination);
+        return false;
+    }
+    
+    // The worker thread is the only writer, so the copy is a consistent snapshot
+    qint64 changeSeq = lastChangeSeq();
+    releaseStatements();
+    bool success = copyDatabase(nativeHandle(), destination);
+    
+    // Remember which changes the backup contains for later incremental runs
+    if (success) {
+        QByteArray state = QString(
+            "DROP TABLE IF EXISTS backup_state;"
+            "CREATE TABLE backup_state (generation INTEGER NOT NULL, change_seq INTEGER NOT NULL);"
+            "INSERT INTO backup_state VALUES (1, %1);"
+        ).arg(changeSeq).toUtf8();
+        success = sqlite3_exec(destination, state.constData(), nullptr, nullptr, nullptr) == SQLITE_OK;
+    }
+    sqlite3_close(destination);
+    
+    if (!success) {
+        QFile::remove(partialPath);
+        emit databaseError("Failed to create backup of " + m_databasePath);
+        return false;
+    }
+    
+    QFile::remove(backupPath);
+    return QFile::rename(partialPath, backupPath);
+}
+
+bool Storage::createIncrementalBackup(const QString &backupPath)
+{
+    if (!m_initialized || backupPath.isEmpty()) {
+        return false;
+    }
+    
+    if (!QFile::exists(backupPath)) {
+        return createBackup(backupPath);
+    }
+    
+    // Statements naming the attached database are not cached; the cache
+    // must not outlive the attachment
+    QSqlQuery attach(m_database);
+    attach.prepare("ATTACH DATABASE ? AS backup");
+    attach.addBindValue(backupPath);
+    if (!attach.exec()) {
+        emit databaseError("Failed to open backup: " + attach.lastError().text());
+        return false;
+    }
+    
+    auto detach = [this]() {
+        releaseStatements();
+        QSqlQuery(m_database).exec("DETACH DATABASE backup");
+    };
+    
+    // Only a backup with the same schema and a known generation can be updated in place
+    QSqlQuery state(m_database);
+    qint64 backupSeq = -1;
+    if (state.exec("SELECT change_seq FROM backup.backup_state") && state.next()) {
+        backupSeq = state.value(0).toLongLong();
+    }
+    state.finish();
+    
+    QSqlQuery versions(m_database);
+    bool sameSchema = versions.exec("PRAGMA backup.user_version") && versions.next() &&
+                      versions.value(0).toInt() == getCurrentVersion();
+    versions.finish();
+    
+    // Key column of every table the change log covers
+    static const QHash<QString, QString> keyColumns = {
+        {"documents", "id"},
+        {"pages", "id"},
+        {"objects", "id"},
+        {"document_tags", "document_id"},
+        {"metadata", "document_id"},
+        {"links", "from_page_id"},
+        {"codec_dictionaries", "id"}
+    };
+    
+    // The version alone misses a column added outside a version step, so the
+    // copied tables must also match column for column
+    QHash<QString, QString> columnLists;
+    for (auto it = keyColumns.constBegin(); sameSchema && it != keyColumns.constEnd(); ++it) {
+        const QStringList columns = tableColumns(it.key());
+        sameSchema = !columns.isEmpty() && columns == tableColumns(it.key(), "backup");
+        columnLists.insert(it.key(), columns.join(", "));
+    }
+    
+    if (backupSeq < 0 || !sameSchema) {
+        detach();
+        return createBackup(backupPath);
+    }
+    
+    QVector<QPair<QString, QString>> changes;
+    qint64 changeSeq = backupSeq;
+    QSqlQuery changed(m_database);
+    changed.prepare("SELECT seq, table_name, row_key FROM change_log WHERE seq > ? ORDER BY seq");
+    changed.addBindValue(backupSeq);
+    if (!changed.exec()) {
+        detach();
+        emit databaseError("Failed to read change log: " + changed.lastError().text());
+        return false;
+    }
+    while (changed.next()) {
+        changeSeq = changed.value(0).toLongLong();
+        changes.append(qMakePair(changed.value(1).toString(), changed.value(2).toString()));
+    }
+    changed.finish();
+    
+    beginTransaction();
+    
+    for (int i = 0; i < changes.size(); ++i) {
+        const QString &table = changes[i].first;
+        const QString key = keyColumns.value(table);
+        if (key.isEmpty()) {
+            continue;
+        }
+        
+        // Replace the backup's rows for this key with the live ones; a row
+        // deleted since the last generation simply is not copied back
+        QSqlQuery remove(m_database);
+        remove.prepare(QString("DELETE FROM backup.%1 WHERE %2 = ?").arg(table, key));
+        remove.addBindValue(changes[i].second);
+        
+        QSqlQuery copy(m_database);
+        copy.prepare(QString("INSERT INTO backup.%1 (%3) SELECT %3 FROM main.%1 WHERE %2 = ?")
+                         .arg(table, key, columnLists.value(table)));
+        copy.addBindValue(changes[i].second);
+        
+        if (!remove.exec() || !copy.exec()) {
+            rollbackTransaction();
+            detach();
+            emit databaseError("Failed to update backup: " + m_database.lastError().text());
+            return false;
+        }
+        
+        emit backupProgress(i + 1, changes.size());
+    }
+    
+    QSqlQuery generation(m_database);
+    generation.prepare("UPDATE backup.backup_state SET generation = generation + 1, change_seq = ?");
+    generation.addBindValue(changeSeq);
+    if (!generation.exec()) {
+        rollbackTransaction();
+        detach();
+        emit databaseError("Failed to update backup: " + generation.lastError().text());
+        return false;
+    }
+    
+    bool success = commitTransaction();
+    detach();
+    return success;
+}
+
+bool Storage::restoreFromBackup(const QString &backupPath)
+{
+    if (!m_initialized || !QFile::exists(backupPath)) {
+        return false;
+    }
+    
+    // Writing into the live connection needs the backup API on its handle
+    if (!m_sharedSqlite) {
+        emit databaseError("Failed to restore backup: Qt's SQLite driver does not use the "
+                           "system SQLite library, so the database cannot be restored in place");
+        return false;
+    }
+    
+    sqlite3 *source = nullptr;
+    if (sqlite3_open_v2(QFile::encodeName(backupPath).constData(), &source,
+                        SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK) {
+        emit databaseError("Failed to open backup: " + QString::fromUtf8(sqlite3_errmsg(source)));
+        sqlite3_close(source);
+        return false;
+    }
+    
+    // The live database is overwritten in place and only once the copy
+    // completes; until then it stays intact
+    m_statements.clear();
+    bool success = copyDatabase(source, nativeHandle());
+    sqlite3_close(source);
+    
+    if (!success) {
+        emit databaseError("Failed to restore backup " + backupPath);
+        return false;
+    }
+    
+    // Incremental generations do not carry the search index; rebuild it and
+    // bring an older backup up to the current schema
+    return executeQuery("DROP TABLE IF EXISTS backup_state") &&
+           createTables() &&
+           loadDictionaries() &&
+           migrateDatabase() &&
+           rebuildSearchIndex();
+}
+
+bool Storage::compactDatabase()
+{
+    if (!m_initialized) {
+        return false;
+    }
+    
+    if (!compressStoredBlobs()) {
+        return false;
+    }
+    
+    // VACUUM cannot run while a statement is active
+    releaseStatements();
+    return executeQuery("VACUUM");
+}
+
+bool Storage::loadDictionaries()
+{
+    // Registered dictionaries stay registered; the newest of this database becomes active
+    quint32 activeId = 0;
+    QSqlQuery query = prepareQuery("SELECT id, data FROM codec_dictionaries ORDER BY created_date, id");
+    if (!query.exec()) {
+        return false;
+    }
+    while (query.next()) {
+        QByteArray dictionary = query.value(1).toByteArray();
+        if (BlobCodec::addDictionary(dictionary)) {
+            activeId = query.value(0).toUInt();
+        }
+    }
+    
+    BlobCodec::setActiveDictionary(activeId);
+    return true;
+}
+
+bool Storage::hasDictionary()
+{
+    QSqlQuery query = prepareQuery("SELECT 1 FROM codec_dictionaries LIMIT 1");
+    return query.exec() && query.next();
+}
+
+bool Storage::trainDictionary()
+{
+    if (!BlobCodec::hasZstd()) {
+        return true;
+    }
+    
+    // Objects make up most of the stored bytes; sample them uncompressed
+    QVector<QByteArray> samples;
+    QSqlQuery query = prepareQuery("SELECT data FROM objects ORDER BY RANDOM() LIMIT 4000");
+    if (!query.exec()) {
+        emit databaseError("Failed to sample objects: " + query.lastError().text());
+        return false;
+    }
+    while (query.next()) {
+        samples.append(BlobCodec::payload(query.value(0).toByteArray()));
+    }
+    
+    // Too little data to train on is not an error; blobs compress without a dictionary
+    QByteArray dictionary = BlobCodec::trainDictionary(samples);
+    if (dictionary.isEmpty() || !BlobCodec::addDictionary(dictionary)) {
+        return true;
+    }
+    
+    quint32 id = BlobCodec::dictionaryId(dictionary);
+    QSqlQuery insert = prepareQuery(
+        "INSERT OR REPLACE INTO codec_dictionaries (id, created_date, data) VALUES (?, ?, ?)"
+    );
+    insert.addBindValue(id);
+    insert.addBindValue(QDateTime::currentDateTimeUtc().toString(Qt::ISODateWithMs));
+    insert.addBindValue(dictionary);
+    if (!insert.exec()) {
+        emit databaseError("Failed to store dictionary: " + insert.lastError().text());
+        return false;
+    }
+    
+    BlobCodec::setActiveDictionary(id);
+    return true;
+}
+
+bool Storage::recompressTable(const QString &table)
+{
+    QStringList ids;
+    QSqlQuery rows = prepareQuery(QString("SELECT id FROM %1").arg(table));
+    if (!rows.exec()) {
+        emit databaseError("Failed to read " + table + ": " + rows.lastError().text());
+        return false;
+    }
+    while (rows.next()) {
+        ids.append(rows.value(0).toString());
+    }
+    
+    // Rows whose blob comes out the same are left alone. The payload does not
+    // change, so neither does the content hash taken over it.
+    for (const QString &id : ids) {
+        QSqlQuery select = prepareQuery(QString("SELECT data FROM %1 WHERE id = ?").arg(table));
+        select.addBindValue(id);
+        if (!select.exec() || !select.next()) {
+            continue;
+        }
+        
+        QByteArray blob = select.value(0).toByteArray();
+        QByteArray recompressed = BlobCodec::recompress(blob);
+        if (recompressed == blob) {
+            continue;
+        }
+        
+        QSqlQuery update = prepareQuery(QString("UPDATE %1 SET data = ? WHERE id = ?").arg(table));
+        update.addBindValue(recompressed);
+        update.addBindValue(id);
+        if (!update.exec()) {
+            emit databaseError("Failed to recompress " + table + ": " + update.lastError().text());
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+bool Storage::updateDocumentMetadata(const QString &documentId, const QJsonObject &metadata)
+{
+    if (!m_initialized || documentId.isEmpty()) {
+        return false;
+    }
+    
+    QHash<QString, QJsonObject> batch;
+    batch.insert(documentId, metadata);
+    return updateDocumentMetadata(batch);
+}
+
+QJsonObject Storage::getDocumentMetadata(const QString &documentId)
+{
+    if (!m_initialized || documentId.isEmpty()) {
+        return QJsonObject();
+    }
+    
+    return getDocumentMetadata(QStringList{documentId}).value(documentId);
+}
+
+bool Storage::updateDocumentMetadata(const QHash<QString, QJsonObject> &metadata)
+{
+    if (!m_initialized) {
+        return false;
+    }
+    
+    QVariantList values;
+    for (auto document = metadata.begin(); document != metadata.end(); ++document) {
+        if (document.key().isEmpty()) {
+            continue;
+        }
+        for (auto it = document->begin(); it != document->end(); ++it) {
+            values << document.key() << it.key() << it.value().toString();
+        }
+    }
+    
+    if (values.isEmpty()) {
+        return true;
+    }
+    
+    // Multi-row inserts inside one transaction: one commit for every key
+    const int columns = 3;
+    const int rowsPerStatement = MaxBindValues / columns;
+    const int rows = values.size() / columns;
+    
+    beginTransaction();
+    
+    for (int first = 0; first < rows; first += rowsPerStatement) {
+        const int count = qMin(rowsPerStatement, rows - first);
+        QSqlQuery query = prepareQuery(
+            "INSERT OR REPLACE INTO metadata (document_id, key, value) VALUES " + placeholderRows(count, columns)
+        );
+        for (int i = first * columns; i < (first + count) * columns; ++i) {
+            query.addBindValue(values.at(i));
+        }
+        
+        if (!query.exec()) {
+            rollbackTransaction();
+            emit databaseError("Failed to update metadata: " + query.lastError().text());
+            return false;
+        }
+    }
+    
+    return commitTransaction();
+}
+
+QHash<QString, QJsonObject> Storage::getDocumentMetadata(const QStringList &documentIds)
+{
+    QHash<QString, QJsonObject> metadata;
+    
+    if (!m_initialized) {
+        return metadata;
+    }
+    
+    // Every requested document gets an entry, empty if it has no metadata
+    QStringList ids;
+    for (const QString &documentId : documentIds) {
+        if (!documentId.isEmpty() && !metadata.contains(documentId)) {
+            metadata.insert(documentId, QJsonObject());
+            ids.append(documentId);
+        }
+    }
+    
+    // One query per batch of ids, each a lookup on the primary key
+    for (int first = 0; first < ids.size(); first += MaxBindValues) {
+        const QStringList batch = ids.mid(first, MaxBindValues);
+        QSqlQuery query = prepareQuery(
+            "SELECT document_id, key, value FROM metadata WHERE document_id IN (" + placeholderRows(batch.size(), 1) + ")"
+        );
+        for (const QString &documentId : batch) {
+            query.addBindValue(documentId);
+        }
+        
+        if (!query.exec()) {
+            emit databaseError("Failed to get metadata: " + query.lastError().text());
+            return metadata;
+        }
+        while (query.next()) {
+            metadata[query.value(0).toString()][query.value(1).toString()] = query.value(2).toString();
+        }
+    }
+    
+    return metadata;
+}
+
+int Storage::getDocumentCount() const
+{
+    if (!m_initialized) {
+        return 0;
+    }
+    
+    QSqlQuery query = prepareQuery("SELECT COUNT(*) FROM documents");
+    if (query.exec() && query.next()) {
+        return query.value(0).toInt();
+    }
+    
+    return 0;
+}
+
+int Storage::getPageCount() const
+{
+    if (!m_initialized) {
+        return 0;
+    }
+    
+    QSqlQuery query = prepareQuery("SELECT COUNT(*) FROM pages");
+    if (query.exec() && query.next()) {
+        return query.value(0).toInt();
+    }
+    
+    return 0;
+}
+
+qint64 Storage::getDatabaseSize() const
+{
+    QFileInfo fileInfo(m_databasePath);
+    return fileInfo.size();
+}
+
+bool Storage::createTables()
+{
+    return createDocumentTable() && 
+           createPageTable() && 
+           createObjectTable() && 
+           createMetadataTable() && 
+           createLinksTable() &&
+           createSearchTables() &&
+           createTagTable() &&
+           createDictionaryTable() &&
+           createJournalTable() &&
+           createChangeLog();
+}
+
+bool Storage::createDocumentTable()
+{
+    QString query = R"(
+        CREATE TABLE IF NOT EXISTS documents (
+            id TEXT PRIMARY KEY,
+            title TEXT NOT NULL,
+            description TEXT,
+            created_date TEXT NOT NULL,
+            modified_date TEXT NOT NULL,
+            tags TEXT,
+            page_count INTEGER NOT NULL DEFAULT 0,
+            data BLOB NOT NULL
+        )
+    )";
+    
+    return executeQuery(query);
+}
+
+bool Storage::createPageTable()
+{
+    QString query = R"(
+        CREATE TABLE IF NOT EXISTS pages (
+            id TEXT PRIMARY KEY,
+            document_id TEXT NOT NULL,
+            title TEXT NOT NULL,
+            position TEXT NOT NULL DEFAULT '',
+            data BLOB NOT NULL,
+            hash BLOB,
+            FOREIGN KEY (document_id) REFERENCES documents (id) ON DELETE CASCADE
+        )
+    )";
+    
+    return executeQuery(query);
+}
+
+bool Storage::createObjectTable()
+{
+    QString query = R"(
+        CREATE TABLE IF NOT EXISTS objects (
+            id TEXT PRIMARY KEY,
+            page_id TEXT NOT NULL,
+            type INTEGER NOT NULL,
+            data BLOB NOT NULL,
+            hash BLOB,
+            FOREIGN KEY (page_id) REFERENCES pages (id) ON DELETE CASCADE
+        )
+    )";
+    
+    return executeQuery(query) &&
+           executeQuery("CREATE INDEX IF NOT EXISTS idx_objects_page ON objects (page_id, type)");
+}
+
+bool Storage::createMetadataTable()
+{
+    QString query = R"(
+        CREATE TABLE IF NOT EXISTS metadata (
+            document_id TEXT NOT NULL,
+            key TEXT NOT NULL,
+            value TEXT NOT NULL,
+            PRIMARY KEY (document_id, key),
+            FOREIGN KEY (document_id) REFERENCES documents (id) ON DELETE CASCADE
+        )
+    )";
+    
+    return executeQuery(query);
+}
+
+bool Storage::createLinksTable()
+{
+    QString query = R"(
+        CREATE TABLE IF NOT EXISTS links (
+            from_page_id TEXT NOT NULL,
+            to_page_id TEXT NOT NULL,
+            PRIMARY KEY (from_page_id, to_page_id),
+            FOREIGN KEY (from_page_id) REFERENCES pages (id) ON DELETE CASCADE,
+            FOREIGN KEY (to_page_id) REFERENCES pages (id) ON DELETE CASCADE
+        )
+    )";
+    
+    // The primary key serves outgoing links; backlinks need the reverse index
+    return executeQuery(query) &&
+           executeQuery("CREATE INDEX IF NOT EXISTS idx_links_to ON links (to_page_id, from_page_id)");
+}
+
+bool Storage::createSearchTables()
+{
+    // Maps full-text rows back to their document, page and object. Indexed so a
+    // page's entries can be replaced without scanning the full-text table.
+    QString query = R"(
+        CREATE TABLE IF NOT EXISTS search_entries (
+            id INTEGER PRIMARY KEY,
+            document_id TEXT NOT NULL,
+            page_id TEXT NOT NULL,
+            object_id TEXT NOT NULL
+        )
+    )";
+    
+    if (!executeQuery(query) ||
+        !executeQuery("CREATE INDEX IF NOT EXISTS idx_search_entries_page ON search_entries (page_id)") ||
+        !executeQuery("CREATE INDEX IF NOT EXISTS idx_search_entries_document ON search_entries (document_id)")) {
+        return false;
+    }
+    
+    // FTS5 is optional in SQLite builds; without it search falls back to LIKE
+    QSqlQuery fullText(m_database);
+    m_fullTextSearch = fullText.exec(
+        "CREATE VIRTUAL TABLE IF NOT EXISTS search_index USING fts5(content)"
+    );
+    if (!m_fullTextSearch) {
+        qWarning() << "Full-text search unavailable:" << fullText.lastError().text();
+    }
+    
+    return true;
+}
+
+bool Storage::createTagTable()
+{
+    // One row per document and tag; the tag-first index serves tag lookups and counts
+    QString query = R"(
+        CREATE TABLE IF NOT EXISTS document_tags (
+            document_id TEXT NOT NULL,
+            tag TEXT NOT NULL,
+            PRIMARY KEY (document_id, tag),
+            FOREIGN KEY (document_id) REFERENCES documents (id) ON DELETE CASCADE
+        ) WITHOUT ROWID
+    )";
+    
+    return executeQuery(query) &&
+           executeQuery("CREATE INDEX IF NOT EXISTS idx_document_tags_tag ON document_tags (tag, document_id)");
+}
+
+bool Storage::createDictionaryTable()
+{
+    // zstd dictionaries keyed by the id recorded in every frame written with them.
+    // Rows are never deleted while blobs may still reference them.
+    QString query = R"(
+        CREATE TABLE IF NOT EXISTS codec_dictionaries (
+            id INTEGER PRIMARY KEY,
+            created_date TEXT NOT NULL,
+            data BLOB NOT NULL
+        )
+    )";
+    
+    return executeQuery(query);
+}
+
+bool Storage::createJournalTable()
+{
+    // Not covered by the change log: entries are folded into snapshots and removed
+    QString query = R"(
+        CREATE TABLE IF NOT EXISTS journal (
+            seq INTEGER PRIMARY KEY AUTOINCREMENT,
+            document_id TEXT NOT NULL,
+            page_id TEXT NOT NULL,
+            object_id TEXT NOT NULL,
+            operation INTEGER NOT NULL,
+            data BLOB
+        )
+    )";
+    
+    return executeQuery(query) &&
+           executeQuery("CREATE INDEX IF NOT EXISTS idx_journal_document ON journal (document_id, seq)");
+}
+
+bool Storage::createChangeLog()
+{
+    // One row per changed key, bumped to a new sequence number on every
+    // write, so the log stays as small as the tables it covers
+    QString query = R"(
+        CREATE TABLE IF NOT EXISTS change_log (
+            seq INTEGER PRIMARY KEY AUTOINCREMENT,
+            table_name TEXT NOT NULL,
+            row_key TEXT NOT NULL,
+            UNIQUE (table_name, row_key)
+        )
+    )";
+    
+    if (!executeQuery(query)) {
+        return false;
+    }
+    
+    const QList<QPair<QString, QString>> tables = {
+        {"documents", "id"},
+        {"pages", "id"},
+        {"objects", "id"},
+        {"document_tags", "document_id"},
+        {"metadata", "document_id"},
+        {"links", "from_page_id"},
+        {"codec_dictionaries", "id"}
+    };
+    
+    for (const auto &table : tables) {
+        const QString record = "INSERT OR REPLACE INTO change_log (table_name, row_key) VALUES ('%1', %2.%3);";
+        const QString name = table.first;
+        const QString key = table.second;
+        
+        if (!executeQuery(QString("CREATE TRIGGER IF NOT EXISTS %1_changed_insert AFTER INSERT ON %1 BEGIN %2 END")
+                              .arg(name, record.arg(name, "NEW", key))) ||
+            !executeQuery(QString("CREATE TRIGGER IF NOT EXISTS %1_changed_update AFTER UPDATE ON %1 BEGIN %2 END")
+                              .arg(name, record.arg(name, "NEW", key))) ||
+            !executeQuery(QString("CREATE TRIGGER IF NOT EXISTS %1_changed_delete AFTER DELETE ON %1 BEGIN %2 END")
+                              .arg(name, record.arg(name, "OLD", key)))) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+bool Storage::writeDocumentTags(const QString &documentId, const QStringList &tags)
+{
+    QSqlQuery clear = prepareQuery("DELETE FROM document_tags WHERE document_id = ?");
+    clear.addBindValue(documentId);
+    if (!clear.exec()) {
+        emit databaseError("Failed to save document tags: " + clear.lastError().text());
+        return false;
+    }
+    
+    for (const QString &tag : normalizeTags(tags)) {
+        QSqlQuery insert = prepareQuery("INSERT INTO document_tags (document_id, tag) VALUES (?, ?)");
+        insert.addBindValue(documentId);
+        insert.addBindValue(tag);
+        if (!insert.exec()) {
+            emit databaseError("Failed to save document tags: " + insert.lastError().text());
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+bool Storage::writeDocumentLinks(const QString &documentId, const QVector<QPair<QString, QString>> &links)
+{
+    // Links are keyed by their source page, so the document's set is replaced through its pages
+    QSqlQuery clear = prepareQuery(
+        "DELETE FROM links WHERE from_page_id IN (SELECT id FROM pages WHERE document_id = ?)"
+    );
+    clear.addBindValue(documentId);
+    if (!clear.exec()) {
+        emit databaseError("Failed to save document links: " + clear.lastError().text());
+        return false;
+    }
+    
+    for (const auto &link : links) {
+        QSqlQuery insert = prepareQuery("INSERT OR IGNORE INTO links (from_page_id, to_page_id) VALUES (?, ?)");
+        insert.addBindValue(link.first);
+        insert.addBindValue(link.second);
+        if (!insert.exec()) {
+            emit databaseError("Failed to save document links: " + insert.lastError().text());
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+QStringList Storage::normalizeTags(const QStringList &tags)
+{
+    QStringList normalized;
+    for (const QString &tag : tags) {
+        QString trimmed = tag.trimmed();
+        if (!trimmed.isEmpty() && !normalized.contains(trimmed)) {
+            normalized.append(trimmed);
+        }
+    }
+    return normalized;
+}
+
+bool Storage::indexPage(const QString &documentId, const PageSnapshot &snapshot)
+{
+    if (!m_fullTextSearch) {
+        return true;
+    }
+    
+    // Replace the title entry and the entries of the objects in the snapshot;
+    // entries of unchanged objects stay as they are
+    if (snapshot.replaceObjects) {
+        if (!removePageFromIndex(snapshot.id)) {
+            return false;
+        }
+    } else {
+        QStringList staleIds = snapshot.removedObjectIds;
+        staleIds.append(QString(""));
+        for (const auto &object : snapshot.objects) {
+            staleIds.append(object.id);
+        }
+        
+        for (const QString &objectId : staleIds) {
+            QSqlQuery removeText = prepareQuery(
+                "DELETE FROM search_index WHERE rowid IN "
+                "(SELECT id FROM search_entries WHERE page_id = ? AND object_id = ?)"
+            );
+            removeText.addBindValue(snapshot.id);
+            removeText.addBindValue(objectId);
+            
+            QSqlQuery removeEntries = prepareQuery(
+                "DELETE FROM search_entries WHERE page_id = ? AND object_id = ?"
+            );
+            removeEntries.addBindValue(snapshot.id);
+            removeEntries.addBindValue(objectId);
+            
+            if (!removeText.exec() || !removeEntries.exec()) {
+                emit databaseError("Failed to update search index: " + getLastError());
+                return false;
+            }
+        }
+    }
+    
+    if (!addIndexEntry(documentId, snapshot.id, QString(), snapshot.title)) {
+        return false;
+    }
+    
+    for (const auto &object : snapshot.objects) {
+        if (!object.text.isEmpty() &&
+            !addIndexEntry(documentId, snapshot.id, object.id, object.text)) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+bool Storage::indexDocumentMetadata(const QString &documentId, const QString &title,
+                                    const QString &description, const QStringList &tags)
+{
+    if (!m_fullTextSearch) {
+        return true;
+    }
+    
+    QSqlQuery removeText = prepareQuery(
+        "DELETE FROM search_index WHERE rowid IN "
+        "(SELECT id FROM search_entries WHERE document_id = ? AND page_id = '')"
+    );
+    removeText.addBindValue(documentId);
+    
+    QSqlQuery removeEntries = prepareQuery(
+        "DELETE FROM search_entries WHERE document_id = ? AND page_id = ''"
+    );
+    removeEntries.addBindValue(documentId);
+    
+    if (!removeText.exec() || !removeEntries.exec()) {
+        emit databaseError("Failed to update search index: " + getLastError());
+        return false;
+    }
+    
+    QStringList content{title, description, tags.join(' ')};
+    return addIndexEntry(documentId, QString(), QString(), content.join('\n'));
+}
+
+bool Storage::removePageFromIndex(const QString &pageId)
+{
+    if (!m_fullTextSearch) {
+        return true;
+    }
+    
+    QSqlQuery removeText = prepareQuery(
+        "DELETE FROM search_index WHERE rowid IN (SELECT id FROM search_entries WHERE page_id = ?)"
+    );
+    removeText.addBindValue(pageId);
+    
+    QSqlQuery removeEntries = prepareQuery("DELETE FROM search_entries WHERE page_id = ?");
+    removeEntries.addBindValue(pageId);
+    
+    if (!removeText.exec() || !removeEntries.exec()) {
+        emit databaseError("Failed to update search index: " + getLastError());
+        return false;
+    }
+    
+    return true;
+}
+
+bool Storage::removeDocumentFromIndex(const QString &documentId)
+{
+    if (!m_fullTextSearch) {
+        return true;
+    }
+    
+    QSqlQuery removeText = prepareQuery(
+        "DELETE FROM search_index WHERE rowid IN (SELECT id FROM search_entries WHERE document_id = ?)"
+    );
+    removeText.addBindValue(documentId);
+    
+    QSqlQuery removeEntries = prepareQuery("DELETE FROM search_entries WHERE document_id = ?");
+    removeEntries.addBindValue(documentId);
+    
+    if (!removeText.exec() || !removeEntries.exec()) {
+        emit databaseError("Failed to update search index: " + getLastError());
+        return false;
+    }
+    
+    return true;
+}
+
+bool Storage::addIndexEntry(const QString &documentId, const QString &pageId,
+                            const QString &objectId, const QString &content)
+{
+    QSqlQuery entry = prepareQuery(
+        "INSERT INTO search_entries (document_id, page_id, object_id) VALUES (?, ?, ?)"
+    );
+    entry.addBindValue(documentId);
+    entry.addBindValue(pageId.isNull() ? QString("") : pageId);
+    entry.addBindValue(objectId.isNull() ? QString("") : objectId);
+    
+    if (!entry.exec()) {
+        emit databaseError("Failed to update search index: " + entry.lastError().text());
+        return false;
+    }
+    
+    QSqlQuery text = prepareQuery("INSERT INTO search_index (rowid, content) VALUES (?, ?)");
+    text.addBindValue(entry.lastInsertId());
+    text.addBindValue(content);
+    
+    if (!text.exec()) {
+        emit databaseError("Failed to update search index: " + text.lastError().text());
+        return false;
+    }
+    
+    return true;
+}
+
+QString Storage::toFullTextQuery(const QString &text)
+{
+    // Quote every term so user input cannot inject FTS syntax; the last term
+    // matches as a prefix so results update while typing
+    QStringList terms;
+    const QStringList words = text.split(QRegularExpression("\\s+"), Qt::SkipEmptyParts);
+    for (QString word : words) {
+        word.replace('"', "\"\"");
+        terms.append(QString("\"%1\"").arg(word));
+    }
+    
+    if (!terms.isEmpty()) {
+        terms.last().append('*');
+    }
+    
+    return terms.join(' ');
+}
+
+bool Storage::addColumn(const QString &table, const QString &column, const QString &definition)
+{
+    if (columnExists(table, column)) {
+        return true;
+    }
+    return executeQuery(QString("ALTER TABLE %1 ADD COLUMN %2 %3").arg(table, column, definition));
+}
+
+bool Storage::columnExists(const QString &table, const QString &column)
+{
+    QSqlQuery query(m_database);
+    if (!query.exec("PRAGMA table_info(" + table + ")")) {
+        return false;
+    }
+    
+    while (query.next()) {
+        if (query.value(1).toString() == column) {
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+QStringList Storage::tableColumns(const QString &table, const QString &schema)
+{
+    QStringList columns;
+    QSqlQuery query(m_database);
+    if (!query.exec(QString("PRAGMA %1.table_info(%2)").arg(schema, table))) {
+        return columns;
+    }
+    
+    while (query.next()) {
+        columns.append(query.value(1).toString());
+    }
+    
+    return columns;
+}
+
+bool Storage::executeQuery(const QString &query, const QVariantList &params)
+{
+    // Schema changes, maintenance and pragmas run once, so they are prepared
+    // fresh rather than kept in the statement cache
+    QSqlQuery sqlQuery(m_database);
+    sqlQuery.prepare(query);
+    
+    for (const QVariant &param : params) {
+        sqlQuery.addBindValue(param);
+    }
+    
+    bool success = sqlQuery.exec();
+    if (!success) {
+        emit databaseError("Query failed: " + sqlQuery.lastError().text());
+    }
+    
+    return success;
+}
+
+QSqlQuery Storage::prepareQuery(const QString &query) const
+{
+    if (!m_tuningEnabled) {
+        QSqlQuery sqlQuery(m_database);
+        sqlQuery.prepare(query);
+        return sqlQuery;
+    }
+    
+    // Copies of a QSqlQuery share one prepared statement, so handing out the
+    // cached one reuses it. Positional bind values restart after every exec();
+    // finish() drops any unread rows from the previous use. The same SQL text
+    // must not be reused while an earlier copy is still being iterated.
+    auto it = m_statements.find(query);
+    if (it != m_statements.end()) {
+        it->finish();
+        return *it;
+    }
+    
+    QSqlQuery sqlQuery(m_database);
+    if (sqlQuery.prepare(query)) {
+        m_statements.insert(query, sqlQuery);
+    }
+    return sqlQuery;
+}
+
+void Storage::releaseStatements() const
+{
+    // Open read cursors would keep the transaction from ending cleanly
+    for (auto it = m_statements.begin(); it != m_statements.end(); ++it) {
+        it->finish();
+    }
+}
+
+bool Storage::applyPragmas()
+{
+    // WAL lets readers run alongside the writer and makes commits an append;
+    // with WAL, synchronous=NORMAL only gives up durability of the last
+    // commits on power loss, never consistency
+    QSqlQuery pragma(m_database);
+    return pragma.exec("PRAGMA journal_mode = WAL") &&
+           pragma.exec("PRAGMA synchronous = NORMAL") &&
+           pragma.exec("PRAGMA cache_size = -16384") &&      // 16 MiB page cache
+           pragma.exec("PRAGMA mmap_size = 268435456") &&    // map up to 256 MiB
+           pragma.exec("PRAGMA temp_store = MEMORY");
+}
+
+QString Storage::getLastError() const
+{
+    return m_database.lastError().text();
+}
+
+sqlite3 *Storage::nativeHandle() const
+{
+    // QSQLITE hands out its connection as a "sqlite3*" QVariant; a handle of
+    // another SQLite library must never reach the functions linked here
+    QVariant handle = m_database.driver()->handle();
+    if (m_sharedSqlite && handle.isValid() && qstrcmp(handle.typeName(), "sqlite3*") == 0) {
+        return *static_cast<sqlite3 *const *>(handle.data());
+    }
+    return nullptr;
+}
+
+bool Storage::usesLinkedSqlite()
+{
+    // Asked through the driver, so nothing of its library is called directly.
+    // Two copies of the very same build cannot be told apart this way and
+    // are taken to be one library.
+    QSqlQuery query(m_database);
+    if (!query.exec("SELECT sqlite_version(), sqlite_source_id()") || !query.next()) {
+        return false;
+    }
+    if (query.value(0).toString() != QString::fromUtf8(sqlite3_libversion()) ||
+        query.value(1).toString() != QString::fromUtf8(sqlite3_sourceid())) {
+        return false;
+    }
+    query.finish();
+    
+    QStringList driverOptions;
+    if (!query.exec("PRAGMA compile_options")) {
+        return false;
+    }
+    while (query.next()) {
+        driverOptions.append(query.value(0).toString());
+    }
+    
+    QStringList linkedOptions;
+    for (int i = 0; sqlite3_compileoption_get(i); ++i) {
+        linkedOptions.append(QString::fromUtf8(sqlite3_compileoption_get(i)));
+    }
+    return driverOptions == linkedOptions;
+}
+
+bool Storage::copyDatabase(sqlite3 *source, sqlite3 *destination)
+{
+    if (!source || !destination) {
+        return false;
+    }
+    
+    const int pagesPerStep = 256;
+    const int busyRetryMs = 25;
+    
+    sqlite3_backup *backup = sqlite3_backup_init(destination, "main", source, "main");
+    if (!backup) {
+        emit databaseError("Failed to start backup: " + QString::fromUtf8(sqlite3_errmsg(destination)));
+        return false;
+    }
+    
+    // Copy in steps so progress can be reported and other connections are
+    // not locked out for the whole copy
+    int result = SQLITE_OK;
+    do {
+        result = sqlite3_backup_step(backup, pagesPerStep);
+        int total = sqlite3_backup_pagecount(backup);
+        emit backupProgress(total - sqlite3_backup_remaining(backup), total);
+        
+        if (result == SQLITE_BUSY || result == SQLITE_LOCKED) {
+            sqlite3_sleep(busyRetryMs);
+        }
+    } while (result == SQLITE_OK || result == SQLITE_BUSY || result == SQLITE_LOCKED);
+    
+    sqlite3_backup_finish(backup);
+    return result == SQLITE_DONE;
+}
+
+bool Storage::vacuumInto(const QString &path, qint64 changeSeq)
+{
+    // One statement through the driver, so progress is only reported at the end
+    releaseStatements();
+    QSqlQuery vacuum(m_database);
+    vacuum.prepare("VACUUM INTO ?");
+    vacuum.addBindValue(path);
+    if (!vacuum.exec()) {
+        emit databaseError("Failed to create backup: " + vacuum.lastError().text());
+        return false;
+    }
+    emit backupProgress(1, 1);
+    
+    QSqlQuery attach(m_database);
+    attach.prepare("ATTACH DATABASE ? AS backup");
+    attach.addBindValue(path);
+    if (!attach.exec()) {
+        emit databaseError("Failed to create backup: " + attach.lastError().text());
+        return false;
+    }
+    
+    // Remember which changes the backup contains for later incremental runs
+    QSqlQuery state(m_database);
+    bool success = state.exec("DROP TABLE IF EXISTS backup.backup_state") &&
+                   state.exec("CREATE TABLE backup.backup_state "
+                              "(generation INTEGER NOT NULL, change_seq INTEGER NOT NULL)");
+    if (success) {
+        state.prepare("INSERT INTO backup.backup_state VALUES (1, ?)");
+        state.addBindValue(changeSeq);
+        success = state.exec();
+    }
+    if (!success) {
+        emit databaseError("Failed to create backup: " + state.lastError().text());
+    }
+    state.finish();
+    
+    QSqlQuery(m_database).exec("DETACH DATABASE backup");
+    return success;
+}
+
+qint64 Storage::lastChangeSeq()
+{
+    QSqlQuery query = prepareQuery("SELECT COALESCE(MAX(seq), 0) FROM change_log");
+    if (query.exec() && query.next()) {
+        return query.value(0).toLongLong();
+    }
+    return 0;
+}
+
+bool Storage::beginTransaction()
+{
+    return m_database.transaction();
+}
+
+bool Storage::commitTransaction()
+{
+    releaseStatements();
+    return m_database.commit();
+}
+
+bool Storage::rollbackTransaction()
+{
+    releaseStatements();
+    return m_database.rollback();
+}
+
+QByteArray Storage::documentToBlob(std::shared_ptr<Document> document)
+{
+    return BlobCodec::encodeManifest(*document);
+}
+
+std::shared_ptr<Document> Storage::documentFromBlob(const QByteArray &blob, LoadMode mode)
+{
+    auto document = std::make_shared<Document>();
+    bool hasPageContent = false;
+    if (!BlobCodec::decodeDocument(blob, *document, &hasPageContent)) {
+        return nullptr;
+    }
+    
+    if (!hasPageContent) {
+        if (!loadPagePositions(*document)) {
+            return nullptr;
+        }
+        
+        if (mode == LoadLazy) {
+            // Pages stay stubs until the document asks for them
+            QPointer<Storage> storage(this);
+            document->setPageLoader([storage](std::shared_ptr<Page> page) {
+                return storage && storage->loadPage(page);
+            });
+            document->ensurePageLoaded(document->currentPage());
+        } else if (!loadDocumentPages(document)) {
+            return nullptr;
+        }
+    }
+    
+    document->markSaved();
+    return document;
+}
+
+QByteArray Storage::pageToBlob(std::shared_ptr<Page> page)
+{
+    return BlobCodec::encodePage(*page);
+}
+
+std::shared_ptr<Page> Storage::pageFromBlob(const QByteArray &blob)
+{
+    PageRecord record;
+    record.data = blob;
+    
+    auto page = std::make_shared<Page>();
+    if (!decodePageRecord(record, *page)) {
+        return nullptr;
+    }
+    return page;
+}
+
+bool Storage::loadPagePositions(Document &document)
+{
+    // Page order comes from the position column, read through idx_pages_document
+    QSqlQuery query = prepareQuery("SELECT id, position FROM pages WHERE document_id = ? ORDER BY position");
+    query.addBindValue(document.id());
+    
+    if (!query.exec()) {
+        emit databaseError("Failed to load page order: " + query.lastError().text());
+        return false;
+    }
+    
+    QHash<QString, QString> positions;
+    while (query.next()) {
+        positions.insert(query.value(0).toString(), query.value(1).toString());
+    }
+    document.restorePagePositions(positions);
+    return true;
+}
+
+bool Storage::loadDocumentPages(std::shared_ptr<Document> document)
+{
+    // Two queries for the whole document: page headers, then every object
+    QHash<QString, PageRecord> records;
+    
+    QSqlQuery query = prepareQuery("SELECT id, data FROM pages WHERE document_id = ?");
+    query.addBindValue(document->id());
+    
+    if (!query.exec()) {
+        emit databaseError("Failed to load document pages: " + query.lastError().text());
+        return false;
+    }
+    while (query.next()) {
+        records[query.value(0).toString()].data = query.value(1).toByteArray();
+    }
+    
+    QSqlQuery objects = prepareQuery(
+        "SELECT o.page_id, o.data FROM objects o JOIN pages p ON p.id = o.page_id "
+        "WHERE p.document_id = ? ORDER BY o.rowid"
+    );
+    objects.addBindValue(document->id());
+    
+    if (!objects.exec()) {
+        emit databaseError("Failed to load document objects: " + objects.lastError().text());
+        return false;
+    }
+    while (objects.next()) {
+        auto record = records.find(objects.value(0).toString());
+        if (record != records.end() && BlobCodec::isPageHeader(record->data)) {
+            record->objects.append(objects.value(1).toByteArray());
+        }
+    }
+    
+    // The objects of every page are decoded in one parallel pass; the pages
+    // themselves are filled in on this thread, which owns them
+    QVector<std::shared_ptr<Page>> pages;
+    QVector<QByteArray> blobs;
+    QVector<int> firstObject;
+    for (const auto &page : document->pages()) {
+        auto record = records.constFind(page->id());
+        if (record != records.constEnd() && !record->data.isEmpty()) {
+            pages.append(page);
+            firstObject.append(blobs.size());
+            blobs += record->objects;
+        }
+    }
+    firstObject.append(blobs.size());
+    
+    const QVector<std::shared_ptr<Object>> objects = decodeObjects(blobs);
+    for (int i = 0; i < pages.size(); ++i) {
+        fillPage(records.value(pages[i]->id()).data,
+                 objects.mid(firstObject[i], firstObject[i + 1] - firstObject[i]), *pages[i]);
+    }
+    
+    return true;
+}
+
+bool Storage::migrateDatabase()
+{
+    int currentVersion = getCurrentVersion();
+    
+    // Content hashes need no backfill; a missing hash never matches. The
+    // columns are added before any migration because migrations save pages;
+    // version 10 below records them.
+    if (!addColumn("pages", "hash", "BLOB") || !addColumn("objects", "hash", "BLOB")) {
+        return false;
+    }
+    
+    // Version 1: initial schema
+    if (currentVersion < 1 && !setCurrentVersion(1)) {
+        return false;
+    }
+    
+    // Version 2: page and manifest blobs use the binary encoding
+    if (currentVersion < 2) {
+        if (!migrateBlobsToBinary() || !setCurrentVersion(2)) {
+            return false;
+        }
+    }
+    
+    // Version 3: full-text index over existing documents and pages
+    if (currentVersion < 3) {
+        if (!rebuildSearchIndex() || !setCurrentVersion(3)) {
+            return false;
+        }
+    }
+    
+    // Version 4: tags move from the comma-joined column to document_tags
+    if (currentVersion < 4) {
+        if (!migrateTagsToTable() || !setCurrentVersion(4)) {
+            return false;
+        }
+    }
+    
+    // Version 5: page_count column and a modified-date index for the catalog
+    if (currentVersion < 5) {
+        if (!addPageCountColumn() || !setCurrentVersion(5)) {
+            return false;
+        }
+    }
+    
+    // Version 6: objects move out of page blobs into the objects table
+    if (currentVersion < 6) {
+        if (!migratePagesToObjectRows() || !setCurrentVersion(6)) {
+            return false;
+        }
+    }
+    
+    // Version 7: stored blobs are compressed, then the freed pages are returned
+    if (currentVersion < 7) {
+        if (!compressStoredBlobs() || !setCurrentVersion(7)) {
+            return false;
+        }
+        releaseStatements();
+        QSqlQuery(m_database).exec("VACUUM");
+    }
+    
+    // Version 8: links move out of the manifests into the links table
+    if (currentVersion < 8) {
+        if (!migrateLinksToTable() || !setCurrentVersion(8)) {
+            return false;
+        }
+    }
+    
+    // Version 9: page order moves into a position column, plus secondary indexes
+    if (currentVersion < 9) {
+        if (!addPagePositions() || !setCurrentVersion(9)) {
+            return false;
+        }
+    }
+    
+    // Version 10: content hash columns on pages and objects (added above)
+    if (currentVersion < 10 && !setCurrentVersion(10)) {
+        return false;
+    }
+    
+    return true;
+}
+
+bool Storage::migrateBlobsToBinary()
+{
+    beginTransaction();
+    
+    // Pages: re-encode JSON rows one at a time to keep memory bounded
+    QStringList pageIds;
+    QSqlQuery pageRows = prepareQuery("SELECT id FROM pages");
+    if (!pageRows.exec()) {
+        rollbackTransaction();
+        emit databaseError("Failed to migrate pages: " + pageRows.lastError().text());
+        return false;
+    }
+    while (pageRows.next()) {
+        pageIds.append(pageRows.value(0).toString());
+    }
+    
+    for (const QString &pageId : pageIds) {
+        QSqlQuery select = prepareQuery("SELECT data FROM pages WHERE id = ?");
+        select.addBindValue(pageId);
+        if (!select.exec() || !select.next()) {
+            continue;
+        }
+        
+        QByteArray blob = select.value(0).toByteArray();
+        Page page;
+        if (BlobCodec::isBinary(blob) || !BlobCodec::decodePage(blob, page)) {
+            continue;
+        }
+        
+        QSqlQuery update = prepareQuery("UPDATE pages SET data = ? WHERE id = ?");
+        update.addBindValue(BlobCodec::encodePage(page));
+        update.addBindValue(pageId);
+        if (!update.exec()) {
+            rollbackTransaction();
+            emit databaseError("Failed to migrate page: " + update.lastError().text());
+            return false;
+        }
+    }
     
-    for (auto it = metadata.begin(); it != metadata.end(); ++it) {
-        query.addBindValue(documentId);
-        query.addBindValue(it.key());
-        query.addBindValue(it.value().toString());
+    // Documents: JSON manifests and legacy full documents become binary manifests
+    QStringList documentIds;
+    QSqlQuery documentRows = prepareQuery("SELECT id FROM documents");
+    if (!documentRows.exec()) {
+        rollbackTransaction();
+        emit databaseError("Failed to migrate documents: " + documentRows.lastError().text());
+        return false;
+    }
+    while (documentRows.next()) {
+        documentIds.append(documentRows.value(0).toString());
+    }
+    
+    for (const QString &documentId : documentIds) {
+        QSqlQuery select = prepareQuery("SELECT data FROM documents WHERE id = ?");
+        select.addBindValue(documentId);
+        if (!select.exec() || !select.next()) {
+            continue;
+        }
         
-        if (!query.exec()) {
-            emit databaseError("Failed to update metadata: " + query.lastError().text());
+        QByteArray blob = select.value(0).toByteArray();
+        Document document;
+        if (BlobCodec::isBinary(blob) || !BlobCodec::decodeDocument(blob, document)) {
+            continue;
+        }
+        
+        QSqlQuery update = prepareQuery("UPDATE documents SET data = ? WHERE id = ?");
+        update.addBindValue(BlobCodec::encodeManifest(document));
+        update.addBindValue(documentId);
+        if (!update.exec()) {
+            rollbackTransaction();
+            emit databaseError("Failed to migrate document: " + update.lastError().text());
             return false;
         }
     }
     
-    return true;
+    return commitTransaction();
 }
 
-QJsonObject Storage::getDocumentMetadata(const QString &documentId)
+bool Storage::rebuildSearchIndex()
 {
-    QJsonObject metadata;
+    if (!m_fullTextSearch) {
+        return true;
+    }
     
-    if (!m_initialized || documentId.isEmpty()) {
-        return metadata;
+    beginTransaction();
+    
+    if (!executeQuery("DELETE FROM search_index") || !executeQuery("DELETE FROM search_entries")) {
+        rollbackTransaction();
+        return false;
     }
     
-    QSqlQuery query = prepareQuery("SELECT key, value FROM metadata WHERE document_id = ?");
-    query.addBindValue(documentId);
+    QSqlQuery documentRows = prepareQuery("SELECT id, title, description, tags FROM documents");
+    if (!documentRows.exec()) {
+        rollbackTransaction();
+        emit databaseError("Failed to index documents: " + documentRows.lastError().text());
+        return false;
+    }
+    while (documentRows.next()) {
+        QStringList tags = documentRows.value(3).toString().split(',', Qt::SkipEmptyParts);
+        if (!indexDocumentMetadata(documentRows.value(0).toString(), documentRows.value(1).toString(),
+                                   documentRows.value(2).toString(), tags)) {
+            rollbackTransaction();
+            return false;
+        }
+    }
     
-    if (query.exec()) {
-        while (query.next()) {
-            metadata[query.value(0).toString()] = query.value(1).toString();
+    // Pages are decoded one at a time to keep memory bounded
+    QVector<QPair<QString, QString>> pageIds;
+    QSqlQuery pageRows = prepareQuery("SELECT id, document_id FROM pages");
+    if (!pageRows.exec()) {
+        rollbackTransaction();
+        emit databaseError("Failed to index pages: " + pageRows.lastError().text());
+        return false;
+    }
+    while (pageRows.next()) {
+        pageIds.append(qMakePair(pageRows.value(0).toString(), pageRows.value(1).toString()));
+    }
+    
+    for (const auto &entry : pageIds) {
+        QSqlQuery select = prepareQuery("SELECT data FROM pages WHERE id = ?");
+        select.addBindValue(entry.first);
+        if (!select.exec() || !select.next()) {
+            continue;
+        }
+        
+        auto page = pageFromBlob(select.value(0).toByteArray());
+        if (!page) {
+            continue;
+        }
+        
+        // Only text objects matter for the index
+        page->addObjects(loadObjects(entry.first, {Object::TextObject}));
+        page->markAllDirty();
+        
+        if (!indexPage(entry.second, snapshotPage(*page))) {
+            rollbackTransaction();
+            return false;
         }
-    } else {
-        emit databaseError("Failed to get metadata: " + query.lastError().text());
     }
     
-    return metadata;
+    return commitTransaction();
 }
 
-int Storage::getDocumentCount() const
+bool Storage::migrateTagsToTable()
 {
-    if (!m_initialized) {
-        return 0;
+    beginTransaction();
+    
+    QVector<QPair<QString, QStringList>> documentTags;
+    QSqlQuery documentRows = prepareQuery("SELECT id, tags FROM documents WHERE tags IS NOT NULL AND tags != ''");
+    if (!documentRows.exec()) {
+        rollbackTransaction();
+        emit databaseError("Failed to migrate tags: " + documentRows.lastError().text());
+        return false;
+    }
+    while (documentRows.next()) {
+        documentTags.append(qMakePair(documentRows.value(0).toString(),
+                                      documentRows.value(1).toString().split(',', Qt::SkipEmptyParts)));
     }
     
-    QSqlQuery query = prepareQuery("SELECT COUNT(*) FROM documents");
-    if (query.exec() && query.next()) {
-        return query.value(0).toInt();
+    for (const auto &entry : documentTags) {
+        if (!writeDocumentTags(entry.first, entry.second)) {
+            rollbackTransaction();
+            return false;
+        }
     }
     
-    return 0;
+    return commitTransaction();
 }
 
-int Storage::getPageCount() const
+bool Storage::addPageCountColumn()
 {
-    if (!m_initialized) {
-        return 0;
+    beginTransaction();
+    
+    // Databases created before version 5 lack the column; newer ones already have it
+    if (!columnExists("documents", "page_count") &&
+        !executeQuery("ALTER TABLE documents ADD COLUMN page_count INTEGER NOT NULL DEFAULT 0")) {
+        rollbackTransaction();
+        return false;
     }
     
-    QSqlQuery query = prepareQuery("SELECT COUNT(*) FROM pages");
-    if (query.exec() && query.next()) {
-        return query.value(0).toInt();
+    if (!executeQuery("UPDATE documents SET page_count = "
+                      "(SELECT COUNT(*) FROM pages WHERE pages.document_id = documents.id)") ||
+        !executeQuery("CREATE INDEX IF NOT EXISTS idx_documents_modified ON documents (modified_date DESC, id DESC)")) {
+        rollbackTransaction();
+        return false;
     }
     
-    return 0;
-}
-
-qint64 Storage::getDatabaseSize() const
-{
-    QFileInfo fileInfo(m_databasePath);
-    return fileInfo.size();
-}
-
-bool Storage::createTables()
-{
-    return createDocumentTable() && 
-           createPageTable() && 
-           createObjectTable() && 
-           createMetadataTable() && 
-           createLinksTable();
+    return commitTransaction();
 }
 
-bool Storage::createDocumentTable()
+bool Storage::migratePagesToObjectRows()
 {
-    QString query = R"(
-        CREATE TABLE IF NOT EXISTS documents (
-            id TEXT PRIMARY KEY,
-            title TEXT NOT NULL,
-            description TEXT,
-            created_date TEXT NOT NULL,
-            modified_date TEXT NOT NULL,
-            tags TEXT,
-            data BLOB NOT NULL
-        )
-    )";
+    beginTransaction();
     
-    return executeQuery(query);
-}
-
-bool Storage::createPageTable()
-{
-    QString query = R"(
-        CREATE TABLE IF NOT EXISTS pages (
-            id TEXT PRIMARY KEY,
-            document_id TEXT NOT NULL,
-            title TEXT NOT NULL,
-            data BLOB NOT NULL,
-            FOREIGN KEY (document_id) REFERENCES documents (id) ON DELETE CASCADE
-        )
-    )";
+    QVector<QPair<QString, QString>> pageIds;
+    QSqlQuery pageRows = prepareQuery("SELECT id, document_id FROM pages");
+    if (!pageRows.exec()) {
+        rollbackTransaction();
+        emit databaseError("Failed to migrate pages: " + pageRows.lastError().text());
+        return false;
+    }
+    while (pageRows.next()) {
+        pageIds.append(qMakePair(pageRows.value(0).toString(), pageRows.value(1).toString()));
+    }
     
-    return executeQuery(query);
-}
-
-bool Storage::createObjectTable()
-{
-    QString query = R"(
-        CREATE TABLE IF NOT EXISTS objects (
-            id TEXT PRIMARY KEY,
-            page_id TEXT NOT NULL,
-            type INTEGER NOT NULL,
-            data BLOB NOT NULL,
-            FOREIGN KEY (page_id) REFERENCES pages (id) ON DELETE CASCADE
-        )
-    )";
+    // One page at a time: decode the full blob, then write header and object rows
+    for (const auto &entry : pageIds) {
+        QSqlQuery select = prepareQuery("SELECT data FROM pages WHERE id = ?");
+        select.addBindValue(entry.first);
+        if (!select.exec() || !select.next()) {
+            continue;
+        }
+        
+        QByteArray blob = select.value(0).toByteArray();
+        Page page;
+        if (BlobCodec::isPageHeader(blob) || !BlobCodec::decodePage(blob, page)) {
+            continue;
+        }
+        
+        page.markAllDirty();
+        if (!savePage(entry.second, snapshotPage(page))) {
+            rollbackTransaction();
+            return false;
+        }
+    }
     
-    return executeQuery(query);
+    return commitTransaction();
 }
 
-bool Storage::createMetadataTable()
+bool Storage::compressStoredBlobs()
 {
-    QString query = R"(
-        CREATE TABLE IF NOT EXISTS metadata (
-            document_id TEXT NOT NULL,
-            key TEXT NOT NULL,
-            value TEXT NOT NULL,
-            PRIMARY KEY (document_id, key),
-            FOREIGN KEY (document_id) REFERENCES documents (id) ON DELETE CASCADE
-        )
-    )";
+    beginTransaction();
     
-    return executeQuery(query);
-}
-
-bool Storage::createLinksTable()
-{
-    QString query = R"(
-        CREATE TABLE IF NOT EXISTS links (
-            from_page_id TEXT NOT NULL,
-            to_page_id TEXT NOT NULL,
-            PRIMARY KEY (from_page_id, to_page_id),
-            FOREIGN KEY (from_page_id) REFERENCES pages (id) ON DELETE CASCADE,
-            FOREIGN KEY (to_page_id) REFERENCES pages (id) ON DELETE CASCADE
-        )
-    )";
+    // Without zstd or enough objects there is no dictionary; rows are still recompressed
+    if (!trainDictionary() ||
+        !recompressTable("documents") || !recompressTable("pages") || !recompressTable("objects")) {
+        rollbackTransaction();
+        return false;
+    }
     
-    return executeQuery(query);
+    return commitTransaction();
 }
 
-bool Storage::executeQuery(const QString &query, const QVariantList &params)
+bool Storage::migrateLinksToTable()
 {
-    QSqlQuery sqlQuery = prepareQuery(query);
+    beginTransaction();
     
-    for (const QVariant &param : params) {
-        sqlQuery.addBindValue(param);
+    QStringList documentIds;
+    QSqlQuery documentRows = prepareQuery("SELECT id FROM documents");
+    if (!documentRows.exec()) {
+        rollbackTransaction();
+        emit databaseError("Failed to migrate links: " + documentRows.lastError().text());
+        return false;
+    }
+    while (documentRows.next()) {
+        documentIds.append(documentRows.value(0).toString());
     }
     
-    bool success = sqlQuery.exec();
-    if (!success) {
-        emit databaseError("Query failed: " + sqlQuery.lastError().text());
+    // Manifests are small; decoding one only builds page stubs
+    for (const QString &documentId : documentIds) {
+        QSqlQuery select = prepareQuery("SELECT data FROM documents WHERE id = ?");
+        select.addBindValue(documentId);
+        if (!select.exec() || !select.next()) {
+            continue;
+        }
+        
+        Document document;
+        if (!BlobCodec::decodeDocument(select.value(0).toByteArray(), document)) {
+            continue;
+        }
+        
+        if (!writeDocumentLinks(documentId, document.links())) {
+            rollbackTransaction();
+            return false;
+        }
     }
     
-    return success;
-}
-
-QSqlQuery Storage::prepareQuery(const QString &query)
-{
-    QSqlQuery sqlQuery(m_database);
-    sqlQuery.prepare(query);
-    return sqlQuery;
-}
-
-QString Storage::getLastError() const
-{
-    return m_database.lastError().text();
-}
-
-bool Storage::beginTransaction()
-{
-    return m_database.transaction();
-}
-
-bool Storage::commitTransaction()
-{
-    return m_database.commit();
-}
-
-bool Storage::rollbackTransaction()
-{
-    return m_database.rollback();
-}
-
-QByteArray Storage::documentToBlob(std::shared_ptr<Document> document)
-{
-    QJsonDocument doc(document->toJson());
-    return doc.toJson(QJsonDocument::Compact);
+    return commitTransaction();
 }
 
-std::shared_ptr<Document> Storage::documentFromBlob(const QByteArray &blob)
+bool Storage::addPagePositions()
 {
-    QJsonDocument doc = QJsonDocument::fromJson(blob);
-    if (doc.isNull()) {
-        return nullptr;
+    beginTransaction();
+    
+    // Databases created before version 9 lack the column; newer ones already have it
+    if (!columnExists("pages", "position") &&
+        !executeQuery("ALTER TABLE pages ADD COLUMN position TEXT NOT NULL DEFAULT ''")) {
+        rollbackTransaction();
+        return false;
     }
     
-    auto document = std::make_shared<Document>();
-    document->fromJson(doc.object());
-    return document;
-}
-
-QByteArray Storage::pageToBlob(std::shared_ptr<Page> page)
-{
-    QJsonDocument doc(page->toJson());
-    return doc.toJson(QJsonDocument::Compact);
-}
-
-std::shared_ptr<Page> Storage::pageFromBlob(const QByteArray &blob)
-{
-    QJsonDocument doc = QJsonDocument::fromJson(blob);
-    if (doc.isNull()) {
-        return nullptr;
+    QStringList documentIds;
+    QSqlQuery documentRows = prepareQuery("SELECT id FROM documents");
+    if (!documentRows.exec()) {
+        rollbackTransaction();
+        emit databaseError("Failed to migrate page order: " + documentRows.lastError().text());
+        return false;
+    }
+    while (documentRows.next()) {
+        documentIds.append(documentRows.value(0).toString());
     }
     
-    auto page = std::make_shared<Page>();
-    page->fromJson(doc.object());
-    return page;
-}
-
-bool Storage::migrateDatabase()
-{
-    int currentVersion = getCurrentVersion();
-    int targetVersion = 1; // Current schema version
+    // Existing pages take positions in their manifest order
+    for (const QString &documentId : documentIds) {
+        QSqlQuery select = prepareQuery("SELECT data FROM documents WHERE id = ?");
+        select.addBindValue(documentId);
+        if (!select.exec() || !select.next()) {
+            continue;
+        }
+        
+        Document document;
+        if (!BlobCodec::decodeDocument(select.value(0).toByteArray(), document)) {
+            continue;
+        }
+        
+        QString position;
+        for (const auto &page : document.pages()) {
+            position = FractionalIndex::after(position);
+            QSqlQuery update = prepareQuery("UPDATE pages SET position = ? WHERE id = ?");
+            update.addBindValue(position);
+            update.addBindValue(page->id());
+            if (!update.exec()) {
+                rollbackTransaction();
+                emit databaseError("Failed to migrate page order: " + update.lastError().text());
+                return false;
+            }
+        }
+    }
     
-    if (currentVersion < targetVersion) {
-        // Run migrations here as the schema evolves
-        // For now, just set the version
-        return setCurrentVersion(targetVersion);
+    // The metadata primary key already leads with document_id
+    if (!executeQuery("CREATE INDEX IF NOT EXISTS idx_pages_document ON pages (document_id, position, id)")) {
+        rollbackTransaction();
+        return false;
     }
     
-    return true;
+    return commitTransaction();
 }
 
 int Storage::getCurrentVersion()
 {
-    QSqlQuery query = prepareQuery("PRAGMA user_version");
+    QSqlQuery query(m_database);
+    query.prepare("PRAGMA user_version");
     if (query.exec() && query.next()) {
         return query.value(0).toInt();
     }
@@ -2,6 +2,7 @@
 #define STORAGE_H
 
 #include "document.h"
+#include "journal.h"
 #include <QObject>
 #include <QString>
 #include <QSqlDatabase>
@@ -11,8 +12,12 @@
 #include <QJsonDocument>
 #include <QDateTime>
 #include <QStringList>
+#include <QMap>
+#include <QHash>
 #include <memory>
 
+struct sqlite3;
+
 /**
  * @brief Storage manager for persisting documents and managing the database
  * 
@@ -24,6 +29,133 @@ class Storage : public QObject
     Q_OBJECT
 
 public:
+    enum LoadMode {
+        LoadFull,   // Build every page up front
+        LoadLazy    // Build page stubs and load page content on demand
+    };
+
+    enum TagMatch {
+        MatchAll,   // Documents carrying every requested tag
+        MatchAny    // Documents carrying at least one requested tag
+    };
+
+    /**
+     * @brief Summary row for listing documents without decoding them
+     */
+    struct CatalogEntry {
+        QString id;
+        QString title;
+        QDateTime modifiedDate;
+        int pageCount;
+        QStringList tags;
+        
+        CatalogEntry() : pageCount(0) {}
+    };
+
+    /**
+     * @brief Position in the catalog; pass the cursor returned by one call to get the next rows
+     */
+    struct CatalogCursor {
+        QString modifiedDate;   // raw column value, compared as stored
+        QString id;
+        
+        bool isNull() const { return id.isEmpty(); }
+    };
+
+    /**
+     * @brief Encoded copy of one object row
+     */
+    struct ObjectSnapshot {
+        QString id;
+        int type;
+        QByteArray payload;                      // uncompressed encoding, taken on the owning thread
+        QByteArray data;                         // blob, filled in by sealPages()
+        QByteArray hash;                         // of the payload; an equal stored hash skips the write
+        QString text;                            // searchable content, empty for non-text objects
+        
+        ObjectSnapshot() : type(0) {}
+    };
+
+    /**
+     * @brief Encoded copy of a page taken on the owning thread, safe to write from another
+     *
+     * Holds the page header and only the objects that changed since the last
+     * save, unless replaceObjects is set, in which case it holds every object.
+     * Taking it only writes the uncompressed payloads; sealPages() compresses
+     * and hashes them later, on the thread that saves.
+     */
+    struct PageSnapshot {
+        QString id;
+        QString title;
+        QString position;
+        QByteArray payload;                      // page header, uncompressed
+        QByteArray data;                         // page header blob
+        QByteArray hash;
+        QVector<ObjectSnapshot> objects;
+        QStringList removedObjectIds;
+        bool replaceObjects;
+        
+        PageSnapshot() : replaceObjects(false) {}
+    };
+
+    /**
+     * @brief Stored form of a page: its header blob and its object blobs in order
+     */
+    struct PageRecord {
+        QByteArray data;
+        QVector<QByteArray> objects;
+    };
+
+    /**
+     * @brief Everything saveDocument writes, detached from the live Document
+     */
+    struct DocumentSnapshot {
+        QString id;
+        QString title;
+        QString description;
+        QDateTime createdDate;
+        QDateTime modifiedDate;
+        QStringList tags;
+        int pageCount;
+        QByteArray manifestPayload;
+        QByteArray manifest;                     // filled in by sealSnapshot()
+        QStringList removedPageIds;
+        QVector<PageSnapshot> pages;             // dirty pages only
+        QHash<QString, QString> movedPages;      // new positions of clean pages
+        bool linksChanged;
+        QVector<QPair<QString, QString>> links;  // every link, when linksChanged
+        
+        DocumentSnapshot() : pageCount(0), linksChanged(false) {}
+    };
+
+    /**
+     * @brief Rows a save wrote, and rows it skipped because their content hash matched
+     */
+    struct SaveStatistics {
+        int pagesWritten;
+        int pagesSkipped;
+        int objectsWritten;
+        int objectsSkipped;
+        
+        SaveStatistics() : pagesWritten(0), pagesSkipped(0), objectsWritten(0), objectsSkipped(0) {}
+    };
+
+    struct Backlink {
+        QString documentId;
+        QString pageId;     // the page holding the link
+        QString pageTitle;
+    };
+
+    struct SearchHit {
+        QString documentId;
+        QString pageId;     // empty for document title/description/tag hits
+        QString objectId;   // empty for page title hits
+        QString snippet;
+        double rank;        // lower is better
+        
+        SearchHit() : rank(0.0) {}
+    };
+
     explicit Storage(QObject *parent = nullptr);
     ~Storage() override;
 
@@ -32,45 +164,97 @@ public:
     void close();
     bool isOpen() const;
     
+    // Statement cache and connection pragmas; on by default, switched off only
+    // to measure their effect. Takes effect on the next initialize().
+    void setTuningEnabled(bool enabled) { m_tuningEnabled = enabled; }
+    
     // Document operations
     bool saveDocument(std::shared_ptr<Document> document);
-    std::shared_ptr<Document> loadDocument(const QString &documentId);
+    bool saveDocument(DocumentSnapshot snapshot);
+    static DocumentSnapshot snapshotDocument(const Document &document);
+    static PageSnapshot snapshotPage(const Page &page);
+    static QVector<PageSnapshot> snapshotPages(const QVector<const Page *> &pages);
+    static void sealSnapshot(DocumentSnapshot &snapshot);
+    static void sealPages(QVector<PageSnapshot> &pages);
+    std::shared_ptr<Document> loadDocument(const QString &documentId, LoadMode mode = LoadFull);
     std::shared_ptr<Document> loadDocumentByTitle(const QString &title);
     bool deleteDocument(const QString &documentId);
     QStringList listDocuments();
+    QVector<CatalogEntry> documentCatalog(int limit, const CatalogCursor &after = CatalogCursor(),
+                                          CatalogCursor *next = nullptr);
     
     // Page operations
     bool savePage(const QString &documentId, std::shared_ptr<Page> page);
+    bool savePage(const QString &documentId, PageSnapshot snapshot);
+    PageRecord loadPageRecord(const QString &pageId);
+    static bool decodePageRecord(const PageRecord &record, Page &page);
+    
+    // Decodes object blobs in parallel; the objects belong to the calling thread
+    static QVector<std::shared_ptr<Object>> decodeObjects(const QVector<QByteArray> &blobs);
+    QVector<std::shared_ptr<Object>> loadObjects(const QString &pageId,
+                                                 const QList<Object::Type> &types = QList<Object::Type>());
     std::shared_ptr<Page> loadPage(const QString &pageId);
+    bool loadPage(std::shared_ptr<Page> page);
     bool deletePage(const QString &pageId);
     
+    // Operation journal: edits appended between snapshots. Saving a snapshot
+    // clears a document's journal; loading replays what is left of it.
+    bool appendJournal(const QString &documentId, const QVector<JournalEntry> &entries);
+    bool replayJournal(const QString &documentId);
+    
     // Search and queries
     QStringList searchDocuments(const QString &query);
+    QVector<SearchHit> searchContent(const QString &query, int limit = 50);
+    bool hasFullTextSearch() const { return m_fullTextSearch; }
     QStringList findDocumentsByTag(const QString &tag);
+    QStringList findDocumentsByTags(const QStringList &tags, TagMatch match = MatchAll);
+    QMap<QString, int> tagCounts();
+    QVector<Backlink> backlinks(const QString &pageId);
     QVector<QJsonObject> getRecentDocuments(int limit = 10);
     
     // Backup and restore
+    // Online backups through the SQLite backup API. An incremental backup
+    // copies only rows changed since the backup's last generation and falls
+    // back to a full backup when the target cannot be updated in place.
     bool createBackup(const QString &backupPath);
+    bool createIncrementalBackup(const QString &backupPath);
     bool restoreFromBackup(const QString &backupPath);
     
+    // Compression maintenance: trains a new zstd dictionary on the stored
+    // blobs, rewrites every row with it and shrinks the file
+    bool compactDatabase();
+    
     // Metadata operations
     bool updateDocumentMetadata(const QString &documentId, const QJsonObject &metadata);
     QJsonObject getDocumentMetadata(const QString &documentId);
     
+    // Batched forms: one transaction for every write, one query per read
+    bool updateDocumentMetadata(const QHash<QString, QJsonObject> &metadata);
+    QHash<QString, QJsonObject> getDocumentMetadata(const QStringList &documentIds);
+    
     // Statistics
     int getDocumentCount() const;
     int getPageCount() const;
     qint64 getDatabaseSize() const;
+    SaveStatistics lastSaveStatistics() const { return m_lastSave; }
+    SaveStatistics totalSaveStatistics() const { return m_totalSaves; }
 
 signals:
     void documentSaved(const QString &documentId);
     void documentDeleted(const QString &documentId);
     void databaseError(const QString &error);
+    void backupProgress(qint64 done, qint64 total);
 
 private:
     QSqlDatabase m_database;
     QString m_databasePath;
     bool m_initialized;
+    bool m_fullTextSearch;
+    bool m_tuningEnabled;
+    bool m_sharedSqlite;        // QSQLITE runs on the SQLite library linked here
+    mutable QHash<QString, QSqlQuery> m_statements;   // prepared statements keyed by SQL text
+    SaveStatistics m_lastSave;
+    SaveStatistics m_totalSaves;
     
     // Database schema management
     bool createTables();
@@ -79,23 +263,72 @@ private:
     bool createObjectTable();
     bool createMetadataTable();
     bool createLinksTable();
+    bool createSearchTables();
+    bool createTagTable();
+    bool createChangeLog();
+    bool createDictionaryTable();
+    bool createJournalTable();
+    
+    // Blob compression
+    bool loadDictionaries();
+    bool hasDictionary();
+    bool trainDictionary();
+    bool recompressTable(const QString &table);
+    
+    // Tag maintenance
+    bool writeDocumentTags(const QString &documentId, const QStringList &tags);
+    bool writeDocumentLinks(const QString &documentId, const QVector<QPair<QString, QString>> &links);
+    static QStringList normalizeTags(const QStringList &tags);
+    
+    // Full-text index maintenance
+    bool indexPage(const QString &documentId, const PageSnapshot &snapshot);
+    bool removeObjectFromIndex(const QString &objectId);
+    bool indexDocumentMetadata(const QString &documentId, const QString &title,
+                               const QString &description, const QStringList &tags);
+    bool removePageFromIndex(const QString &pageId);
+    bool removeDocumentFromIndex(const QString &documentId);
+    bool addIndexEntry(const QString &documentId, const QString &pageId,
+                       const QString &objectId, const QString &content);
+    static QString toFullTextQuery(const QString &text);
     
-    // Helper methods
+    // Helper methods. executeQuery() prepares a fresh statement for one-off
+    // SQL; prepareQuery() hands out cached statements for the hot DML paths.
     bool executeQuery(const QString &query, const QVariantList &params = QVariantList());
-    QSqlQuery prepareQuery(const QString &query);
+    bool columnExists(const QString &table, const QString &column);
+    QStringList tableColumns(const QString &table, const QString &schema = "main");
+    bool addColumn(const QString &table, const QString &column, const QString &definition);
+    QSqlQuery prepareQuery(const QString &query) const;
+    void releaseStatements() const;
+    bool applyPragmas();
     QString getLastError() const;
+    sqlite3 *nativeHandle() const;
+    bool usesLinkedSqlite();
+    bool copyDatabase(sqlite3 *source, sqlite3 *destination);
+    bool vacuumInto(const QString &path, qint64 changeSeq);
+    qint64 lastChangeSeq();
     bool beginTransaction();
     bool commitTransaction();
     bool rollbackTransaction();
     
-    // JSON serialization helpers
+    // Blob serialization helpers
     QByteArray documentToBlob(std::shared_ptr<Document> document);
-    std::shared_ptr<Document> documentFromBlob(const QByteArray &blob);
+    std::shared_ptr<Document> documentFromBlob(const QByteArray &blob, LoadMode mode = LoadFull);
     QByteArray pageToBlob(std::shared_ptr<Page> page);
     std::shared_ptr<Page> pageFromBlob(const QByteArray &blob);
+    bool loadDocumentPages(std::shared_ptr<Document> document);
+    bool loadPagePositions(Document &document);
+    static bool fillPage(const QByteArray &header, const QVector<std::shared_ptr<Object>> &objects, Page &page);
     
     // Migration support
     bool migrateDatabase();
+    bool migrateBlobsToBinary();
+    bool rebuildSearchIndex();
+    bool migrateTagsToTable();
+    bool addPageCountColumn();
+    bool migratePagesToObjectRows();
+    bool compressStoredBlobs();
+    bool migrateLinksToTable();
+    bool addPagePositions();
     int getCurrentVersion();
     bool setCurrentVersion(int version);
 };
@@ -37,6 +37,7 @@ void TextObject::setContent(const QString &content)
     if (m_content != content) {
         m_content = content;
         setupDocument();
+        markChanged();
         emit contentChanged(m_content);
     }
 }
@@ -65,6 +66,7 @@ void TextObject::setMarkdownMode(bool markdownMode)
     if (m_markdownMode != markdownMode) {
         m_markdownMode = markdownMode;
         setupDocument();
+        markChanged();
     }
 }
 
@@ -73,6 +75,7 @@ void TextObject::setFont(const QFont &font)
     if (m_font != font) {
         m_font = font;
         setupDocument();
+        markChanged();
     }
 }
 
@@ -81,6 +84,7 @@ void TextObject::setTextColor(const QColor &color)
     if (m_textColor != color) {
         m_textColor = color;
         setupDocument();
+        markChanged();
     }
 }
 
@@ -89,6 +93,7 @@ void TextObject::setBackgroundColor(const QColor &color)
     if (m_backgroundColor != color) {
         m_backgroundColor = color;
         setupDocument();
+        markChanged();
     }
 }
 
@@ -97,6 +102,7 @@ void TextObject::setAlignment(Qt::Alignment alignment)
     if (m_alignment != alignment) {
         m_alignment = alignment;
         setupDocument();
+        markChanged();
     }
 }
 
@@ -105,6 +111,7 @@ void TextObject::setLineSpacing(int spacing)
     if (m_lineSpacing != spacing) {
         m_lineSpacing = spacing;
         setupDocument();
+        markChanged();
     }
 }
 
@@ -223,6 +230,27 @@ void TextObject::fromJson(const QJsonObject &json)
     setupDocument();
 }
 
+void TextObject::writeBinary(QDataStream &out) const
+{
+    Object::writeBinary(out);
+    out << m_content << m_markdownMode << m_font << m_textColor << m_backgroundColor
+        << static_cast<qint32>(m_alignment) << static_cast<qint32>(m_lineSpacing);
+}
+
+void TextObject::readBinary(QDataStream &in)
+{
+    Object::readBinary(in);
+    
+    qint32 alignment = 0;
+    qint32 lineSpacing = 0;
+    in >> m_content >> m_markdownMode >> m_font >> m_textColor >> m_backgroundColor
+       >> alignment >> lineSpacing;
+    m_alignment = static_cast<Qt::Alignment>(alignment);
+    m_lineSpacing = lineSpacing;
+    
+    setupDocument();
+}
+
 std::unique_ptr<Object> TextObject::clone() const
 {
     auto clone = std::make_unique<TextObject>();
@@ -242,7 +270,9 @@ void TextObject::setState(const QJsonObject &state)
 
 void TextObject::setupDocument()
 {
-    m_document = std::make_unique<QTextDocument>();
+    // Parented so that moveToThread() takes the document along; objects are
+    // built on pool threads when pages are decoded in parallel
+    m_document = std::make_unique<QTextDocument>(this);
     m_document->setDefaultFont(m_font);
     m_document->setDefaultStyleSheet(QString(
         "body { color: %1; background-color: %2; }"
@@ -62,6 +62,8 @@ public:
     // Serialization
     QJsonObject toJson() const override;
     void fromJson(const QJsonObject &json) override;
+    void writeBinary(QDataStream &out) const override;
+    void readBinary(QDataStream &in) override;
     
     // Operations
     std::unique_ptr<Object> clone() const override;
@@ -88,7 +90,7 @@ private:
     int m_lineSpacing;
     bool m_editing;
     
-    std::unique_ptr<QTextDocument> m_document;
+    std::unique_ptr<QTextDocument> m_document;    // child of this object, deleted first
     std::unique_ptr<QTextEdit> m_textEdit;
     
     void setupDocument();
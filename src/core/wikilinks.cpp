@@ -0,0 +1,333 @@
+#include "wikilinks.h"
+#include "textobject.h"
+#include <QRegularExpression>
+
+WikiLinkTracker::WikiLinkTracker(QObject *parent)
+    : QObject(parent)
+{
+}
+
+WikiLinkTracker::~WikiLinkTracker()
+{
+    detach();
+}
+
+void WikiLinkTracker::attach(std::shared_ptr<Document> document)
+{
+    detach();
+
+    m_document = document;
+    if (!m_document) {
+        return;
+    }
+
+    connect(m_document.get(), &Document::pageAdded, this, &WikiLinkTracker::onPageAdded);
+    connect(m_document.get(), &Document::pageRemoved, this, &WikiLinkTracker::onPageRemoved);
+    connect(m_document.get(), &Document::pageLoaded, this, &WikiLinkTracker::onPageLoaded);
+
+    // Every title is indexed before any text is resolved against them
+    for (const auto &page : m_document->pages()) {
+        connect(page.get(), &Page::titleChanged, this, &WikiLinkTracker::onPageTitleChanged);
+        connect(page.get(), &Page::objectAdded, this, &WikiLinkTracker::onObjectAdded);
+        connect(page.get(), &Page::objectRemoved, this, &WikiLinkTracker::onObjectRemoved);
+        indexPage(page->id(), page->title());
+    }
+    for (const auto &page : m_document->pages()) {
+        for (const auto &object : page->objects()) {
+            attachObject(page->id(), object);
+        }
+    }
+}
+
+void WikiLinkTracker::detach()
+{
+    if (m_document) {
+        disconnect(m_document.get(), nullptr, this, nullptr);
+        for (const auto &page : m_document->pages()) {
+            disconnect(page.get(), nullptr, this, nullptr);
+        }
+    }
+
+    for (auto it = m_textKeys.begin(); it != m_textKeys.end(); ++it) {
+        disconnect(it.key(), nullptr, this, nullptr);
+    }
+
+    m_document.reset();
+    m_texts.clear();
+    m_textKeys.clear();
+    m_pagesByTitle.clear();
+    m_pageTitles.clear();
+    m_referencingTexts.clear();
+    m_linkCounts.clear();
+}
+
+QStringList WikiLinkTracker::parseTitles(const QString &text)
+{
+    // [[Title]] or [[Title|label]]; brackets and line breaks end a reference
+    static const QRegularExpression reference(QStringLiteral("\\[\\[([^\\[\\]|\\n]+)(?:\\|[^\\[\\]\\n]*)?\\]\\]"));
+
+    QStringList titles;
+    if (!text.contains(QLatin1String("[["))) {
+        return titles;
+    }
+
+    QRegularExpressionMatchIterator matches = reference.globalMatch(text);
+    while (matches.hasNext()) {
+        const QString title = matches.next().captured(1).trimmed();
+        if (!title.isEmpty() && !titles.contains(title)) {
+            titles.append(title);
+        }
+    }
+    return titles;
+}
+
+QString WikiLinkTracker::titleKey(const QString &title)
+{
+    return title.simplified().toCaseFolded();
+}
+
+QStringList WikiLinkTracker::titleKeysIn(const QString &text)
+{
+    QStringList keys;
+    for (const QString &title : parseTitles(text)) {
+        const QString key = titleKey(title);
+        if (!keys.contains(key)) {
+            keys.append(key);
+        }
+    }
+    return keys;
+}
+
+QString WikiLinkTracker::textKey(const QString &pageId, const QString &objectId)
+{
+    // Duplicated pages reuse object ids, so the page is part of the key
+    return pageId + QLatin1Char('/') + objectId;
+}
+
+void WikiLinkTracker::attachPage(std::shared_ptr<Page> page)
+{
+    connect(page.get(), &Page::titleChanged, this, &WikiLinkTracker::onPageTitleChanged);
+    connect(page.get(), &Page::objectAdded, this, &WikiLinkTracker::onObjectAdded);
+    connect(page.get(), &Page::objectRemoved, this, &WikiLinkTracker::onObjectRemoved);
+    indexPage(page->id(), page->title());
+
+    for (const auto &object : page->objects()) {
+        attachObject(page->id(), object);
+    }
+}
+
+void WikiLinkTracker::attachObject(const QString &pageId, std::shared_ptr<Object> object)
+{
+    auto text = qobject_cast<TextObject *>(object.get());
+    if (!text) {
+        return;
+    }
+
+    const QString key = textKey(pageId, text->id());
+    m_textKeys.insert(text, key);
+    connect(text, &TextObject::contentChanged, this, &WikiLinkTracker::onContentChanged);
+
+    // Evicted pages drop their objects without a signal; their references stay
+    connect(text, &QObject::destroyed, this, [this](QObject *destroyed) {
+        m_textKeys.remove(destroyed);
+    });
+
+    updateText(key, pageId, titleKeysIn(text->content()));
+}
+
+void WikiLinkTracker::indexPage(const QString &pageId, const QString &title)
+{
+    const QString key = titleKey(title);
+    m_pageTitles.insert(pageId, key);
+    m_pagesByTitle[key].append(pageId);
+    resolveTitle(key);
+}
+
+void WikiLinkTracker::unindexPage(const QString &pageId)
+{
+    auto title = m_pageTitles.find(pageId);
+    if (title == m_pageTitles.end()) {
+        return;
+    }
+
+    const QString key = title.value();
+    m_pageTitles.erase(title);
+
+    auto pages = m_pagesByTitle.find(key);
+    if (pages != m_pagesByTitle.end()) {
+        pages->removeAll(pageId);
+        if (pages->isEmpty()) {
+            m_pagesByTitle.erase(pages);
+        }
+    }
+    resolveTitle(key);
+}
+
+void WikiLinkTracker::updateText(const QString &key, const QString &pageId, const QStringList &titleKeys)
+{
+    TrackedText &text = m_texts[key];
+    text.pageId = pageId;
+
+    // Most edits leave the references as they were
+    if (text.titleKeys == titleKeys) {
+        return;
+    }
+
+    for (const QString &titleKey : text.titleKeys) {
+        if (!titleKeys.contains(titleKey)) {
+            auto referencing = m_referencingTexts.find(titleKey);
+            if (referencing != m_referencingTexts.end()) {
+                referencing->remove(key);
+                if (referencing->isEmpty()) {
+                    m_referencingTexts.erase(referencing);
+                }
+            }
+        }
+    }
+    for (const QString &titleKey : titleKeys) {
+        m_referencingTexts[titleKey].insert(key);
+    }
+
+    text.titleKeys = titleKeys;
+    setTargets(text, resolve(pageId, titleKeys));
+}
+
+void WikiLinkTracker::removeText(const QString &key)
+{
+    auto it = m_texts.find(key);
+    if (it == m_texts.end()) {
+        return;
+    }
+
+    updateText(key, it->pageId, QStringList());
+    m_texts.remove(key);
+}
+
+void WikiLinkTracker::resolveTitle(const QString &titleKey)
+{
+    const QSet<QString> referencing = m_referencingTexts.value(titleKey);
+    for (const QString &key : referencing) {
+        auto text = m_texts.find(key);
+        if (text != m_texts.end()) {
+            setTargets(*text, resolve(text->pageId, text->titleKeys));
+        }
+    }
+}
+
+QStringList WikiLinkTracker::resolve(const QString &pageId, const QStringList &titleKeys) const
+{
+    // A title shared by several pages resolves to the first page given it
+    QStringList targets;
+    for (const QString &titleKey : titleKeys) {
+        const QStringList pages = m_pagesByTitle.value(titleKey);
+        if (!pages.isEmpty() && pages.first() != pageId && !targets.contains(pages.first())) {
+            targets.append(pages.first());
+        }
+    }
+    return targets;
+}
+
+void WikiLinkTracker::setTargets(TrackedText &text, const QStringList &targets)
+{
+    const QStringList previous = text.targets;
+    text.targets = targets;
+
+    for (const QString &target : previous) {
+        if (targets.contains(target)) {
+            continue;
+        }
+        const auto link = qMakePair(text.pageId, target);
+        if (--m_linkCounts[link] <= 0) {
+            m_linkCounts.remove(link);
+            m_document->removeLink(text.pageId, target);
+        }
+    }
+    for (const QString &target : targets) {
+        if (previous.contains(target)) {
+            continue;
+        }
+        if (m_linkCounts[qMakePair(text.pageId, target)]++ == 0) {
+            m_document->addLink(text.pageId, target);
+        }
+    }
+}
+
+void WikiLinkTracker::onPageAdded(std::shared_ptr<Page> page)
+{
+    attachPage(page);
+}
+
+void WikiLinkTracker::onPageRemoved(std::shared_ptr<Page> page)
+{
+    disconnect(page.get(), nullptr, this, nullptr);
+    for (const auto &object : page->objects()) {
+        disconnect(object.get(), nullptr, this, nullptr);
+        m_textKeys.remove(object.get());
+    }
+
+    // The document has already dropped the page's links in both directions
+    QStringList keys;
+    for (auto it = m_texts.begin(); it != m_texts.end(); ++it) {
+        if (it->pageId == page->id()) {
+            keys.append(it.key());
+        }
+    }
+    for (const QString &key : keys) {
+        removeText(key);
+    }
+    unindexPage(page->id());
+}
+
+void WikiLinkTracker::onPageLoaded(std::shared_ptr<Page> page)
+{
+    // Texts seen before the page was evicted parse to the references they held
+    for (const auto &object : page->objects()) {
+        attachObject(page->id(), object);
+    }
+}
+
+void WikiLinkTracker::onPageTitleChanged(const QString &newTitle)
+{
+    Page *page = qobject_cast<Page *>(sender());
+    if (!page) {
+        return;
+    }
+
+    unindexPage(page->id());
+    indexPage(page->id(), newTitle);
+}
+
+void WikiLinkTracker::onObjectAdded(std::shared_ptr<Object> object)
+{
+    Page *page = qobject_cast<Page *>(sender());
+    if (!page || !object) {
+        return;
+    }
+
+    attachObject(page->id(), object);
+}
+
+void WikiLinkTracker::onObjectRemoved(std::shared_ptr<Object> object)
+{
+    if (!object) {
+        return;
+    }
+
+    disconnect(object.get(), nullptr, this, nullptr);
+    const QString key = m_textKeys.take(object.get());
+    if (!key.isEmpty()) {
+        removeText(key);
+    }
+}
+
+void WikiLinkTracker::onContentChanged(const QString &newContent)
+{
+    const QString key = m_textKeys.value(sender());
+    auto text = m_texts.find(key);
+    if (key.isEmpty() || text == m_texts.end()) {
+        return;
+    }
+
+    // Only the edited object is parsed again
+    updateText(key, text->pageId, titleKeysIn(newContent));
+}
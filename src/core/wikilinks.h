@@ -0,0 +1,81 @@
+#ifndef WIKILINKS_H
+#define WIKILINKS_H
+
+#include "document.h"
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QHash>
+#include <QSet>
+#include <QPair>
+#include <memory>
+
+class TextObject;
+
+/**
+ * @brief Keeps a document's page links in step with [[Page Title]] references
+ *
+ * Each text object is parsed when it is loaded or its content changes, and
+ * only that object: its references are diffed against the ones it held
+ * before. References are resolved case-insensitively through an index of
+ * page titles, and a link stays in the document while at least one text
+ * object on the source page refers to its target. References to titles no
+ * page has yet are kept and resolve once such a page appears.
+ *
+ * Links added by other means are left alone unless text also refers to them.
+ */
+class WikiLinkTracker : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit WikiLinkTracker(QObject *parent = nullptr);
+    ~WikiLinkTracker() override;
+
+    void attach(std::shared_ptr<Document> document);
+    void detach();
+
+    // Titles referenced in text, in order of first appearance
+    static QStringList parseTitles(const QString &text);
+
+private:
+    // References held by one text object
+    struct TrackedText {
+        QString pageId;
+        QStringList titleKeys;
+        QStringList targets;    // resolved page ids
+    };
+
+    std::shared_ptr<Document> m_document;
+    QHash<QString, TrackedText> m_texts;                // by page and object id
+    QHash<QObject *, QString> m_textKeys;
+    QHash<QString, QStringList> m_pagesByTitle;         // title key to page ids
+    QHash<QString, QString> m_pageTitles;               // page id to title key
+    QHash<QString, QSet<QString>> m_referencingTexts;   // title key to text keys
+    QHash<QPair<QString, QString>, int> m_linkCounts;   // texts backing each link
+
+    static QString titleKey(const QString &title);
+    static QStringList titleKeysIn(const QString &text);
+    static QString textKey(const QString &pageId, const QString &objectId);
+
+    void attachPage(std::shared_ptr<Page> page);
+    void attachObject(const QString &pageId, std::shared_ptr<Object> object);
+    void indexPage(const QString &pageId, const QString &title);
+    void unindexPage(const QString &pageId);
+    void updateText(const QString &key, const QString &pageId, const QStringList &titleKeys);
+    void removeText(const QString &key);
+    void resolveTitle(const QString &titleKey);
+    QStringList resolve(const QString &pageId, const QStringList &titleKeys) const;
+    void setTargets(TrackedText &text, const QStringList &targets);
+
+private slots:
+    void onPageAdded(std::shared_ptr<Page> page);
+    void onPageRemoved(std::shared_ptr<Page> page);
+    void onPageLoaded(std::shared_ptr<Page> page);
+    void onPageTitleChanged(const QString &newTitle);
+    void onObjectAdded(std::shared_ptr<Object> object);
+    void onObjectRemoved(std::shared_ptr<Object> object);
+    void onContentChanged(const QString &newContent);
+};
+
+#endif // WIKILINKS_H
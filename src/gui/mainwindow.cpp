@@ -28,12 +28,14 @@
 #include <QTimer>
 #include <QCloseEvent>
 #include <QKeyEvent>
+#include <QFutureWatcher>
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
     , ui(new Ui::MainWindow)
     , m_initialized(false)
     , m_zoomFactor(1.0)
+    , m_catalogGeneration(0)
 {
     ui->setupUi(this);
     initializeApplication();
@@ -434,17 +436,24 @@ void MainWindow::openDocument()
 {
     if (!confirmClose()) return;
     
-    QStringList documentIds = m_note->listDocuments();
-    if (documentIds.isEmpty()) {
-        showInfoMessage("No Documents", "No documents found. Create a new document first.");
-        return;
-    }
-    
-    bool ok;
-    QString documentId = QInputDialog::getItem(this, "Open Document", "Select document:", documentIds, 0, false, &ok);
-    if (ok && !documentId.isEmpty()) {
-        m_note->loadDocument(documentId);
-    }
+    // The list is read on the storage thread; the dialog opens once it arrives
+    auto *watcher = new QFutureWatcher<QStringList>(this);
+    connect(watcher, &QFutureWatcher<QStringList>::finished, this, [this, watcher]() {
+        QStringList documentIds = watcher->result();
+        watcher->deleteLater();
+        
+        if (documentIds.isEmpty()) {
+            showInfoMessage("No Documents", "No documents found. Create a new document first.");
+            return;
+        }
+        
+        bool ok;
+        QString documentId = QInputDialog::getItem(this, "Open Document", "Select document:", documentIds, 0, false, &ok);
+        if (ok && !documentId.isEmpty()) {
+            m_note->loadDocument(documentId);
+        }
+    });
+    watcher->setFuture(m_note->listDocuments());
 }
 
 void MainWindow::saveDocument()
@@ -709,7 +718,15 @@ void MainWindow::onModifiedChanged(bool modified)
 
 void MainWindow::onPageChanged(std::shared_ptr<Page> page)
 {
+    if (m_currentPage) {
+        disconnect(m_currentPage.get(), &Page::objectSelectionChanged, this, &MainWindow::onObjectSelectionChanged);
+    }
+    
+    // Pages emit this once per batch, so select-all refreshes the actions once
     m_currentPage = page;
+    if (m_currentPage) {
+        connect(m_currentPage.get(), &Page::objectSelectionChanged, this, &MainWindow::onObjectSelectionChanged);
+    }
     updateActions();
 }
 
@@ -747,7 +764,9 @@ void MainWindow::onObjectRemoved(std::shared_ptr<Page> object)
 void MainWindow::onDocumentTreeItemClicked(QTreeWidgetItem *item, int column)
 {
     Q_UNUSED(column)
-    if (item && item->data(0, Qt::UserRole).isValid()) {
+    if (item && item->data(0, Qt::UserRole + 1).toBool()) {
+        appendDocumentTreeRows();
+    } else if (item && item->data(0, Qt::UserRole).isValid()) {
         QString documentId = item->data(0, Qt::UserRole).toString();
         m_note->loadDocument(documentId);
     }
@@ -791,20 +810,56 @@ void MainWindow::updateWindowTitle()
 void MainWindow::updateDocumentTree()
 {
     m_documentTree->clear();
+    m_catalogCursor = Storage::CatalogCursor();
+    ++m_catalogGeneration;
+    appendDocumentTreeRows();
+}
+
+void MainWindow::appendDocumentTreeRows()
+{
+    const int rowsPerFetch = 100;
     
-    QStringList documentIds = m_note->listDocuments();
-    for (const QString &documentId : documentIds) {
-        auto document = m_note->m_storage->loadDocument(documentId);
-        if (document) {
-            QTreeWidgetItem *item = new QTreeWidgetItem(m_documentTree);
-            item->setText(0, document->title());
-            item->setData(0, Qt::UserRole, documentId);
-            
-            if (m_currentDocument && documentId == m_currentDocument->id()) {
-                item->setSelected(true);
-            }
+    // Drop the trailing "more" placeholder before appending the next rows
+    int count = m_documentTree->topLevelItemCount();
+    if (count > 0 && m_documentTree->topLevelItem(count - 1)->data(0, Qt::UserRole + 1).toBool()) {
+        delete m_documentTree->takeTopLevelItem(count - 1);
+    }
+    
+    // Rows arrive from the storage thread; a fetch overtaken by a rebuild is dropped
+    const int generation = m_catalogGeneration;
+    auto *watcher = new QFutureWatcher<AsyncStorage::CatalogPage>(this);
+    connect(watcher, &QFutureWatcher<AsyncStorage::CatalogPage>::finished, this, [this, watcher, generation]() {
+        const AsyncStorage::CatalogPage page = watcher->result();
+        watcher->deleteLater();
+        if (generation == m_catalogGeneration) {
+            addDocumentTreeRows(page);
+        }
+    });
+    watcher->setFuture(m_note->documentCatalog(rowsPerFetch, m_catalogCursor));
+}
+
+void MainWindow::addDocumentTreeRows(const AsyncStorage::CatalogPage &page)
+{
+    for (const auto &entry : page.entries) {
+        QTreeWidgetItem *item = new QTreeWidgetItem(m_documentTree);
+        item->setText(0, entry.title);
+        item->setData(0, Qt::UserRole, entry.id);
+        item->setToolTip(0, QString("%1 page(s)\nModified %2%3")
+                                .arg(entry.pageCount)
+                                .arg(entry.modifiedDate.toString(Qt::TextDate))
+                                .arg(entry.tags.isEmpty() ? QString() : "\nTags: " + entry.tags.join(", ")));
+        
+        if (m_currentDocument && entry.id == m_currentDocument->id()) {
+            item->setSelected(true);
         }
     }
+    
+    m_catalogCursor = page.next;
+    if (!page.next.isNull()) {
+        QTreeWidgetItem *more = new QTreeWidgetItem(m_documentTree);
+        more->setText(0, "More...");
+        more->setData(0, Qt::UserRole + 1, true);
+    }
 }
 
 void MainWindow::updatePageTabs()
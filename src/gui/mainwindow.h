@@ -10,6 +10,7 @@
 #include <QTabWidget>
 #include <QAction>
 #include <QActionGroup>
+#include "../core/asyncstorage.h"
 #include <memory>
 
 QT_BEGIN_NAMESPACE
@@ -168,6 +169,8 @@ private:
     // State
     bool m_initialized;
     double m_zoomFactor;
+    Storage::CatalogCursor m_catalogCursor;   // next rows for the document tree
+    int m_catalogGeneration;                  // bumped when the tree is rebuilt
     
     // Setup methods
     void setupUI();
@@ -180,6 +183,8 @@ private:
     // UI update methods
     void updateWindowTitle();
     void updateDocumentTree();
+    void appendDocumentTreeRows();
+    void addDocumentTreeRows(const AsyncStorage::CatalogPage &page);
     void updatePageTabs();
     void updateActions();
     void updateStatusBar();
@@ -17,6 +17,7 @@
 #include <QColorDialog>
 #include <QMessageBox>
 #include <QApplication>
+#include <QSet>
 
 ObjectSelector::ObjectSelector(QWidget *parent)
     : QDockWidget("Object Properties", parent)
@@ -33,9 +34,18 @@ void ObjectSelector::setPage(std::shared_ptr<Page> page)
 {
     if (m_page == page) return;
     
+    if (m_page) {
+        disconnect(m_page.get(), &Page::objectsChanged, this, &ObjectSelector::onPageObjectsChanged);
+    }
+    
     m_page = page;
     m_selectedObject.reset();
     
+    // Page changes arrive once per batch rather than once per object
+    if (m_page) {
+        connect(m_page.get(), &Page::objectsChanged, this, &ObjectSelector::onPageObjectsChanged);
+    }
+    
     updateObjectTree();
     updatePropertyEditors();
     updateButtons();
@@ -81,11 +91,6 @@ void ObjectSelector::addObject(std::shared_ptr<Object> object)
         Q_UNUSED(bounds)
         updateObject(object);
     });
-    connect(object.get(), &Object::selectionChanged, this, [this, object](bool selected) {
-        if (selected) {
-            setSelectedObject(object);
-        }
-    });
     connect(object.get(), &Object::layerChanged, this, [this, object](int layer) {
         Q_UNUSED(layer)
         updateObject(object);
@@ -100,6 +105,8 @@ void ObjectSelector::removeObject(std::shared_ptr<Object> object)
 {
     if (!object) return;
     
+    disconnect(object.get(), nullptr, this, nullptr);
+    
     // Find and remove the item
     for (int i = 0; i < m_objectTree->topLevelItemCount(); ++i) {
         QTreeWidgetItem *item = m_objectTree->topLevelItem(i);
@@ -484,6 +491,42 @@ void ObjectSelector::onObjectTreeItemClicked(QTreeWidgetItem *item, int column)
     }
 }
 
+void ObjectSelector::onPageObjectsChanged(const Page::ChangeSet &changes)
+{
+    if (!changes.removed.isEmpty()) {
+        QSet<Object *> removed;
+        for (const auto &object : changes.removed) {
+            disconnect(object.get(), nullptr, this, nullptr);
+            removed.insert(object.get());
+        }
+        
+        // One pass over the tree however many objects went
+        for (int i = m_objectTree->topLevelItemCount() - 1; i >= 0; --i) {
+            QTreeWidgetItem *item = m_objectTree->topLevelItem(i);
+            if (removed.contains(item->data(0, Qt::UserRole).value<std::shared_ptr<Object>>().get())) {
+                delete item;
+            }
+        }
+        if (m_selectedObject && removed.contains(m_selectedObject.get())) {
+            setSelectedObject(nullptr);
+        }
+    }
+    
+    for (const auto &object : changes.added) {
+        addObject(object);
+    }
+    
+    if (changes.selectionChanged && m_page) {
+        // The current object stays while it is selected; otherwise the topmost selected one takes over
+        std::shared_ptr<Object> selected = m_selectedObject;
+        if (!selected || !selected->isSelected()) {
+            const QVector<std::shared_ptr<Object>> selectedObjects = m_page->selectedObjects();
+            selected = selectedObjects.isEmpty() ? nullptr : selectedObjects.last();
+        }
+        setSelectedObject(selected);
+    }
+}
+
 void ObjectSelector::onObjectTreeItemChanged(QTreeWidgetItem *item, int column)
 {
     Q_UNUSED(item)
@@ -13,9 +13,9 @@
 #include <QCheckBox>
 #include <QComboBox>
 #include <memory>
+#include "../core/page.h"
 
 // Forward declarations
-class Page;
 class Object;
 
 /**
@@ -61,6 +61,7 @@ private slots:
     void onBringForwardClicked();
     void onSendBackwardClicked();
     void onDuplicateObjectClicked();
+    void onPageObjectsChanged(const Page::ChangeSet &changes);
     
     // Property change slots
     void onPositionChanged();
@@ -4,6 +4,7 @@
 #include "../core/textobject.h"
 #include "../core/drawingobject.h"
 #include <QPainter>
+#include <QPaintEvent>
 #include <QMouseEvent>
 #include <QWheelEvent>
 #include <QKeyEvent>
@@ -12,6 +13,14 @@
 #include <QDebug>
 #include <cmath>
 
+namespace {
+
+const int TileSize = 256;                           // device pixels
+const int TileCost = TileSize * TileSize * 4 / 1024; // kilobytes
+const int TileCacheLimit = 64 * 1024;               // kilobytes
+
+} // namespace
+
 PageCanvas::PageCanvas(QWidget *parent)
     : QWidget(parent)
     , m_zoomFactor(1.0)
@@ -23,6 +32,8 @@ PageCanvas::PageCanvas(QWidget *parent)
     , m_snapToGrid(false)
     , m_dragging(false)
 {
+    m_tiles.setMaxCost(TileCacheLimit);
+    
     setFocusPolicy(Qt::StrongFocus);
     setMouseTracking(true);
     setMinimumSize(400, 300);
@@ -36,7 +47,19 @@ void PageCanvas::setPage(std::shared_ptr<Page> page)
 {
     if (m_page == page) return;
     
+    if (m_page) {
+        disconnect(m_page.get(), &Page::damaged, this, &PageCanvas::onPageDamaged);
+    }
+    
+    // Damage is only heard from the page on screen, so other pages' tiles would go stale
     m_page = page;
+    m_tiles.clear();
+    m_liveObjects.clear();
+    m_livePaintedRects.clear();
+    if (m_page) {
+        m_page->requestLoad();
+        connect(m_page.get(), &Page::damaged, this, &PageCanvas::onPageDamaged);
+    }
     update();
     emit pageChanged(m_page);
 }
@@ -156,13 +179,12 @@ QPoint PageCanvas::snapToGrid(const QPoint &point) const
 
 void PageCanvas::paintEvent(QPaintEvent *event)
 {
-    Q_UNUSED(event)
-    
     QPainter painter(this);
     painter.setRenderHint(QPainter::Antialiasing);
     
     // Fill background
-    painter.fillRect(rect(), QColor(240, 240, 240));
+    const QRect exposed = event->rect();
+    painter.fillRect(exposed, QColor(240, 240, 240));
     
     if (!m_page) {
         painter.setPen(Qt::gray);
@@ -181,17 +203,21 @@ void PageCanvas::paintEvent(QPaintEvent *event)
         drawGrid(painter);
     }
     
-    // Draw page background
-    QSize pageSize = m_page->size();
-    painter.fillRect(QRect(QPoint(0, 0), pageSize), m_page->backgroundColor());
+    // Draw page content: cached tiles first, which carry the page background,
+    // then the border and the objects being worked on
+    const QRect viewport = screenToPage(exposed).adjusted(-1, -1, 1, 1);
+    updateLiveObjects();
+    drawTiles(painter, viewport);
     
-    // Draw page border
     painter.setPen(QPen(Qt::black, 1 / m_zoomFactor));
     painter.setBrush(Qt::NoBrush);
-    painter.drawRect(QRect(QPoint(0, 0), pageSize));
+    painter.drawRect(QRect(QPoint(0, 0), m_page->size()));
     
-    // Draw page content
-    m_page->paint(painter, screenToPage(rect()));
+    for (const auto &object : m_liveObjects) {
+        if (object->isVisible()) {
+            object->paint(painter, viewport);
+        }
+    }
     
     painter.restore();
     
@@ -237,8 +263,6 @@ void PageCanvas::mousePressEvent(QMouseEvent *event)
         m_mode = PanMode;
         m_dragging = true;
     }
-    
-    update();
 }
 
 void PageCanvas::mouseMoveEvent(QMouseEvent *event)
@@ -248,6 +272,8 @@ void PageCanvas::mouseMoveEvent(QMouseEvent *event)
     QPoint delta = event->pos() - m_lastMousePos;
     m_lastMousePos = event->pos();
     
+    // Only what changed is repainted: moved objects report their old and new
+    // areas through the page's damage, the selection rectangle its own
     if (m_dragging && m_draggedObject) {
         updateDrag(event->pos());
     } else if (m_selecting) {
@@ -255,8 +281,6 @@ void PageCanvas::mouseMoveEvent(QMouseEvent *event)
     } else if (m_mode == PanMode && m_dragging) {
         setViewportOffset(m_viewportOffset + delta);
     }
-    
-    update();
 }
 
 void PageCanvas::mouseReleaseEvent(QMouseEvent *event)
@@ -275,8 +299,6 @@ void PageCanvas::mouseReleaseEvent(QMouseEvent *event)
             m_dragging = false;
         }
     }
-    
-    update();
 }
 
 void PageCanvas::wheelEvent(QWheelEvent *event)
@@ -312,7 +334,6 @@ void PageCanvas::keyPressEvent(QKeyEvent *event)
     case Qt::Key_Delete:
     case Qt::Key_Backspace:
         m_page->deleteSelectedObjects();
-        update();
         break;
         
     case Qt::Key_Escape:
@@ -398,6 +419,162 @@ void PageCanvas::drawSelection(QPainter &painter)
     painter.drawRect(m_selectionRect);
 }
 
+void PageCanvas::updateSelectionArea(const QRect &oldRect)
+{
+    // The dashed outline is 2 pixels wide and centered on the rectangle
+    QRegion area;
+    if (!oldRect.isEmpty()) {
+        area += oldRect.adjusted(-2, -2, 2, 2);
+    }
+    if (m_selecting && !m_selectionRect.isEmpty()) {
+        area += m_selectionRect.adjusted(-2, -2, 2, 2);
+    }
+    if (!area.isEmpty()) {
+        update(area);
+    }
+}
+
+void PageCanvas::onPageDamaged(const QRegion &region)
+{
+    // Live objects are not in the tiles, so damage covering only where they
+    // were or are now leaves the tiles valid; anything else changed under them
+    // is picked up when they leave the live layer
+    QRegion liveArea;
+    for (const auto &object : m_liveObjects) {
+        QRect &painted = m_livePaintedRects[object.get()];
+        const QRect current = Page::paintedRect(object->bounds());
+        liveArea += painted;
+        liveArea += current;
+        painted = current;
+    }
+    for (const QRect &rect : region.subtracted(liveArea)) {
+        invalidateTiles(rect);
+    }
+    
+    // Page coordinates are truncated on the way to the screen, so pad a pixel
+    QRegion area;
+    for (const QRect &rect : region) {
+        area += pageToScreen(rect).adjusted(-1, -1, 2, 2);
+    }
+    update(area);
+}
+
+void PageCanvas::drawTiles(QPainter &painter, const QRect &viewport)
+{
+    TileKey key;
+    key.pageId = m_page->id();
+    key.zoom = qRound(m_zoomFactor * 100);
+    key.pixelRatio = qRound(devicePixelRatioF() * 100);
+    
+    const qreal scale = key.zoom / 100.0 * key.pixelRatio / 100.0;
+    const int firstColumn = static_cast<int>(std::floor(viewport.left() * scale / TileSize));
+    const int lastColumn = static_cast<int>(std::floor((viewport.right() + 1) * scale / TileSize));
+    const int firstRow = static_cast<int>(std::floor(viewport.top() * scale / TileSize));
+    const int lastRow = static_cast<int>(std::floor((viewport.bottom() + 1) * scale / TileSize));
+    
+    QSet<const Object *> excluded;
+    for (const auto &object : m_liveObjects) {
+        excluded.insert(object.get());
+    }
+    
+    painter.save();
+    painter.setRenderHint(QPainter::SmoothPixmapTransform);
+    for (key.row = firstRow; key.row <= lastRow; ++key.row) {
+        for (key.column = firstColumn; key.column <= lastColumn; ++key.column) {
+            QPixmap *pixmap = tile(key, excluded);
+            if (pixmap) {
+                painter.drawPixmap(tileRect(key), *pixmap, QRectF(0, 0, TileSize, TileSize));
+            }
+        }
+    }
+    painter.restore();
+}
+
+QPixmap *PageCanvas::tile(const TileKey &key, const QSet<const Object *> &excluded)
+{
+    QPixmap *cached = m_tiles.object(key);
+    if (cached) {
+        return cached;
+    }
+    
+    const qreal scale = key.zoom / 100.0 * key.pixelRatio / 100.0;
+    QPixmap *pixmap = new QPixmap(TileSize, TileSize);
+    pixmap->fill(Qt::transparent);
+    
+    QPainter painter(pixmap);
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.translate(-key.column * TileSize, -key.row * TileSize);
+    painter.scale(scale, scale);
+    m_page->paint(painter, tileRect(key).toAlignedRect(), excluded);
+    painter.end();
+    
+    m_tiles.insert(key, pixmap, TileCost);
+    return m_tiles.object(key);
+}
+
+QRectF PageCanvas::tileRect(const TileKey &key)
+{
+    // The page area a tile covers, in page coordinates
+    const qreal size = TileSize / (key.zoom / 100.0 * key.pixelRatio / 100.0);
+    return QRectF(key.column * size, key.row * size, size, size);
+}
+
+void PageCanvas::invalidateTiles(const QRect &pageRect)
+{
+    // Tiles of every zoom level cover the area, not just the one on screen
+    const QRectF area(pageRect);
+    const QList<TileKey> keys = m_tiles.keys();
+    for (const TileKey &key : keys) {
+        if (tileRect(key).intersects(area)) {
+            m_tiles.remove(key);
+        }
+    }
+}
+
+QRegion PageCanvas::updateLiveObjects()
+{
+    QVector<std::shared_ptr<Object>> live;
+    if (m_page) {
+        if (m_dragging && m_draggedObject) {
+            live = m_page->selectedObjects();
+        }
+        
+        // Text being typed and strokes being drawn change with every event
+        for (const auto &object : m_page->objectsInRect(screenToPage(rect()))) {
+            bool working = false;
+            if (object->type() == Object::TextObject) {
+                working = std::static_pointer_cast<TextObject>(object)->isEditing();
+            } else if (object->type() == Object::DrawingObject) {
+                working = std::static_pointer_cast<DrawingObject>(object)->isDrawing();
+            }
+            if (working && !live.contains(object)) {
+                live.append(object);
+            }
+        }
+    }
+    
+    // Objects joining or leaving the live layer are in the tiles under them, or missing from them
+    QRegion changed;
+    for (const auto &object : m_liveObjects) {
+        if (!live.contains(object)) {
+            changed += m_livePaintedRects.take(object.get());
+            changed += Page::paintedRect(object->bounds());
+        }
+    }
+    for (const auto &object : live) {
+        if (!m_liveObjects.contains(object)) {
+            const QRect painted = Page::paintedRect(object->bounds());
+            m_livePaintedRects.insert(object.get(), painted);
+            changed += painted;
+        }
+    }
+    for (const QRect &rect : changed) {
+        invalidateTiles(rect);
+    }
+    m_liveObjects = live;
+    return changed;
+}
+
 void PageCanvas::drawViewport(QPainter &painter)
 {
     // This method can be used to draw viewport indicators
@@ -431,8 +608,10 @@ void PageCanvas::updateSelection(const QPoint &point)
 {
     if (!m_selecting) return;
     
+    const QRect oldRect = m_selectionRect;
     m_selectionEnd = point;
     m_selectionRect = QRect(m_selectionStart, m_selectionEnd).normalized();
+    updateSelectionArea(oldRect);
 }
 
 void PageCanvas::finishSelection()
@@ -447,13 +626,17 @@ void PageCanvas::finishSelection()
         emit selectionChanged();
     }
     
+    const QRect oldRect = m_selectionRect;
     m_selectionRect = QRect();
+    updateSelectionArea(oldRect);
 }
 
 void PageCanvas::cancelSelection()
 {
+    const QRect oldRect = m_selectionRect;
     m_selecting = false;
     m_selectionRect = QRect();
+    updateSelectionArea(oldRect);
 }
 
 void PageCanvas::startDrag(std::shared_ptr<Object> object, const QPoint &point)
@@ -461,6 +644,9 @@ void PageCanvas::startDrag(std::shared_ptr<Object> object, const QPoint &point)
     m_draggedObject = object;
     m_dragStartPos = point;
     m_dragging = true;
+    
+    // Lift the selection out of the tiles before it starts moving
+    updateLiveObjects();
 }
 
 void PageCanvas::updateDrag(const QPoint &point)
@@ -474,6 +660,7 @@ void PageCanvas::updateDrag(const QPoint &point)
         pageDelta = snapToGrid(pageDelta) - snapToGrid(QPoint(0, 0));
     }
     
+    // Only live objects move, so the tiles under them stay valid
     m_page->moveSelectedObjects(pageDelta);
     m_dragStartPos = point;
 }
@@ -482,12 +669,16 @@ void PageCanvas::finishDrag()
 {
     m_dragging = false;
     m_draggedObject.reset();
+    
+    // The dropped objects are painted back into the tiles at their own layer
+    onPageDamaged(updateLiveObjects());
 }
 
 void PageCanvas::cancelDrag()
 {
     m_dragging = false;
     m_draggedObject.reset();
+    onPageDamaged(updateLiveObjects());
 }
 
 void PageCanvas::updateViewport()
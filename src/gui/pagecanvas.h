@@ -7,8 +7,14 @@
 #include <QWheelEvent>
 #include <QKeyEvent>
 #include <QScrollArea>
+#include <QCache>
+#include <QHash>
+#include <QPixmap>
+#include <QSet>
+#include <QVector>
 #include <QPoint>
 #include <QRect>
+#include <QRegion>
 #include <QSize>
 #include <memory>
 
@@ -22,6 +28,10 @@ class Object;
  * This widget provides the main drawing area where users can view and interact
  * with page objects. It handles mouse input for object selection, manipulation,
  * and drawing operations.
+ *
+ * Page content is rendered into cached tiles that are only redrawn where the
+ * page reports damage. Objects being dragged, edited or drawn on change on
+ * every event, so they are left out of the tiles and painted on top instead.
  */
 class PageCanvas : public QWidget
 {
@@ -82,6 +92,9 @@ protected:
     void keyPressEvent(QKeyEvent *event) override;
     void resizeEvent(QResizeEvent *event) override;
 
+private slots:
+    void onPageDamaged(const QRegion &region);
+
 private:
     std::shared_ptr<Page> m_page;
     double m_zoomFactor;
@@ -112,6 +125,32 @@ private:
     std::shared_ptr<Object> m_draggedObject;
     QPoint m_dragStartPos;
     
+    // Rendered page content, in square tiles of device pixels
+    struct TileKey {
+        QString pageId;
+        int zoom;           // zoom factor in percent
+        int pixelRatio;     // devicePixelRatio in percent
+        int column;
+        int row;
+        
+        bool operator==(const TileKey &other) const
+        {
+            return pageId == other.pageId && zoom == other.zoom && pixelRatio == other.pixelRatio &&
+                   column == other.column && row == other.row;
+        }
+        friend size_t qHash(const TileKey &key, size_t seed = 0)
+        {
+            return qHash(key.pageId, seed) ^ qHash((static_cast<quint64>(static_cast<quint32>(key.column)) << 32) |
+                                                   static_cast<quint32>(key.row), seed) ^
+                   static_cast<size_t>(key.zoom * 1009 + key.pixelRatio);
+        }
+    };
+    QCache<TileKey, QPixmap> m_tiles;
+    
+    // Objects painted over the tiles rather than into them, in stacking order
+    QVector<std::shared_ptr<Object>> m_liveObjects;
+    QHash<const Object *, QRect> m_livePaintedRects;   // where each was last painted
+    
     // Helper methods
     QPoint screenToPage(const QPoint &screenPoint) const;
     QPoint pageToScreen(const QPoint &pagePoint) const;
@@ -121,6 +160,13 @@ private:
     void drawGrid(QPainter &painter);
     void drawSelection(QPainter &painter);
     void drawViewport(QPainter &painter);
+    void updateSelectionArea(const QRect &oldRect);
+    
+    void drawTiles(QPainter &painter, const QRect &viewport);
+    QPixmap *tile(const TileKey &key, const QSet<const Object *> &excluded);
+    static QRectF tileRect(const TileKey &key);
+    void invalidateTiles(const QRect &pageRect);
+    QRegion updateLiveObjects();
     
     std::shared_ptr<Object> objectAt(const QPoint &point) const;
     QVector<std::shared_ptr<Object>> objectsInRect(const QRect &rect) const;